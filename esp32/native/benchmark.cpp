@@ -0,0 +1,231 @@
+// Runs compiled programs (.mkb files) on the host and reports the executed instructions and
+// calls per second, the time per call of each function, thus per block type, and the number
+// of superinstructions of each kind created when loading the programs.
+//
+// Usage: vmBenchmark [--runs n] [--reference] [--machines m] [file or directory ...]
+//
+// Without files, the programs of the corpus are run. Each program is loaded and run until
+// all its threads ended, n times (5 by default). --reference loads the programs without
+// superinstructions. --machines also runs each program on m machines at once, each on a
+// thread of its own, and reports the runs per second against a single machine. The VM is
+// built with MACHINE_PROFILE to count instructions and calls, the times thus include the
+// cost of profiling each call.
+#include <Arduino.h>
+#include <dirent.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "machine.h"
+#include "host.h"
+#include "bytecode.h"
+
+const unsigned long TIMEOUT = 10000;
+
+typedef struct
+{
+    std::string path;
+    std::string name;
+    double seconds;
+    uint64_t instructions;
+    uint64_t calls;
+    // calls and cycles of each function
+    std::vector<machine::FunctionProfile> functions;
+    std::vector<machine::FusionCount> fusions;
+} Result;
+
+void addPrograms(const std::string &path, std::vector<std::string> &programs)
+{
+    DIR *directory = opendir(path.c_str());
+    if (directory == NULL)
+    {
+        programs.push_back(path);
+        return;
+    }
+    std::vector<std::string> found;
+    while (auto entry = readdir(directory))
+    {
+        std::string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".mkb") == 0)
+            found.push_back(path + "/" + name);
+    }
+    closedir(directory);
+    std::sort(found.begin(), found.end());
+    programs.insert(programs.end(), found.begin(), found.end());
+}
+
+bool run(const std::string &path, int runs, Result &result)
+{
+    std::vector<uint8_t> program;
+    if (!host::readFile(path, program))
+    {
+        fprintf(stderr, "Cannot read %s\n", path.c_str());
+        return false;
+    }
+
+    result.path = path;
+    result.name = path.substr(path.find_last_of('/') + 1);
+    result.seconds = 0;
+    for (int i = 0; i < runs; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (!host::load(program))
+        {
+            fprintf(stderr, "%s was not loaded\n", path.c_str());
+            return false;
+        }
+        if (!host::runUntilIdle(TIMEOUT))
+        {
+            fprintf(stderr, "%s did not end within %lu ms\n", path.c_str(), TIMEOUT);
+            return false;
+        }
+        result.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    result.seconds /= runs;
+    result.fusions = host::machine().superinstructionCounts();
+
+    // the profile is cleared when loading, thus holds the last run
+    result.instructions = host::machine().executedInstructions();
+    result.calls = 0;
+    result.functions.clear();
+    for (uint16_t functionNr = 0; host::machine().functionProfile(functionNr) != NULL; functionNr++)
+    {
+        result.functions.push_back(*host::machine().functionProfile(functionNr));
+        result.calls += host::machine().functionProfile(functionNr)->calls;
+    }
+    return true;
+}
+
+// Runs the program n times on each of the given number of machines, each on a thread of its
+// own. Returns the runs per second of all machines together, or 0 if a run failed.
+double runsPerSecond(const std::string &path, int runs, int machineCount)
+{
+    std::vector<uint8_t> program;
+    if (!host::readFile(path, program))
+        return 0;
+
+    std::vector<std::unique_ptr<machine::Machine>> machines;
+    for (int i = 0; i < machineCount; i++)
+        machines.emplace_back(new machine::Machine());
+    std::vector<char> failed(machineCount, false);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < machineCount; i++)
+        threads.emplace_back([&, i]()
+                             {
+                                 for (int run = 0; run < runs && !failed[i]; run++)
+                                     failed[i] = !host::load(*machines[i], program) ||
+                                                 !host::runUntilIdle(*machines[i], TIMEOUT); });
+    for (auto &thread : threads)
+        thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (auto machineFailed : failed)
+        if (machineFailed)
+        {
+            fprintf(stderr, "%s failed on %d machines\n", path.c_str(), machineCount);
+            return 0;
+        }
+    return runs * machineCount / seconds;
+}
+
+void print(const Result &result)
+{
+    printf("%-22s %10.3f %12llu %10.2f %11llu %10.2f\n", result.name.c_str(), result.seconds * 1000,
+           (unsigned long long)result.instructions, result.instructions / result.seconds / 1e6,
+           (unsigned long long)result.calls, result.calls / result.seconds / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    int runs = 5;
+    int machineCount = 1;
+    std::vector<std::string> programs;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        if (argument == "--runs" && i + 1 < argc)
+            runs = std::max(1, atoi(argv[++i]));
+        else if (argument == "--machines" && i + 1 < argc)
+            machineCount = std::max(1, atoi(argv[++i]));
+        else if (argument == "--reference")
+            machine::optimizeCode = false;
+        else
+            addPrograms(argument, programs);
+    }
+    if (programs.empty())
+        addPrograms(CORPUS_DIR, programs);
+
+    host::setup();
+
+    std::vector<Result> results;
+    bool failed = false;
+    for (auto &path : programs)
+    {
+        Result result;
+        Serial.enabled = false;
+        bool ok = run(path, runs, result);
+        Serial.enabled = true;
+        if (ok)
+            results.push_back(result);
+        else
+            failed = true;
+    }
+
+    printf("%-22s %10s %12s %10s %11s %10s\n", "program", "ms/run", "instructions", "Minstr/s", "calls", "Mcalls/s");
+    for (auto &result : results)
+        print(result);
+
+    // time per call of each function, over all programs
+    printf("\n%-30s %11s %10s\n", "function", "calls", "ns/call");
+    for (uint16_t functionNr = 0; host::machine().functionProfile(functionNr) != NULL; functionNr++)
+    {
+        uint64_t calls = 0, cycles = 0;
+        for (auto &result : results)
+        {
+            calls += result.functions[functionNr].calls;
+            cycles += result.functions[functionNr].cycles;
+        }
+        if (calls == 0)
+            continue;
+        const char *name = bytecode::fn::name(functionNr);
+        printf("%3u %-26s %11llu %10.1f\n", functionNr, name == NULL ? "" : name, (unsigned long long)calls,
+               cycles * 1000.0 / ESP.getCpuFreqMHz() / calls);
+    }
+
+    // superinstructions of each kind, over all programs
+    if (!results.empty())
+    {
+        printf("\n%-30s %11s\n", "superinstruction", "count");
+        for (size_t i = 0; i < results[0].fusions.size(); i++)
+        {
+            unsigned count = 0;
+            for (auto &result : results)
+                count += result.fusions[i].count;
+            printf("%-30s %11u\n", results[0].fusions[i].name, count);
+        }
+    }
+
+    // runs per second on one machine and on all machines at once
+    if (machineCount > 1)
+    {
+        char header[32];
+        snprintf(header, sizeof(header), "%d machines", machineCount);
+        printf("\n%-22s %12s %12s %8s\n", "runs/s", "1 machine", header, "scaling");
+        for (auto &result : results)
+        {
+            Serial.enabled = false;
+            double single = runsPerSecond(result.path, runs, 1);
+            double parallel = runsPerSecond(result.path, runs, machineCount);
+            Serial.enabled = true;
+            if (single == 0 || parallel == 0)
+            {
+                failed = true;
+                continue;
+            }
+            printf("%-22s %12.1f %12.1f %8.2f\n", result.name.c_str(), single, parallel, parallel / single);
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,560 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <initializer_list>
+
+// Builds programs in the format produced by the compiler of the frontend (CodeBuffer.ts and
+// compile.ts): the header, the thread table, the constant pool and the code of each thread.
+// Used by the tests and to generate the benchmark corpus.
+namespace bytecode
+{
+    // operations of the extended opcode page, see VmSpecification.md
+    enum class Native : uint8_t
+    {
+        ADD = 0b00110000,
+        SUB,
+        MUL,
+        DIV,
+        EQ,
+        NEQ,
+        LT,
+        LTE,
+        GT,
+        GTE,
+        AND,
+        OR,
+        NOT,
+        DUP32,
+        DROP32,
+    };
+
+    // function numbers, as in functionTable.ts of the frontend
+    namespace fn
+    {
+        const uint16_t BASIC_YIELD = 0;
+        const uint16_t PIN_SETUP_ON_CHANGE = 1;
+        const uint16_t PIN_WAIT_FOR_CHANGE = 2;
+        const uint16_t PIN_SET = 3;
+        const uint16_t VARIABLES_SET_VAR32 = 4;
+        const uint16_t VARIABLES_GET_VAR32 = 5;
+        const uint16_t MATH_BINARY = 6;
+        const uint16_t LOGIC_COMPARE = 7;
+        const uint16_t BASIC_DELAY = 9;
+        const uint16_t CONTROLS_REPEAT_EXT_DONE = 10;
+        const uint16_t BASIC_END_THREAD = 11;
+        const uint16_t BASIC_POP32 = 12;
+        const uint16_t LOGIC_OPERATION = 13;
+        const uint16_t LOGIC_NEGATE = 14;
+        const uint16_t MATH_NUMBER_PROPERTY = 15;
+        const uint16_t MATH_UNARY = 16;
+        const uint16_t MATH_RANDOM_FLOAT = 17;
+        const uint16_t MATH_CONSTRAIN = 18;
+        const uint16_t PIN_SET_ANALOG = 19;
+        const uint16_t SENSOR_GET_GRAVITY_VALUE = 20;
+        const uint16_t SENSOR_SETUP_ON_GRAVITY_VALUES = 21;
+        const uint16_t SENSOR_WAIT_FOR_GRAVITY_VALUES = 22;
+        const uint16_t TEXT_LOAD = 23;
+        const uint16_t TEXT_NUM_TO_STRING = 24;
+        const uint16_t TEXT_PRINT_STRING = 25;
+        const uint16_t TEXT_BOOL_TO_STRING = 26;
+        const uint16_t TEXT_JOIN_STRING = 27;
+        const uint16_t VARIABLES_GET_RESOURCE_HANDLE = 28;
+        const uint16_t VARIABLES_SET_RESOURCE_HANDLE = 29;
+        const uint16_t GUI_SHOW_BUTTON = 30;
+        const uint16_t BASIC_CALLBACK_READY = 31;
+        const uint16_t PIN_READ_ANALOG = 32;
+        const uint16_t GUI_SHOW_TEXT = 33;
+        const uint16_t MATH_MAP_LINEAR = 34;
+        const uint16_t MATH_MAP_TEMPERATURE = 35;
+        const uint16_t VARIABLES_SET_VAR8 = 36;
+        const uint16_t VARIABLES_GET_VAR8 = 37;
+        const uint16_t COLOUR_GET_CHANNEL = 38;
+        const uint16_t COLOUR_SET_VAR = 39;
+        const uint16_t COLOUR_BLEND = 40;
+        const uint16_t TCS34725_SETUP = 41;
+        const uint16_t TCS34725_GET_RGB = 42;
+        const uint16_t TCS34725_GET_CLEAR = 43;
+        const uint16_t TCS34725_SET_PARAMS = 44;
+        const uint16_t GUI_SHOW_SIGNAL_LIGHT = 45;
+        const uint16_t TEXT_COLOUR_TO_STRING = 46;
+        const uint16_t COLOUR_FROM_HSV = 47;
+        const uint16_t RGB_LED_SETUP = 48;
+        const uint16_t RGB_LED_SET_COLOUR = 49;
+        const uint16_t RGB_SHOW = 50;
+        const uint16_t RGB_SET_BITMAP = 51;
+        const uint16_t BASIC_SETUP_PERIODIC = 52;
+        const uint16_t BASIC_SET_PRIORITY = 53;
+        const uint16_t BASIC_SET_EVENT_QUEUE = 54;
+        const uint16_t BASIC_EVENT_AGE = 55;
+        const uint16_t PIN_EVENT_STATE = 56;
+        const uint16_t BASIC_BACKGROUND_THREAD = 57;
+        const uint16_t BASIC_RUN_IN_BACKGROUND = 58;
+        const uint16_t BASIC_BACKGROUND_ARGUMENT = 59;
+        const uint16_t CHANNEL_SETUP = 60;
+        const uint16_t CHANNEL_WAIT_SLOT = 61;
+        const uint16_t CHANNEL_SEND_NUMBER = 62;
+        const uint16_t CHANNEL_WAIT_VALUE = 63;
+        const uint16_t CHANNEL_RECEIVE_NUMBER = 64;
+        const uint16_t CHANNEL_SEND_HANDLE = 65;
+        const uint16_t CHANNEL_RECEIVE_HANDLE = 66;
+
+        // name of a function as in functionTable.ts, NULL if unknown
+        inline const char *name(uint16_t functionNr)
+        {
+            switch (functionNr)
+            {
+            case 0:
+                return "basicYield";
+            case 1:
+                return "pinSetupOnChange";
+            case 2:
+                return "pinWaitForChange";
+            case 3:
+                return "pinSet";
+            case 4:
+                return "variablesSetVar32";
+            case 5:
+                return "variablesGetVar32";
+            case 6:
+                return "mathBinary";
+            case 7:
+                return "logicCompare";
+            case 9:
+                return "basicDelay";
+            case 10:
+                return "controlsRepeatExtDone";
+            case 11:
+                return "basicEndThread";
+            case 12:
+                return "basicPop32";
+            case 13:
+                return "logicOperation";
+            case 14:
+                return "logicNegate";
+            case 15:
+                return "mathNumberProperty";
+            case 16:
+                return "mathUnary";
+            case 17:
+                return "mathRandomFloat";
+            case 18:
+                return "mathConstrain";
+            case 19:
+                return "pinSetAnalog";
+            case 20:
+                return "sensorGetGravityValue";
+            case 21:
+                return "sensorSetupOnGravityValues";
+            case 22:
+                return "sensorWaitForGravityValues";
+            case 23:
+                return "textLoad";
+            case 24:
+                return "textNumToString";
+            case 25:
+                return "textPrintString";
+            case 26:
+                return "textBoolToString";
+            case 27:
+                return "textJoinString";
+            case 28:
+                return "variablesGetResourceHandle";
+            case 29:
+                return "variablesSetResourceHandle";
+            case 30:
+                return "guiShowButton";
+            case 31:
+                return "basicCallbackReady";
+            case 32:
+                return "pinReadAnalog";
+            case 33:
+                return "guiShowText";
+            case 34:
+                return "mathMapLinear";
+            case 35:
+                return "mathMapTemperature";
+            case 36:
+                return "variablesSetVar8";
+            case 37:
+                return "variablesGetVar8";
+            case 38:
+                return "colourGetChannel";
+            case 39:
+                return "colourSetVar";
+            case 40:
+                return "colourBlend";
+            case 41:
+                return "tcs34725Setup";
+            case 42:
+                return "tcs34725GetRGB";
+            case 43:
+                return "tcs34725GetClear";
+            case 44:
+                return "tcs34725SetParams";
+            case 45:
+                return "guiShowSignalLight";
+            case 46:
+                return "textColourToString";
+            case 47:
+                return "colourFromHSV";
+            case 48:
+                return "rgbLedSetup";
+            case 49:
+                return "rgbLedSetColour";
+            case 50:
+                return "rgbShow";
+            case 51:
+                return "rgbSetBitmap";
+            case 52:
+                return "basicSetupPeriodic";
+            case 53:
+                return "basicSetPriority";
+            case 54:
+                return "basicSetEventQueue";
+            case 55:
+                return "basicEventAge";
+            case 56:
+                return "pinEventState";
+            case 57:
+                return "basicBackgroundThread";
+            case 58:
+                return "basicRunInBackground";
+            case 59:
+                return "basicBackgroundArgument";
+            case 60:
+                return "channelSetup";
+            case 61:
+                return "channelWaitSlot";
+            case 62:
+                return "channelSendNumber";
+            case 63:
+                return "channelWaitValue";
+            case 64:
+                return "channelReceiveNumber";
+            case 65:
+                return "channelSendHandle";
+            case 66:
+                return "channelReceiveHandle";
+            default:
+                return NULL;
+            }
+        }
+    }
+
+    const uint8_t LOAD_GLOBAL32 = 0b01110000;
+    const uint8_t STORE_GLOBAL32 = 0b01110001;
+
+    typedef int Label;
+
+    // Code of a single thread. Jumps refer to labels, the smallest encoding of each jump
+    // is chosen when assembling, like the compiler does.
+    class Code
+    {
+    public:
+        Code &raw(std::initializer_list<uint8_t> bytes)
+        {
+            addBytes(bytes.begin(), bytes.size());
+            return *this;
+        }
+
+        Code &pushUint8(uint8_t value)
+        {
+            addOpcodeWithParameter(0b00, 1, false);
+            return raw({value});
+        }
+
+        Code &pushUint16(uint16_t value)
+        {
+            addOpcodeWithParameter(0b00, 2, false);
+            return raw({(uint8_t)value, (uint8_t)(value >> 8)});
+        }
+
+        Code &pushFloat(float value)
+        {
+            addOpcodeWithParameter(0b00, 4, false);
+            addBytes((const uint8_t *)&value, 4);
+            return *this;
+        }
+
+        Code &push(const void *data, size_t size)
+        {
+            addOpcodeWithParameter(0b00, size, false);
+            addBytes((const uint8_t *)data, size);
+            return *this;
+        }
+
+        Code &call(uint16_t functionNr)
+        {
+            addOpcodeWithParameter(0b11, functionNr, false);
+            return *this;
+        }
+
+        Code &native(Native operation)
+        {
+            return raw({(uint8_t)operation});
+        }
+
+        Code &loadGlobal32(uint16_t offset)
+        {
+            return raw({LOAD_GLOBAL32, (uint8_t)offset, (uint8_t)(offset >> 8)});
+        }
+
+        Code &storeGlobal32(uint16_t offset)
+        {
+            return raw({STORE_GLOBAL32, (uint8_t)offset, (uint8_t)(offset >> 8)});
+        }
+
+        Label label()
+        {
+            labelItems.push_back(-1);
+            return labelItems.size() - 1;
+        }
+
+        // the label refers to the next instruction
+        Code &bind(Label label)
+        {
+            items.push_back(Item{false, 0, 0, {}});
+            labelItems[label] = items.size() - 1;
+            return *this;
+        }
+
+        Code &jump(Label target)
+        {
+            return addJump(0b01, target);
+        }
+
+        Code &jz(Label target)
+        {
+            return addJump(0b10, target);
+        }
+
+        std::vector<uint8_t> assemble() const
+        {
+            // start with the shortest encoding of all jumps and widen them until all fit
+            std::vector<size_t> sizes(items.size());
+            for (size_t i = 0; i < items.size(); i++)
+                sizes[i] = items[i].isJump ? 1 : items[i].bytes.size();
+
+            std::vector<size_t> offsets;
+            bool changed = true;
+            while (changed)
+            {
+                changed = false;
+                offsets = layout(sizes);
+                for (size_t i = 0; i < items.size(); i++)
+                {
+                    if (!items[i].isJump)
+                        continue;
+                    size_t size = encodedSize(jumpOffset(i, offsets, sizes[i]), true);
+                    if (size > sizes[i])
+                    {
+                        sizes[i] = size;
+                        changed = true;
+                    }
+                }
+            }
+
+            std::vector<uint8_t> result;
+            for (size_t i = 0; i < items.size(); i++)
+            {
+                if (!items[i].isJump)
+                {
+                    result.insert(result.end(), items[i].bytes.begin(), items[i].bytes.end());
+                    continue;
+                }
+                encode(result, items[i].opcode, jumpOffset(i, offsets, sizes[i]), sizes[i]);
+            }
+            return result;
+        }
+
+    private:
+        typedef struct
+        {
+            bool isJump;
+            uint8_t opcode;
+            Label target;
+            std::vector<uint8_t> bytes;
+        } Item;
+
+        std::vector<Item> items;
+        // index of the item each label refers to
+        std::vector<int> labelItems;
+
+        void addBytes(const uint8_t *bytes, size_t count)
+        {
+            if (items.empty() || items.back().isJump)
+                items.push_back(Item{false, 0, 0, {}});
+            items.back().bytes.insert(items.back().bytes.end(), bytes, bytes + count);
+        }
+
+        Code &addJump(uint8_t opcode, Label target)
+        {
+            items.push_back(Item{true, opcode, target, {}});
+            return *this;
+        }
+
+        void addOpcodeWithParameter(uint8_t opcode, int32_t parameter, bool isSigned)
+        {
+            std::vector<uint8_t> bytes;
+            encode(bytes, opcode, parameter, encodedSize(parameter, isSigned));
+            addBytes(bytes.data(), bytes.size());
+        }
+
+        std::vector<size_t> layout(const std::vector<size_t> &sizes) const
+        {
+            std::vector<size_t> offsets(items.size() + 1, 0);
+            for (size_t i = 0; i < items.size(); i++)
+                offsets[i + 1] = offsets[i] + sizes[i];
+            return offsets;
+        }
+
+        // forward jumps are relative to the end of the jump, backward jumps to its start
+        int32_t jumpOffset(size_t item, const std::vector<size_t> &offsets, size_t size) const
+        {
+            size_t target = offsets[labelItems[items[item].target]];
+            if (target >= offsets[item] + size)
+                return target - (offsets[item] + size);
+            return (int32_t)target - (int32_t)offsets[item];
+        }
+
+        static size_t encodedSize(int32_t parameter, bool isSigned)
+        {
+            if (isSigned)
+            {
+                if (parameter >= -(1 << 3) && parameter < (1 << 3))
+                    return 1;
+                if (parameter >= -(1 << 11) && parameter < (1 << 11))
+                    return 2;
+                return 3;
+            }
+            if (parameter < (1 << 4))
+                return 1;
+            if (parameter < (1 << 12))
+                return 2;
+            return 3;
+        }
+
+        static void encode(std::vector<uint8_t> &output, uint8_t opcode, int32_t parameter, size_t size)
+        {
+            switch (size)
+            {
+            case 1:
+                output.push_back(opcode << 6 | (parameter & 0xf));
+                break;
+            case 2:
+                output.push_back(opcode << 6 | 0b01 << 4 | (parameter >> 8 & 0xf));
+                output.push_back(parameter & 0xff);
+                break;
+            default:
+                output.push_back(opcode << 6 | 0b10 << 4 | (parameter >> 16 & 0xf));
+                output.push_back(parameter & 0xff);
+                output.push_back(parameter >> 8 & 0xff);
+            }
+        }
+    };
+
+    // controls_repeat_ext as generated by the compiler, running the body the given times
+    template <typename Body>
+    void repeat(Code &code, float times, Body body)
+    {
+        Label loop = code.label();
+        code.pushFloat(times);
+        code.bind(loop);
+        body(code);
+        code.call(fn::CONTROLS_REPEAT_EXT_DONE).jz(loop).native(Native::DROP32);
+    }
+
+    // controls_for as generated by the compiler, counting the global at offset variable
+    // from from while it is below to
+    template <typename Body>
+    void count(Code &code, uint16_t variable, float from, float to, float by, Body body)
+    {
+        Label main = code.label();
+        Label condition = code.label();
+        code.pushFloat(from).storeGlobal32(variable).jump(condition);
+        code.bind(main);
+        body(code);
+        code.loadGlobal32(variable).pushFloat(by).native(Native::ADD).storeGlobal32(variable);
+        code.bind(condition);
+        code.loadGlobal32(variable).pushFloat(to).native(Native::GTE).jz(main);
+    }
+
+    // A program with a fixed number of threads. The stacks of the threads follow the globals,
+    // in the order of the threads.
+    class Program
+    {
+    public:
+        Program(uint16_t threadCount, uint16_t globalsSize, uint8_t version = 1)
+            : threads(threadCount), stackSizes(threadCount, 0), globalsSize(globalsSize), version(version)
+        {
+        }
+
+        // add an entry to the constant pool, returns its offset
+        uint16_t constant(const void *data, size_t size)
+        {
+            uint16_t offset = constantPoolStart() + constants.size();
+            constants.insert(constants.end(), (const uint8_t *)data, (const uint8_t *)data + size);
+            return offset;
+        }
+
+        uint16_t constant(const char *text)
+        {
+            return constant(text, strlen(text) + 1);
+        }
+
+        Code &thread(uint16_t threadNr, uint16_t stackSize)
+        {
+            stackSizes[threadNr] = stackSize;
+            return threads[threadNr];
+        }
+
+        std::vector<uint8_t> build() const
+        {
+            std::vector<std::vector<uint8_t>> codes;
+            for (auto &thread : threads)
+                codes.push_back(thread.assemble());
+
+            uint32_t memorySize = globalsSize;
+            for (auto stackSize : stackSizes)
+                memorySize += stackSize;
+
+            std::vector<uint8_t> result = {'M', 'B', version};
+            addUint16(result, threads.size());
+            addUint16(result, memorySize);
+
+            size_t codeOffset = constantPoolStart() + constants.size();
+            uint32_t stackOffset = globalsSize;
+            for (size_t i = 0; i < threads.size(); i++)
+            {
+                addUint16(result, codeOffset);
+                addUint16(result, stackOffset);
+                codeOffset += codes[i].size();
+                stackOffset += stackSizes[i];
+            }
+
+            result.insert(result.end(), constants.begin(), constants.end());
+            for (auto &code : codes)
+                result.insert(result.end(), code.begin(), code.end());
+            return result;
+        }
+
+    private:
+        std::vector<Code> threads;
+        std::vector<uint16_t> stackSizes;
+        std::vector<uint8_t> constants;
+        uint16_t globalsSize;
+        uint8_t version;
+
+        size_t constantPoolStart() const
+        {
+            return 7 + threads.size() * 4;
+        }
+
+        static void addUint16(std::vector<uint8_t> &output, uint16_t value)
+        {
+            output.push_back(value & 0xff);
+            output.push_back(value >> 8);
+        }
+    };
+}
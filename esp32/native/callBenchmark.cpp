@@ -0,0 +1,112 @@
+// Times the calls of native functions from bytecode: a function registered with typed
+// arguments, the same function behind the former calling convention, a std::function
+// popping each argument through an out-of-line call, and an operation bound when loading.
+// The time of the loop without calls is subtracted. Usage: callBenchmark [--calls n]
+#include <Arduino.h>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include "machine.h"
+#include "host.h"
+#include "bytecode.h"
+
+using namespace bytecode;
+
+// benchmarked functions, not in the function table of the frontend
+const uint16_t FN_TYPED = 250, FN_LEGACY = 251, FN_OPERATION = 252;
+const uint16_t NO_CALL = 0xffff;
+
+float typed(float a, float b)
+{
+    return a * b + 1;
+}
+
+// the former calling convention: the functions took no arguments and accessed the stack of
+// the current thread through out-of-line functions
+machine::Context *legacyContext;
+std::function<void()> legacyFunction;
+
+__attribute__((noinline)) float legacyPopFloat()
+{
+    return machine::pop<float>(*legacyContext);
+}
+
+__attribute__((noinline)) void legacyPushFloat(float value)
+{
+    machine::push<float>(*legacyContext, value);
+}
+
+void legacyCall(machine::Context &context)
+{
+    legacyContext = &context;
+    legacyFunction();
+}
+
+// a loop of the given number of calls, each with two arguments and a result
+std::vector<uint8_t> program(uint16_t functionNr, int calls)
+{
+    Program program(1, 4);
+    Code &code = program.thread(0, 32);
+    repeat(code, calls / 10, [&](Code &code)
+           {
+               for (int i = 0; i < 10; i++)
+               {
+                   code.pushFloat(2).pushFloat(3);
+                   if (functionNr == FN_OPERATION)
+                       code.pushUint8(0);
+                   if (functionNr == NO_CALL)
+                       code.native(Native::DROP32);
+                   else
+                       code.call(functionNr);
+                   code.storeGlobal32(0);
+               } });
+    code.call(fn::BASIC_END_THREAD);
+    return program.build();
+}
+
+double seconds(uint16_t functionNr, int calls)
+{
+    Serial.enabled = false;
+    auto start = std::chrono::steady_clock::now();
+    bool ran = host::load(program(functionNr, calls)) && host::runUntilIdle(60000);
+    double result = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Serial.enabled = true;
+    if (!ran)
+    {
+        fprintf(stderr, "function %u did not run\n", functionNr);
+        exit(1);
+    }
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    int calls = 10000000;
+    if (argc > 2 && std::string(argv[1]) == "--calls")
+        calls = std::max(10, atoi(argv[2]));
+
+    host::setup();
+    machine::registerFunction<FN_TYPED>(typed);
+    legacyFunction = []()
+    {
+        float b = legacyPopFloat();
+        float a = legacyPopFloat();
+        legacyPushFloat(typed(a, b));
+    };
+    machine::registerFunction(FN_LEGACY, legacyCall, 8, 4);
+    machine::registerOperation<FN_OPERATION, 0>(typed);
+    // the time slice never expires
+    hostClock::simulate(true);
+
+    double loop = seconds(NO_CALL, calls);
+    printf("%-18s %10s\n", "function", "ns/call");
+    printf("%-18s %10.2f\n", "typed", (seconds(FN_TYPED, calls) - loop) / calls * 1e9);
+    printf("%-18s %10.2f\n", "std::function", (seconds(FN_LEGACY, calls) - loop) / calls * 1e9);
+    printf("%-18s %10.2f\n", "bound operation", (seconds(FN_OPERATION, calls) - loop) / calls * 1e9);
+    // without superinstructions the operation is popped and dispatched by each call
+    machine::optimizeCode = false;
+    loop = seconds(NO_CALL, calls);
+    printf("%-18s %10.2f\n", "operation", (seconds(FN_OPERATION, calls) - loop) / calls * 1e9);
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include "host.h"
+#include <Arduino.h>
+#include <limits.h>
+#include <malloc.h>
+#include "machine.h"
+#include "resourcePool.h"
+#include "latency.h"
+#include "modules/basic.h"
+#include "modules/math.h"
+#include "modules/logic.h"
+#include "modules/controls.h"
+#include "modules/variables.h"
+#include "modules/text.h"
+#include "modules/colour.h"
+#include "modules/rgbLed.h"
+#include "modules/channel.h"
+#include "modules/modules.h"
+
+// modules.cpp of the firmware includes the modules depending on hardware, of the modules built
+// on the host only the basic module keeps state per thread
+namespace modules
+{
+    void resetThread(machine::Machine &machine, uint16_t threadNr)
+    {
+        basicModule::resetThread(machine, threadNr);
+    }
+}
+
+namespace host
+{
+    void setup()
+    {
+        // Resource handles are stored as 32 bit values, see CMakeLists.txt. Threads would get
+        // arenas of their own, mapped above 4 GB, thus all allocate from the heap.
+        mallopt(M_ARENA_MAX, 1);
+
+        machine::setup();
+        basicModule::setup();
+        logicModule::setup();
+        mathModule::setup();
+        variablesModule::setup();
+        controlsModule::setup();
+        textModule::setup();
+        colourModule::setup();
+        rgbLedModule::setup();
+        channelModule::setup();
+    }
+
+    machine::Machine &machine()
+    {
+        static machine::Machine instance;
+        return instance;
+    }
+
+    bool load(machine::Machine &machine, const std::vector<uint8_t> &program)
+    {
+        basicModule::reset(machine);
+        textModule::reset(machine);
+        rgbLedModule::reset(machine);
+        channelModule::reset(machine);
+        machine.resources.clear();
+        latency::clear(machine);
+
+        // applyCode takes ownership of the buffer
+        uint8_t *buf = (uint8_t *)malloc(program.size());
+        memcpy(buf, program.data(), program.size());
+        machine.applyCode(buf, program.size());
+        return machine.threadCount() > 0;
+    }
+
+    bool load(const std::vector<uint8_t> &program)
+    {
+        return load(machine(), program);
+    }
+
+    void loop(machine::Machine &machine)
+    {
+        textModule::loop(machine);
+        rgbLedModule::loop(machine);
+        basicModule::loop(machine);
+        machine::loop();
+    }
+
+    void loop()
+    {
+        loop(machine());
+    }
+
+    bool runUntilIdle(machine::Machine &machine, unsigned long timeout)
+    {
+        unsigned long start = millis();
+        while (true)
+        {
+            unsigned long idleTime = basicModule::idleTime(machine);
+            if (idleTime == ULONG_MAX)
+                return true;
+            if (millis() - start > timeout)
+                return false;
+            if (idleTime > 0)
+                delayMicroseconds(idleTime);
+            loop(machine);
+        }
+    }
+
+    bool runUntilIdle(unsigned long timeout)
+    {
+        return runUntilIdle(machine(), timeout);
+    }
+
+    bool readFile(const std::string &path, std::vector<uint8_t> &content)
+    {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == NULL)
+            return false;
+        content.clear();
+        uint8_t buffer[4096];
+        size_t count;
+        while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+            content.insert(content.end(), buffer, buffer + count);
+        fclose(file);
+        return true;
+    }
+}
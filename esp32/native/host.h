@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include <string>
+
+// Runs programs on the host like microBlocks::loop() does on the ESP32, with the modules
+// which do not depend on hardware: basic, math, logic, controls, variables, text, colour,
+// rgbLed (without LEDs) and channel. Each machine may run on a thread of its own, as long as
+// setup() ran before.
+namespace machine
+{
+    class Machine;
+}
+
+namespace host
+{
+    void setup();
+
+    // the machine used by the functions without a machine parameter, created on first use
+    machine::Machine &machine();
+
+    // Reset the modules and load the program, as when new code arrives. Returns whether
+    // the program was accepted and started.
+    bool load(machine::Machine &machine, const std::vector<uint8_t> &program);
+    bool load(const std::vector<uint8_t> &program);
+
+    // one pass of the main loop of the VM task
+    void loop(machine::Machine &machine);
+    void loop();
+
+    // Run the main loop until all threads ended or wait for events, at most for the given
+    // time in milliseconds. Waits for delays to expire. Returns false on timeout.
+    bool runUntilIdle(machine::Machine &machine, unsigned long timeout);
+    bool runUntilIdle(unsigned long timeout);
+
+    bool readFile(const std::string &path, std::vector<uint8_t> &content);
+}
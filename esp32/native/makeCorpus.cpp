@@ -0,0 +1,194 @@
+// Writes the programs of the benchmark corpus, shaped like the code the compiler generates
+// for the corresponding blocks. Usage: makeCorpus <directory>
+#include <stdio.h>
+#include <string>
+#include "bytecode.h"
+
+using namespace bytecode;
+
+// stack size of each thread, large enough for all programs below
+const uint16_t STACK_SIZE = 64;
+
+// the init thread sets up string variables and LED strips, further threads run loops
+Code &endThread(Code &code)
+{
+    return code.call(fn::BASIC_END_THREAD);
+}
+
+// nested counting loops doing arithmetic on globals
+std::vector<uint8_t> loops()
+{
+    const uint16_t i = 0, j = 4, sum = 8;
+    Program program(1, 12);
+    Code &code = program.thread(0, STACK_SIZE);
+    count(code, i, 0, 300, 1, [&](Code &code)
+          { count(code, j, 0, 300, 1, [&](Code &code)
+                  { code.loadGlobal32(sum).loadGlobal32(i).loadGlobal32(j).native(Native::MUL).pushFloat(7).native(Native::DIV).native(Native::ADD).storeGlobal32(sum); }); });
+    endThread(code);
+    return program.build();
+}
+
+// repeated calls of math functions with an operation
+std::vector<uint8_t> mathCalls()
+{
+    const uint16_t i = 0, sum = 4;
+    Program program(1, 8);
+    Code &code = program.thread(0, STACK_SIZE);
+    count(code, i, 0, 20000, 1, [&](Code &code)
+          {
+              // sum = sum + sin(i) + (i mod 7) ^ 2
+              code.loadGlobal32(sum);
+              code.loadGlobal32(i).pushUint8(0).call(fn::MATH_UNARY).native(Native::ADD);
+              code.loadGlobal32(i).pushFloat(7).pushUint8(5).call(fn::MATH_BINARY);
+              code.pushFloat(2).pushUint8(4).call(fn::MATH_BINARY).native(Native::ADD);
+              code.storeGlobal32(sum); });
+    endThread(code);
+    return program.build();
+}
+
+// building a line of text by joining strings, printed once it has 20 parts
+std::vector<uint8_t> stringJoins()
+{
+    const uint16_t line = 0, i = 4, part = 8;
+    Program program(2, 12);
+    uint16_t empty = program.constant("");
+    uint16_t separator = program.constant(", ");
+
+    Code &init = program.thread(0, STACK_SIZE);
+    init.pushUint16(line).pushUint16(empty).call(fn::TEXT_LOAD).call(fn::VARIABLES_SET_RESOURCE_HANDLE);
+    endThread(init);
+
+    Code &code = program.thread(1, STACK_SIZE);
+    count(code, i, 0, 200, 1, [&](Code &code)
+          {
+              count(code, part, 0, 20, 1, [&](Code &code)
+                    {
+                        // line = line + ", " + i
+                        code.pushUint16(line);
+                        code.pushUint16(line).call(fn::VARIABLES_GET_RESOURCE_HANDLE);
+                        code.pushUint16(separator).call(fn::TEXT_LOAD).call(fn::TEXT_JOIN_STRING);
+                        code.loadGlobal32(part).call(fn::TEXT_NUM_TO_STRING).call(fn::TEXT_JOIN_STRING);
+                        code.call(fn::VARIABLES_SET_RESOURCE_HANDLE); });
+              code.pushUint16(line).call(fn::VARIABLES_GET_RESOURCE_HANDLE).call(fn::TEXT_PRINT_STRING);
+              code.pushUint16(line).pushUint16(empty).call(fn::TEXT_LOAD).call(fn::VARIABLES_SET_RESOURCE_HANDLE); });
+    endThread(code);
+    return program.build();
+}
+
+Code &loadColour(Code &code, uint16_t offset)
+{
+    return code.loadGlobal32(offset).loadGlobal32(offset + 4).loadGlobal32(offset + 8);
+}
+
+// blending between two colour variables and reading the hue of the result
+std::vector<uint8_t> colourBlend()
+{
+    const uint16_t from = 0, to = 12, blended = 24, ratio = 36, hue = 40;
+    Program program(1, 44);
+    Code &code = program.thread(0, STACK_SIZE);
+    code.pushUint16(from).pushFloat(1).pushFloat(0.5).pushFloat(0).call(fn::COLOUR_SET_VAR);
+    code.pushUint16(to).pushFloat(0).pushFloat(0.2).pushFloat(1).call(fn::COLOUR_SET_VAR);
+    count(code, ratio, 0, 1, 0.0001, [&](Code &code)
+          {
+              code.pushUint16(blended);
+              loadColour(code, from);
+              loadColour(code, to);
+              code.loadGlobal32(ratio).call(fn::COLOUR_BLEND).call(fn::COLOUR_SET_VAR);
+              code.loadGlobal32(hue);
+              loadColour(code, blended).pushUint8(3).call(fn::COLOUR_GET_CHANNEL);
+              code.native(Native::ADD).storeGlobal32(hue); });
+    endThread(code);
+    return program.build();
+}
+
+// a rotating bitmap on a 16x16 LED matrix
+std::vector<uint8_t> ledBitmap()
+{
+    const uint16_t angle = 0;
+    const uint16_t led = 0, width = 16, height = 16;
+    Program program(2, 4);
+
+    const uint8_t bitmapWidth = 8, bitmapHeight = 8;
+    const char *rows[bitmapHeight] = {
+        "..####..",
+        ".#....#.",
+        "#.#..#.#",
+        "#......#",
+        "#.#..#.#",
+        "#..##..#",
+        ".#....#.",
+        "..####..",
+    };
+    std::vector<uint8_t> bitmap = {bitmapWidth, 0, bitmapHeight, 0};
+    for (int y = 0; y < bitmapHeight; y++)
+        for (int x = 0; x < bitmapWidth; x++)
+            bitmap.push_back(rows[y][x] == '#' ? 1 : 0);
+    uint16_t bitmapOffset = program.constant(bitmap.data(), bitmap.size());
+
+    Code &init = program.thread(0, STACK_SIZE);
+    init.pushUint16(led).pushUint8(16).pushUint16(width).pushUint16(height).call(fn::RGB_LED_SETUP);
+    endThread(init);
+
+    Code &code = program.thread(1, STACK_SIZE);
+    count(code, angle, 0, 6.28, 0.01, [&](Code &code)
+          {
+              code.pushUint16(led).pushUint16(bitmapOffset);
+              code.pushFloat(0).pushFloat(0).pushFloat(width).pushFloat(height);
+              code.pushFloat(4).pushFloat(4).pushFloat(0.5).loadGlobal32(angle);
+              code.pushUint8(0).pushFloat(1).pushFloat(0.5).pushFloat(0);
+              code.call(fn::RGB_SET_BITMAP);
+              code.pushUint16(led).call(fn::RGB_SHOW); });
+    endThread(code);
+    return program.build();
+}
+
+// a producer sending numbers to a consumer through a channel with a single slot, thus
+// switching threads for each value
+std::vector<uint8_t> channelPingPong()
+{
+    const uint16_t sum = 0, sent = 4, received = 8;
+    const uint16_t channel = 0;
+    Program program(3, 12);
+
+    Code &init = program.thread(0, STACK_SIZE);
+    init.pushUint16(channel).pushFloat(1).pushUint8(0).call(fn::CHANNEL_SETUP);
+    endThread(init);
+
+    Code &producer = program.thread(1, STACK_SIZE);
+    count(producer, sent, 0, 20000, 1, [&](Code &code)
+          { code.pushUint16(channel).call(fn::CHANNEL_WAIT_SLOT).pushUint16(channel).loadGlobal32(sent).call(fn::CHANNEL_SEND_NUMBER); });
+    endThread(producer);
+
+    Code &consumer = program.thread(2, STACK_SIZE);
+    count(consumer, received, 0, 20000, 1, [&](Code &code)
+          { code.pushUint16(channel).call(fn::CHANNEL_WAIT_VALUE).loadGlobal32(sum).pushUint16(channel).call(fn::CHANNEL_RECEIVE_NUMBER).native(Native::ADD).storeGlobal32(sum); });
+    endThread(consumer);
+    return program.build();
+}
+
+bool write(const std::string &directory, const char *name, const std::vector<uint8_t> &program)
+{
+    std::string path = directory + "/" + name;
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Cannot write %s\n", path.c_str());
+        return false;
+    }
+    fwrite(program.data(), 1, program.size(), file);
+    fclose(file);
+    printf("%s: %zu bytes\n", path.c_str(), program.size());
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    std::string directory = argc > 1 ? argv[1] : "corpus";
+    bool ok = write(directory, "loops.mkb", loops()) &&
+              write(directory, "mathCalls.mkb", mathCalls()) &&
+              write(directory, "stringJoins.mkb", stringJoins()) &&
+              write(directory, "colourBlend.mkb", colourBlend()) &&
+              write(directory, "ledBitmap.mkb", ledBitmap()) &&
+              write(directory, "channelPingPong.mkb", channelPingPong());
+    return ok ? 0 : 1;
+}
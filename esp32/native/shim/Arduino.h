@@ -0,0 +1,181 @@
+#pragma once
+// Minimal replacement of the Arduino core for building the VM and the platform independent
+// modules on a host. Only what these modules use is provided.
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <cmath>
+#include <string>
+#include <algorithm>
+#include <type_traits>
+#include "hostClock.h"
+
+using std::abs;
+using std::max;
+using std::min;
+
+#define IRAM_ATTR
+
+inline unsigned long micros()
+{
+    return (unsigned long)hostClock::now();
+}
+
+inline unsigned long millis()
+{
+    return (unsigned long)(hostClock::now() / 1000);
+}
+
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+inline long random(long min, long max)
+{
+    if (max <= min)
+        return min;
+    return min + rand() % (max - min);
+}
+
+class String
+{
+public:
+    String(const char *value = "") : value(value == NULL ? "" : value) {}
+    String(const std::string &value) : value(value) {}
+    explicit String(char value) : value(1, value) {}
+    explicit String(int value) : value(std::to_string(value)) {}
+    explicit String(unsigned int value) : value(std::to_string(value)) {}
+    explicit String(long value) : value(std::to_string(value)) {}
+    explicit String(unsigned long value) : value(std::to_string(value)) {}
+    explicit String(long long value) : value(std::to_string(value)) {}
+    explicit String(unsigned long long value) : value(std::to_string(value)) {}
+    // like Arduino, floats are printed with two decimals
+    explicit String(float value, unsigned int decimals = 2) : String((double)value, decimals) {}
+    explicit String(double value, unsigned int decimals = 2)
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%.*f", (int)decimals, value);
+        this->value = buffer;
+    }
+
+    const char *c_str() const
+    {
+        return value.c_str();
+    }
+
+    unsigned int length() const
+    {
+        return value.length();
+    }
+
+    void toCharArray(char *buffer, unsigned int bufferSize) const
+    {
+        if (bufferSize == 0)
+            return;
+        size_t count = std::min<size_t>(bufferSize - 1, value.length());
+        memcpy(buffer, value.c_str(), count);
+        buffer[count] = 0;
+    }
+
+    String &operator+=(const String &other)
+    {
+        value += other.value;
+        return *this;
+    }
+
+    bool operator==(const String &other) const
+    {
+        return value == other.value;
+    }
+
+    bool operator!=(const String &other) const
+    {
+        return value != other.value;
+    }
+
+    friend String operator+(const String &a, const String &b)
+    {
+        return String(a.value + b.value);
+    }
+
+    friend String operator+(const String &a, const char *b)
+    {
+        return String(a.value + b);
+    }
+
+    template <typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+    friend String operator+(const String &a, T b)
+    {
+        return a + String(b);
+    }
+
+private:
+    std::string value;
+};
+
+class HostSerial
+{
+public:
+    // tests and benchmarks switch the output off
+    bool enabled = true;
+
+    void begin(unsigned long) {}
+
+    void print(const String &value)
+    {
+        if (enabled)
+            fputs(value.c_str(), stdout);
+    }
+
+    void print(const char *value)
+    {
+        print(String(value));
+    }
+
+    template <typename T>
+    void print(T value)
+    {
+        print(String(value));
+    }
+
+    void println()
+    {
+        print("\n");
+    }
+
+    template <typename T>
+    void println(T value)
+    {
+        print(value);
+        println();
+    }
+
+    template <typename... Args>
+    void printf(const char *format, Args... args)
+    {
+        if (enabled)
+            ::printf(format, args...);
+    }
+};
+
+extern HostSerial Serial;
+
+class EspClass
+{
+public:
+    // the CPU of the ESP32 runs at 240 MHz, the host counts cycles of a CPU of that speed
+    uint32_t getCpuFreqMHz()
+    {
+        return 240;
+    }
+
+    uint32_t getCycleCount()
+    {
+        return (uint32_t)(hostClock::nanos() * getCpuFreqMHz() / 1000);
+    }
+};
+
+extern EspClass ESP;
@@ -0,0 +1,56 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+
+// Keeps the pixels in memory instead of sending them to a LED strip
+struct NeoGrbFeature
+{
+};
+
+struct NeoWs2812xMethod
+{
+};
+
+struct RgbColor
+{
+    uint8_t R;
+    uint8_t G;
+    uint8_t B;
+
+    RgbColor(uint8_t r = 0, uint8_t g = 0, uint8_t b = 0) : R(r), G(g), B(b) {}
+};
+
+template <typename Feature, typename Method>
+class NeoPixelBus
+{
+public:
+    NeoPixelBus(uint16_t count, uint8_t) : pixels(count) {}
+
+    void Begin() {}
+
+    void Show()
+    {
+        shown++;
+    }
+
+    void SetPixelColor(uint16_t index, RgbColor colour)
+    {
+        if (index < pixels.size())
+            pixels[index] = colour;
+    }
+
+    RgbColor GetPixelColor(uint16_t index) const
+    {
+        return index < pixels.size() ? pixels[index] : RgbColor();
+    }
+
+    uint16_t PixelCount() const
+    {
+        return pixels.size();
+    }
+
+    uint32_t shown = 0;
+
+private:
+    std::vector<RgbColor> pixels;
+};
@@ -0,0 +1,2 @@
+#pragma once
+// included by modules built on the host, nothing of it is used there
@@ -0,0 +1,49 @@
+#include <Arduino.h>
+#include <chrono>
+#include <thread>
+
+HostSerial Serial;
+EspClass ESP;
+
+namespace hostClock
+{
+    bool simulated = false;
+    uint64_t simulatedNanos = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    void simulate(bool enabled)
+    {
+        simulated = enabled;
+        simulatedNanos = 0;
+    }
+
+    void advance(uint64_t micros)
+    {
+        simulatedNanos += micros * 1000;
+    }
+
+    uint64_t nanos()
+    {
+        if (simulated)
+            return simulatedNanos;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    uint64_t now()
+    {
+        return nanos() / 1000;
+    }
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    if (hostClock::simulated)
+        hostClock::advance(us);
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void delay(unsigned long ms)
+{
+    delayMicroseconds(ms * 1000);
+}
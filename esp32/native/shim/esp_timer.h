@@ -0,0 +1,8 @@
+#pragma once
+#include <stdint.h>
+#include "hostClock.h"
+
+inline int64_t esp_timer_get_time()
+{
+    return (int64_t)hostClock::now();
+}
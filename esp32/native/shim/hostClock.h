@@ -0,0 +1,15 @@
+#pragma once
+#include <stdint.h>
+
+// Time as seen by micros(), millis(), esp_timer_get_time() and the cycle counter of the host
+// build. By default it is the monotonic clock of the host, tests switch to a simulated clock
+// which only advances when told to, which makes them deterministic.
+namespace hostClock
+{
+    void simulate(bool enabled);
+    void advance(uint64_t micros);
+
+    // time in microseconds, respectively nanoseconds, since the first use of the clock
+    uint64_t now();
+    uint64_t nanos();
+}
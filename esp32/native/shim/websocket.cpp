@@ -0,0 +1,36 @@
+#include "websocket.h"
+#include <atomic>
+
+// There is no network on the host: sent messages are only counted and received messages
+// are passed to their handlers by the tests themselves. Machines running on threads of
+// their own send at the same time.
+namespace websocket
+{
+    std::unordered_map<MessageType, MessageEntry> lastMessages;
+    std::unordered_map<MessageType, std::function<void(uint8_t *data, size_t size)>> incomingMessageHandlers;
+    volatile uint32_t droppedIncomingMessages = 0;
+
+    std::atomic<uint32_t> sentMessages(0);
+
+    void send(MessageType, size_t, uint8_t *)
+    {
+        sentMessages++;
+    }
+
+    void send(size_t, uint8_t *)
+    {
+        sentMessages++;
+    }
+
+    void dispatchReceived()
+    {
+    }
+
+    void setup()
+    {
+    }
+
+    void loop()
+    {
+    }
+}
@@ -0,0 +1,111 @@
+// The interpreter keeps the stack pointer in a local and passes it to native functions in the
+// context. Results of the native operations, functions using the context directly and
+// threads suspended in the middle of an expression have to see a consistent stack.
+#include <Arduino.h>
+#include <cmath>
+#include "machine.h"
+#include "host.h"
+#include "bytecode.h"
+#include "check.h"
+
+using namespace bytecode;
+
+// pops two floats and pushes their sum and difference, not in the function table of the frontend
+const uint16_t FN_SUM_AND_DIFFERENCE = 250;
+
+const uint16_t A = 0, B = 4, C = 8;
+const uint16_t RESULTS = 12;
+const int RESULT_COUNT = 12;
+const uint16_t GLOBALS_SIZE = RESULTS + RESULT_COUNT * 4;
+
+void sumAndDifference(machine::Context &context)
+{
+    float b = machine::pop<float>(context);
+    float a = machine::pop<float>(context);
+    machine::push<float>(context, a + b);
+    machine::push<float>(context, a - b);
+}
+
+float result(int i)
+{
+    return *(float *)host::machine().variable(RESULTS + i * 4);
+}
+
+std::vector<uint8_t> program()
+{
+    Program program(2, GLOBALS_SIZE);
+    Code &code = program.thread(0, 32);
+    auto store = [&](int i)
+    { code.storeGlobal32(RESULTS + i * 4); };
+    code.pushFloat(7).storeGlobal32(A).pushFloat(-2).storeGlobal32(B).pushFloat(0.5).storeGlobal32(C);
+
+    // ((a + b) * c - a) / b
+    code.loadGlobal32(A).loadGlobal32(B).native(Native::ADD).loadGlobal32(C).native(Native::MUL);
+    code.loadGlobal32(A).native(Native::SUB).loadGlobal32(B).native(Native::DIV);
+    store(0);
+    // a * a, through dup
+    code.loadGlobal32(A).native(Native::DUP32).native(Native::MUL);
+    store(1);
+    // division by zero
+    code.loadGlobal32(A).pushFloat(0).native(Native::DIV);
+    store(2);
+    // (a < b) or not (b == -2), as float
+    code.pushFloat(1).loadGlobal32(A).loadGlobal32(B).native(Native::LT);
+    code.loadGlobal32(B).pushFloat(-2).native(Native::EQ).native(Native::NOT).native(Native::OR);
+    Label isFalse = code.label(), done = code.label();
+    code.jz(isFalse).pushFloat(2).native(Native::ADD).jump(done).bind(isFalse).pushFloat(3).native(Native::ADD).bind(done);
+    store(3);
+    // the results of a function using the context, below a value pushed before
+    code.pushFloat(100).loadGlobal32(A).loadGlobal32(B).call(FN_SUM_AND_DIFFERENCE);
+    store(4);
+    store(5);
+    store(6);
+    // a value dropped, leaving the one below
+    code.loadGlobal32(C).pushFloat(9).native(Native::DROP32);
+    store(7);
+    // suspended in the middle of expressions, while the other thread runs
+    code.loadGlobal32(A).call(fn::BASIC_YIELD).pushFloat(1).native(Native::ADD);
+    store(8);
+    code.loadGlobal32(A).pushFloat(2).call(fn::BASIC_DELAY).loadGlobal32(B).native(Native::MUL);
+    store(9);
+    code.call(fn::BASIC_END_THREAD);
+
+    // changes the globals while the first thread waits
+    Code &other = program.thread(1, 32);
+    other.pushFloat(10).storeGlobal32(A).call(fn::BASIC_YIELD).pushFloat(20).storeGlobal32(B);
+    other.pushFloat(4).pushFloat(3).call(FN_SUM_AND_DIFFERENCE).native(Native::MUL).storeGlobal32(RESULTS + 10 * 4);
+    other.call(fn::BASIC_END_THREAD);
+    return program.build();
+}
+
+void testArithmetic(bool optimize)
+{
+    machine::optimizeCode = optimize;
+    CHECK(host::load(program()));
+    CHECK(host::runUntilIdle(1000));
+
+    CHECK_EQUAL(((7 - 2) * 0.5 - 7) / -2, result(0));
+    CHECK_EQUAL(49, result(1));
+    CHECK(std::isinf(result(2)) && result(2) > 0);
+    CHECK_EQUAL(4, result(3));
+    CHECK_EQUAL(9, result(4));
+    CHECK_EQUAL(5, result(5));
+    CHECK_EQUAL(100, result(6));
+    CHECK_EQUAL(0.5, result(7));
+    // loaded before yielding, thus before the other thread changed it
+    CHECK_EQUAL(8, result(8));
+    CHECK_EQUAL(10 * 20, result(9));
+    CHECK_EQUAL(7 * 1, result(10));
+}
+
+int main()
+{
+    host::setup();
+    machine::registerFunction(FN_SUM_AND_DIFFERENCE, sumAndDifference, 8, 8);
+    hostClock::simulate(true);
+    Serial.enabled = false;
+    testArithmetic(true);
+    testArithmetic(false);
+    Serial.enabled = true;
+    return checkResult();
+}
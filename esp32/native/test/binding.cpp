@@ -0,0 +1,131 @@
+// Functions registered with typed arguments: the arguments are read from the stack in order,
+// with the size of their type, and the result is pushed. Functions taking the machine get the
+// one running the calling thread, which takes no room on the stack. Operations selected by a
+// literal are bound when loading, others are dispatched when called, with the same results.
+#include <Arduino.h>
+#include "machine.h"
+#include "host.h"
+#include "bytecode.h"
+#include "check.h"
+
+using namespace bytecode;
+
+// test functions, not in the function table of the frontend
+const uint16_t FN_STORE = 249, FN_MIXED = 250, FN_COUNT = 251, FN_NEGATE = 252, FN_SELECT = 253;
+
+const uint16_t RESULT = 0, BOOL_RESULT = 4, OPERATION = 8, SELECTED = 12, DISPATCHED = 16, STORED = 20;
+const uint16_t GLOBALS_SIZE = 24;
+
+struct
+{
+    uint8_t a;
+    uint16_t b;
+    float c;
+    bool d;
+    int counted;
+    machine::Machine *machine;
+} received;
+
+std::vector<uint8_t> program()
+{
+    Program program(1, GLOBALS_SIZE);
+    Code &code = program.thread(0, 32);
+    code.pushUint8(200).pushUint16(60000).pushFloat(-1.5).pushUint8(1).call(FN_MIXED).storeGlobal32(RESULT);
+    code.call(FN_COUNT).call(FN_COUNT);
+    code.pushUint16(BOOL_RESULT).pushUint8(0).call(FN_NEGATE).call(fn::VARIABLES_SET_VAR8);
+    code.pushFloat(3).pushFloat(4).pushUint8(1).call(FN_SELECT).storeGlobal32(SELECTED);
+    code.pushUint16(STORED).pushFloat(2.5).call(FN_STORE);
+    code.call(fn::BASIC_END_THREAD);
+    return program.build();
+}
+
+void registerFunctions()
+{
+    machine::registerFunction<FN_MIXED>(+[](uint8_t a, uint16_t b, float c, bool d) -> float
+                                        {
+                                            received.a = a;
+                                            received.b = b;
+                                            received.c = c;
+                                            received.d = d;
+                                            return a + b + c; });
+    machine::registerFunction<FN_STORE>(+[](machine::Machine &machine, uint16_t offset, float value)
+                                        {
+                                            received.machine = &machine;
+                                            memcpy(machine.variable(offset), &value, sizeof(value)); });
+    machine::registerFunction<FN_COUNT>(+[]()
+                                        { received.counted++; });
+    machine::registerFunction<FN_NEGATE>(+[](bool value) -> bool
+                                         { return !value; });
+    machine::registerOperation<FN_SELECT, 0>(+[](float a, float b) -> float
+                                             { return a + b; });
+    machine::registerOperation<FN_SELECT, 1>(+[](float a, float b) -> float
+                                             { return a * b; });
+}
+
+void testArguments(bool optimize)
+{
+    machine::optimizeCode = optimize;
+    received = {};
+    CHECK(host::load(program()));
+    CHECK(host::runUntilIdle(1000));
+
+    CHECK_EQUAL(200, received.a);
+    CHECK_EQUAL(60000, received.b);
+    CHECK_EQUAL(-1.5, received.c);
+    CHECK(received.d);
+    CHECK_EQUAL(200 + 60000 - 1.5, *(float *)host::machine().variable(RESULT));
+    CHECK_EQUAL(2, received.counted);
+    CHECK_EQUAL(1, *host::machine().variable(BOOL_RESULT));
+    CHECK_EQUAL(12, *(float *)host::machine().variable(SELECTED));
+    CHECK(received.machine == &host::machine());
+    CHECK_EQUAL(2.5, *(float *)host::machine().variable(STORED));
+}
+
+void testDispatch(bool optimize)
+{
+    machine::optimizeCode = optimize;
+    Program program(1, GLOBALS_SIZE);
+    Code &code = program.thread(0, 32);
+    // the difference of the dispatched and the bound operation is stored for each operation
+    for (uint8_t operation = 0; operation < 2; operation++)
+    {
+        code.pushUint16(OPERATION).pushUint8(operation).call(fn::VARIABLES_SET_VAR8);
+        code.pushFloat(3).pushFloat(4).pushUint16(OPERATION).call(fn::VARIABLES_GET_VAR8).call(FN_SELECT).storeGlobal32(DISPATCHED);
+        code.pushFloat(3).pushFloat(4).pushUint8(operation).call(FN_SELECT).storeGlobal32(SELECTED);
+        code.pushUint16(RESULT + operation * 4).loadGlobal32(DISPATCHED).loadGlobal32(SELECTED).native(Native::SUB).call(fn::VARIABLES_SET_VAR32);
+    }
+    // an operation which is not registered stops the thread
+    code.pushFloat(3).pushFloat(4).pushUint8(7).call(FN_SELECT).storeGlobal32(SELECTED);
+    code.pushFloat(1).storeGlobal32(BOOL_RESULT).call(fn::BASIC_END_THREAD);
+
+    CHECK(host::load(program.build()));
+    CHECK(host::runUntilIdle(1000));
+    CHECK_EQUAL(0, *(float *)host::machine().variable(RESULT));
+    CHECK_EQUAL(0, *(float *)host::machine().variable(RESULT + 4));
+    CHECK_EQUAL(12, *(float *)host::machine().variable(SELECTED));
+    CHECK_EQUAL(0, *(float *)host::machine().variable(BOOL_RESULT));
+}
+
+void testStackUsage()
+{
+    // the arguments of a typed function are too few for its registered size
+    Program program(1, GLOBALS_SIZE);
+    program.thread(0, 32).pushUint8(200).pushFloat(-1.5).pushUint8(1).call(FN_MIXED).storeGlobal32(RESULT).call(fn::BASIC_END_THREAD);
+    CHECK(!host::load(program.build()));
+}
+
+int main()
+{
+    host::setup();
+    registerFunctions();
+    hostClock::simulate(true);
+    Serial.enabled = false;
+    for (bool optimize : {true, false})
+    {
+        testArguments(optimize);
+        testDispatch(optimize);
+    }
+    testStackUsage();
+    Serial.enabled = true;
+    return checkResult();
+}
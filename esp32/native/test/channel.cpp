@@ -0,0 +1,152 @@
+// Threads blocking on channels: receivers wait until a value is sent, senders wait while the
+// channel is full, and the values arrive in the order they were sent. Capacities computed by
+// the program are clamped to the range the channel supports.
+#include <Arduino.h>
+#include <cmath>
+#include "machine.h"
+#include "host.h"
+#include "bytecode.h"
+#include "check.h"
+
+using namespace bytecode;
+
+// records its float argument and the calling thread, not in the function table of the frontend
+const uint16_t FN_TRACE = 255;
+
+typedef struct
+{
+    uint16_t threadNr;
+    float value;
+} TraceEntry;
+
+std::vector<TraceEntry> trace;
+
+const uint16_t CONSUMER = 0, PRODUCER = 1;
+const int VALUES = 20;
+
+Code &setup(Code &code, uint16_t id, float capacity)
+{
+    return code.pushUint16(id).pushFloat(capacity).pushUint8(0).call(fn::CHANNEL_SETUP);
+}
+
+Code &send(Code &code, uint16_t id)
+{
+    // the value is on the stack, the id is pushed below it by the compiler
+    return code.pushUint16(id).call(fn::CHANNEL_WAIT_SLOT).call(fn::CHANNEL_SEND_NUMBER);
+}
+
+Code &receive(Code &code, uint16_t id)
+{
+    return code.pushUint16(id).call(fn::CHANNEL_WAIT_VALUE).pushUint16(id).call(fn::CHANNEL_RECEIVE_NUMBER);
+}
+
+// The consumer starts first and waits for the first value, which the producer sends after a
+// delay. Then the consumer takes its time for each value, so the producer fills the channel
+// and waits for a free slot.
+std::vector<uint8_t> producerConsumer()
+{
+    Program program(2, 8);
+    Code &consumer = program.thread(CONSUMER, 16);
+    setup(consumer, 0, 1);
+    count(consumer, 0, 1, VALUES + 1, 1, [](Code &code)
+          {
+              receive(code, 0).call(FN_TRACE);
+              code.pushFloat(2).call(fn::BASIC_DELAY); });
+    consumer.call(fn::BASIC_END_THREAD);
+
+    Code &producer = program.thread(PRODUCER, 16);
+    setup(producer, 0, 1);
+    producer.pushFloat(5).call(fn::BASIC_DELAY);
+    count(producer, 4, 1, VALUES + 1, 1, [](Code &code)
+          {
+              code.pushUint16(0).loadGlobal32(4);
+              send(code, 0);
+              code.loadGlobal32(4).call(FN_TRACE); });
+    producer.call(fn::BASIC_END_THREAD);
+    return program.build();
+}
+
+// Each thread sets up a channel of the given capacity and sends values without a receiver,
+// until it waits for a free slot.
+std::vector<uint8_t> capacities(const std::vector<float> &capacities)
+{
+    uint16_t threadCount = capacities.size();
+    Program program(threadCount, threadCount * 4);
+    for (uint16_t t = 0; t < threadCount; t++)
+    {
+        Code &code = program.thread(t, 16);
+        setup(code, t, capacities[t]);
+        count(code, t * 4, 1, 2000, 1, [&](Code &code)
+              {
+                  code.pushUint16(t).loadGlobal32(t * 4);
+                  send(code, t);
+                  code.loadGlobal32(t * 4).call(FN_TRACE); });
+        code.call(fn::BASIC_END_THREAD);
+    }
+    return program.build();
+}
+
+void testProducerConsumer()
+{
+    trace.clear();
+    CHECK(host::load(producerConsumer()));
+    CHECK(host::runUntilIdle(1000));
+    CHECK_EQUAL(2 * VALUES, (int)trace.size());
+    if (trace.empty())
+        return;
+
+    // the consumer waited for the delayed first value
+    CHECK_EQUAL(PRODUCER, trace[0].threadNr);
+
+    int sent = 0, received = 0;
+    bool ordered = true, bounded = true, producerWaited = false;
+    for (auto &entry : trace)
+    {
+        if (entry.threadNr == PRODUCER)
+        {
+            sent++;
+            ordered = ordered && entry.value == sent;
+        }
+        else
+        {
+            received++;
+            ordered = ordered && entry.value == received;
+            producerWaited = producerWaited || sent == received;
+        }
+        // a capacity of one: the producer is at most one value ahead
+        bounded = bounded && received <= sent && sent <= received + 1;
+    }
+    CHECK(ordered);
+    CHECK(bounded);
+    CHECK(producerWaited);
+    CHECK_EQUAL(VALUES, sent);
+    CHECK_EQUAL(VALUES, received);
+}
+
+void testCapacities()
+{
+    const std::vector<float> requested = {NAN, -3, 0, 0.5, 2.5, 7, 1e9, INFINITY};
+    const std::vector<int> expected = {1, 1, 1, 1, 2, 7, 1024, 1024};
+    trace.clear();
+    CHECK(host::load(capacities(requested)));
+    CHECK(host::runUntilIdle(1000));
+
+    std::vector<int> sent(requested.size(), 0);
+    for (auto &entry : trace)
+        sent[entry.threadNr]++;
+    for (size_t t = 0; t < requested.size(); t++)
+        CHECK_EQUAL(expected[t], sent[t]);
+}
+
+int main()
+{
+    host::setup();
+    machine::registerFunction<FN_TRACE>(+[](machine::Machine &machine, float value)
+                                        { trace.push_back(TraceEntry{machine.currentThreadNr, value}); });
+    hostClock::simulate(true);
+    Serial.enabled = false;
+    testProducerConsumer();
+    testCapacities();
+    Serial.enabled = true;
+    return checkResult();
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <stdio.h>
+
+// Checks of the host tests. Each test is an executable which reports the failed checks and
+// exits with 1 if there were any.
+static int failedChecks = 0;
+
+#define CHECK(condition)                                                        \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failedChecks++;                                                     \
+        }                                                                       \
+    } while (0)
+
+#define CHECK_EQUAL(expected, actual)                                                                        \
+    do                                                                                                       \
+    {                                                                                                        \
+        auto expectedValue = (expected);                                                                     \
+        auto actualValue = (actual);                                                                         \
+        if (!(expectedValue == actualValue))                                                                 \
+        {                                                                                                    \
+            printf("%s:%d: expected %s == %s, was %.17g\n", __FILE__, __LINE__, #expected, #actual, (double)actualValue); \
+            failedChecks++;                                                                                  \
+        }                                                                                                    \
+    } while (0)
+
+inline int checkResult()
+{
+    if (failedChecks > 0)
+        printf("%d checks failed\n", failedChecks);
+    return failedChecks > 0 ? 1 : 0;
+}
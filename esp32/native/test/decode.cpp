@@ -0,0 +1,93 @@
+// Translation of the bytecode into the instruction stream: pushes of each size and jumps of
+// each encoding width, forward and backward, run the same with and without superinstructions.
+#include <Arduino.h>
+#include "machine.h"
+#include "host.h"
+#include "bytecode.h"
+#include "check.h"
+
+using namespace bytecode;
+
+const uint16_t COUNTER = 0, LOOP = 4, RESULTS = 8;
+
+// a loop counting to times, whose body is padded to the given size in bytes, so that the
+// jumps around it need one, two or three bytes
+std::vector<uint8_t> paddedLoop(int times, size_t padding)
+{
+    Program program(1, 8);
+    Code &code = program.thread(0, 16);
+    count(code, LOOP, 0, times, 1, [&](Code &code)
+          {
+              code.loadGlobal32(COUNTER).pushFloat(1).native(Native::ADD).storeGlobal32(COUNTER);
+              // each pair of a push and a drop takes 6 bytes
+              for (size_t size = 0; size + 6 <= padding; size += 6)
+                  code.pushFloat(0).native(Native::DROP32); });
+    code.call(fn::BASIC_END_THREAD);
+    return program.build();
+}
+
+// pushes of 1, 2, 4 and 12 bytes, the last one a colour of three floats
+std::vector<uint8_t> pushes()
+{
+    const float colour[] = {0.25, 0.5, 0.75};
+    Program program(1, RESULTS + 20);
+    Code &code = program.thread(0, 32);
+    code.pushUint16(RESULTS).pushUint8(3).call(fn::VARIABLES_SET_VAR8);
+    code.pushUint16(RESULTS + 1).pushUint16(RESULTS).call(fn::VARIABLES_GET_VAR8).call(fn::VARIABLES_SET_VAR8);
+    code.pushFloat(-2.5).storeGlobal32(RESULTS + 4);
+    code.push(colour, sizeof(colour)).storeGlobal32(RESULTS + 16).storeGlobal32(RESULTS + 12).storeGlobal32(RESULTS + 8);
+    // the end of the code ends the thread as well
+    return program.build();
+}
+
+float global(uint16_t offset)
+{
+    return *(float *)host::machine().variable(offset);
+}
+
+void testJumps(bool optimize)
+{
+    machine::optimizeCode = optimize;
+    // bodies needing jumps of one byte, two bytes and three bytes
+    const size_t paddings[] = {0, 60, 1200, 6000};
+    for (size_t padding : paddings)
+    {
+        auto program = paddedLoop(7, padding);
+        CHECK(host::load(program));
+        CHECK(host::runUntilIdle(1000));
+        CHECK_EQUAL(7, global(COUNTER));
+        CHECK_EQUAL(7, global(LOOP));
+    }
+
+    // a body running not at all
+    CHECK(host::load(paddedLoop(0, 60)));
+    CHECK(host::runUntilIdle(1000));
+    CHECK_EQUAL(0, global(COUNTER));
+}
+
+void testPushes(bool optimize)
+{
+    machine::optimizeCode = optimize;
+    CHECK(host::load(pushes()));
+    CHECK(host::runUntilIdle(1000));
+    CHECK_EQUAL(3, *host::machine().variable(RESULTS));
+    CHECK_EQUAL(3, *host::machine().variable(RESULTS + 1));
+    CHECK_EQUAL(-2.5, global(RESULTS + 4));
+    CHECK_EQUAL(0.25, global(RESULTS + 8));
+    CHECK_EQUAL(0.5, global(RESULTS + 12));
+    CHECK_EQUAL(0.75, global(RESULTS + 16));
+}
+
+int main()
+{
+    host::setup();
+    hostClock::simulate(true);
+    Serial.enabled = false;
+    for (bool optimize : {true, false})
+    {
+        testJumps(optimize);
+        testPushes(optimize);
+    }
+    Serial.enabled = true;
+    return checkResult();
+}
@@ -0,0 +1,100 @@
+// Many threads waiting in basicDelay at the same time, like one per LED animation. With the
+// simulated clock each thread has to wake at its deadline with microsecond precision, and the
+// threads have to wake in the order of their deadlines.
+//
+// Usage: delays [--threads n]
+//
+// The code and the stacks of the threads have to fit into 16 bit offsets, thus n is at
+// most 2500.
+//
+// Also reports the time per wakeup for 100 threads and the given number of threads, 1000 by
+// default, which stays about the same if the timer queue scales.
+#include <Arduino.h>
+#include <chrono>
+#include <string>
+#include "machine.h"
+#include "host.h"
+#include "bytecode.h"
+#include "check.h"
+
+using namespace bytecode;
+
+// records the calling thread and the time, not in the function table of the frontend
+const uint16_t FN_WOKE = 255;
+
+const int ROUNDS = 3;
+
+typedef struct
+{
+    uint16_t threadNr;
+    unsigned long time;
+} Wakeup;
+
+std::vector<Wakeup> wakeups;
+
+// distinct delays between 0 and 10 ms, in steps of 10 us
+float delay(uint16_t threadNr, uint16_t threadCount)
+{
+    return (threadNr * 7919 % threadCount) * 10.0f / threadCount;
+}
+
+// each thread waits its delay several times
+std::vector<uint8_t> program(uint16_t threadCount)
+{
+    Program program(threadCount, 4);
+    for (uint16_t t = 0; t < threadCount; t++)
+    {
+        Code &code = program.thread(t, 16);
+        repeat(code, ROUNDS, [&](Code &code)
+               { code.pushFloat(delay(t, threadCount)).call(fn::BASIC_DELAY).call(FN_WOKE); });
+        code.call(fn::BASIC_END_THREAD);
+    }
+    return program.build();
+}
+
+// microseconds per wakeup
+double run(uint16_t threadCount)
+{
+    wakeups.clear();
+    wakeups.reserve(threadCount * ROUNDS);
+    hostClock::simulate(true);
+    auto code = program(threadCount);
+    auto start = std::chrono::steady_clock::now();
+    CHECK(host::load(code));
+    CHECK(host::runUntilIdle(1000));
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    CHECK_EQUAL(threadCount * ROUNDS, (int)wakeups.size());
+    // each delay starts when the thread woke from the previous one, the first at 0
+    std::vector<unsigned long> woke(threadCount, 0);
+    bool onTime = true, ordered = true;
+    unsigned long last = 0;
+    for (auto &wakeup : wakeups)
+    {
+        unsigned long deadline = woke[wakeup.threadNr] + (unsigned long)(delay(wakeup.threadNr, threadCount) * 1000);
+        onTime = onTime && wakeup.time == deadline;
+        ordered = ordered && wakeup.time >= last;
+        woke[wakeup.threadNr] = wakeup.time;
+        last = wakeup.time;
+    }
+    CHECK(onTime);
+    CHECK(ordered);
+    return seconds * 1e6 / wakeups.size();
+}
+
+int main(int argc, char **argv)
+{
+    uint16_t threadCount = 1000;
+    if (argc > 2 && std::string(argv[1]) == "--threads")
+        threadCount = std::min(2500, std::max(1, atoi(argv[2])));
+
+    host::setup();
+    machine::registerFunction<FN_WOKE>(+[](machine::Machine &machine)
+                                       { wakeups.push_back(Wakeup{machine.currentThreadNr, micros()}); });
+    Serial.enabled = false;
+    double few = run(100);
+    double many = run(threadCount);
+    Serial.enabled = true;
+    printf("100 threads %.3f us per wakeup, %u threads %.3f us per wakeup\n", few, threadCount, many);
+    return checkResult();
+}
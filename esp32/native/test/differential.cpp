@@ -0,0 +1,340 @@
+// Differential test of the superinstructions: random programs, valid by construction, are run
+// with and without the optimizations of applyCode(). The globals, the values passed to a
+// tracing function and the stack pointer at each of its calls have to be the same.
+//
+// Usage: differential [--programs n] [--seed s] [--repetitions r]
+//
+// Also reports the time both variants took, thus serves as benchmark of the optimizations
+// on code mixing all the fused instruction sequences. With repetitions, each thread repeats
+// its code that often, so running the programs outweighs loading them.
+#include <Arduino.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include "machine.h"
+#include "host.h"
+#include "bytecode.h"
+#include "check.h"
+
+using namespace bytecode;
+
+// records its float argument, not in the function table of the frontend
+const uint16_t FN_TRACE = 255;
+
+const uint16_t THREAD_COUNT = 2;
+const uint16_t STACK_SIZE = 256;
+
+// globals: floats read and written by all threads, a byte used as condition and the
+// variables of the counting loops, separate for each thread and nesting level
+const uint16_t DATA_COUNT = 8;
+const uint16_t BYTE_VARIABLE = DATA_COUNT * 4;
+const int MAX_NESTING = 3;
+const uint16_t LOOP_VARIABLES = BYTE_VARIABLE + 4;
+const uint16_t GLOBALS_SIZE = LOOP_VARIABLES + THREAD_COUNT * MAX_NESTING * 4;
+
+typedef struct
+{
+    uint16_t threadNr;
+    uint32_t value;
+    // stack pointer after popping the argument, relative to the memory of the program
+    uint32_t stackPointer;
+} TraceEntry;
+
+bool operator==(const TraceEntry &a, const TraceEntry &b)
+{
+    return a.threadNr == b.threadNr && a.value == b.value && a.stackPointer == b.stackPointer;
+}
+
+std::vector<TraceEntry> trace;
+
+void traceFunction(machine::Context &context)
+{
+    context.stackPointer -= 4;
+    uint32_t value;
+    memcpy(&value, context.stackPointer, 4);
+    trace.push_back(TraceEntry{context.machine->currentThreadNr, value, (uint32_t)(context.stackPointer - context.machine->variable(0))});
+}
+
+// Generates code shaped like the compiler output, including the sequences fuse() combines:
+// loads of globals through variablesGetVar32/8, arithmetic with a constant operand, calls
+// selecting their operation by a constant, comparisons followed by jz and repeat loops.
+class Generator
+{
+public:
+    Generator(uint32_t seed, int repetitions) : random(seed), repetitions(repetitions) {}
+
+    std::vector<uint8_t> program()
+    {
+        Program program(THREAD_COUNT, GLOBALS_SIZE);
+        for (uint16_t t = 0; t < THREAD_COUNT; t++)
+        {
+            threadNr = t;
+            Code &code = program.thread(t, STACK_SIZE);
+            if (repetitions > 1)
+                repeat(code, repetitions, [&](Code &code)
+                       { block(code, 1, 12); });
+            else
+                block(code, 0, 12);
+            code.call(fn::BASIC_END_THREAD);
+        }
+        return program.build();
+    }
+
+private:
+    std::mt19937 random;
+    int repetitions;
+    uint16_t threadNr;
+
+    int below(int count)
+    {
+        return std::uniform_int_distribution<int>(0, count - 1)(random);
+    }
+
+    float constant()
+    {
+        static const float constants[] = {0, 1, 2, -3, 0.5, 7.25, 1000, -0.125};
+        return constants[below(sizeof(constants) / sizeof(constants[0]))];
+    }
+
+    uint16_t data()
+    {
+        return below(DATA_COUNT) * 4;
+    }
+
+    // pushes a float
+    void number(Code &code, int depth)
+    {
+        switch (depth <= 0 ? below(4) : below(10))
+        {
+        case 0:
+            code.pushFloat(constant());
+            break;
+        case 1:
+            code.loadGlobal32(data());
+            break;
+        case 2:
+            code.pushUint16(data()).call(fn::VARIABLES_GET_VAR32);
+            break;
+        case 3:
+            code.pushFloat(below(5));
+            break;
+        case 4:
+            number(code, depth - 1);
+            number(code, depth - 1);
+            code.native((Native)((uint8_t)Native::ADD + below(4)));
+            break;
+        case 5:
+            number(code, depth - 1);
+            code.pushFloat(constant()).native((Native)((uint8_t)Native::ADD + below(4)));
+            break;
+        case 6:
+            number(code, depth - 1);
+            code.pushFloat(constant()).pushUint8(below(4)).call(fn::MATH_BINARY);
+            break;
+        case 7:
+        {
+            // all binary operations except random
+            static const uint8_t operations[] = {0, 1, 2, 3, 4, 5, 7};
+            number(code, depth - 1);
+            number(code, depth - 1);
+            code.pushUint8(operations[below(sizeof(operations))]).call(fn::MATH_BINARY);
+            break;
+        }
+        case 8:
+            number(code, depth - 1);
+            code.pushUint8(below(16)).call(fn::MATH_UNARY);
+            break;
+        default:
+            number(code, depth - 1);
+            code.native(Native::DUP32).native(Native::MUL);
+            break;
+        }
+    }
+
+    // pushes a boolean
+    void condition(Code &code, int depth)
+    {
+        switch (depth <= 0 ? below(3) : below(5))
+        {
+        case 0:
+            number(code, 1);
+            number(code, 1);
+            code.native((Native)((uint8_t)Native::EQ + below(6)));
+            break;
+        case 1:
+            number(code, 1);
+            number(code, 1);
+            code.pushUint8(below(6)).call(fn::LOGIC_COMPARE);
+            break;
+        case 2:
+            code.pushUint16(BYTE_VARIABLE).call(fn::VARIABLES_GET_VAR8);
+            break;
+        case 3:
+            condition(code, depth - 1);
+            condition(code, depth - 1);
+            code.native(below(2) == 0 ? Native::AND : Native::OR);
+            break;
+        default:
+            condition(code, depth - 1);
+            code.native(Native::NOT);
+            break;
+        }
+    }
+
+    void block(Code &code, int nesting, int statements)
+    {
+        for (int i = 0; i < statements; i++)
+            statement(code, nesting);
+    }
+
+    void statement(Code &code, int nesting)
+    {
+        switch (nesting >= MAX_NESTING ? below(6) : below(10))
+        {
+        case 0:
+            number(code, 3);
+            code.storeGlobal32(data());
+            break;
+        case 1:
+            code.pushUint16(data());
+            number(code, 3);
+            code.call(fn::VARIABLES_SET_VAR32);
+            break;
+        case 2:
+            code.pushUint16(BYTE_VARIABLE);
+            condition(code, 1);
+            code.call(fn::VARIABLES_SET_VAR8);
+            break;
+        case 3:
+        case 4:
+            number(code, 3);
+            code.call(FN_TRACE);
+            break;
+        case 5:
+            number(code, 2);
+            code.native(Native::DROP32);
+            break;
+        case 6:
+        {
+            Label skip = code.label();
+            condition(code, 2);
+            code.jz(skip);
+            block(code, nesting + 1, 1 + below(3));
+            code.bind(skip);
+            break;
+        }
+        case 7:
+        {
+            Label otherwise = code.label();
+            Label end = code.label();
+            condition(code, 2);
+            code.jz(otherwise);
+            block(code, nesting + 1, 1 + below(3));
+            code.jump(end);
+            code.bind(otherwise);
+            block(code, nesting + 1, 1 + below(3));
+            code.bind(end);
+            break;
+        }
+        case 8:
+        {
+            // the body runs at least once, also for counts below one
+            static const float times[] = {-1, 0, 0.5, 1, 2, 3.5};
+            repeat(code, times[below(sizeof(times) / sizeof(times[0]))], [&](Code &code)
+                   { block(code, nesting + 1, 1 + below(3)); });
+            break;
+        }
+        default:
+        {
+            // a value kept on the stack while the loop runs, the loop variable is not
+            // written by the body
+            uint16_t variable = LOOP_VARIABLES + (threadNr * MAX_NESTING + nesting) * 4;
+            number(code, 1);
+            count(code, variable, below(3), 1 + below(4), below(2) == 0 ? 1 : 0.75, [&](Code &code)
+                  { block(code, nesting + 1, 1 + below(3)); });
+            code.call(FN_TRACE);
+            break;
+        }
+        }
+    }
+};
+
+typedef struct
+{
+    std::vector<uint8_t> globals;
+    std::vector<TraceEntry> trace;
+    double seconds;
+} Run;
+
+bool run(const std::vector<uint8_t> &program, bool optimize, Run &result)
+{
+    machine::optimizeCode = optimize;
+    trace.clear();
+    Serial.enabled = false;
+    // loading the program includes running its threads until they yield
+    auto start = std::chrono::steady_clock::now();
+    bool ok = host::load(program) && host::runUntilIdle(100000);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Serial.enabled = true;
+    if (!ok)
+        return false;
+    result.globals.assign(host::machine().variable(0), host::machine().variable(0) + GLOBALS_SIZE);
+    result.trace = trace;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    int programs = 200;
+    uint32_t seed = 1;
+    int repetitions = 1;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string argument = argv[i];
+        if (argument == "--programs")
+            programs = atoi(argv[i + 1]);
+        else if (argument == "--seed")
+            seed = strtoul(argv[i + 1], NULL, 10);
+        else if (argument == "--repetitions")
+            repetitions = atoi(argv[i + 1]);
+    }
+
+    host::setup();
+    machine::registerFunction(FN_TRACE, traceFunction, 4, 0);
+    // the time slices never expire, thus the threads run one after the other in both variants
+    hostClock::simulate(true);
+
+    Generator generator(seed, repetitions);
+    double optimizedSeconds = 0, referenceSeconds = 0;
+    size_t traced = 0;
+    for (int p = 0; p < programs; p++)
+    {
+        auto program = generator.program();
+        Run optimized, reference;
+        bool optimizedRan = run(program, true, optimized);
+        bool referenceRan = run(program, false, reference);
+        CHECK(optimizedRan);
+        CHECK(referenceRan);
+        if (!optimizedRan || !referenceRan)
+        {
+            printf("program %d of seed %u did not run\n", p, seed);
+            continue;
+        }
+
+        bool sameGlobals = optimized.globals == reference.globals;
+        bool sameTrace = optimized.trace == reference.trace;
+        CHECK(sameGlobals);
+        CHECK(sameTrace);
+        if (!sameGlobals || !sameTrace)
+            printf("program %d of seed %u differs\n", p, seed);
+
+        optimizedSeconds += optimized.seconds;
+        referenceSeconds += reference.seconds;
+        traced += reference.trace.size();
+    }
+
+    printf("%d programs, %zu traced values, optimized %.1f ms, reference %.1f ms\n", programs, traced,
+           optimizedSeconds * 1000, referenceSeconds * 1000);
+    return checkResult();
+}
@@ -0,0 +1,129 @@
+// Batch dispatch: each loop resumes all runnable threads, in the order they became runnable,
+// until the time budget of the loop is used up. The threads left over are resumed first by
+// the next loop, thus every thread makes progress.
+//
+// Usage: dispatch [--yields n]
+//
+// Also reports the resumptions per second of 100 threads yielding n times each, 1000 by
+// default, with the real clock.
+#include <Arduino.h>
+#include <chrono>
+#include <string>
+#include "machine.h"
+#include "host.h"
+#include "bytecode.h"
+#include "check.h"
+#include "modules/basic.h"
+
+using namespace bytecode;
+
+// advances the simulated clock by its argument in microseconds, not in the function table
+// of the frontend
+const uint16_t FN_TAKE_TIME = 254;
+
+const uint16_t THREAD_COUNT = 100;
+
+float runs(uint16_t threadNr)
+{
+    return *(float *)host::machine().variable(threadNr * 4);
+}
+
+// each thread counts its runs in its own global and yields, the given number of times
+std::vector<uint8_t> program(int yields, float cost)
+{
+    Program program(THREAD_COUNT, THREAD_COUNT * 4);
+    for (uint16_t t = 0; t < THREAD_COUNT; t++)
+    {
+        Code &code = program.thread(t, 16);
+        repeat(code, yields, [&](Code &code)
+               {
+                   code.loadGlobal32(t * 4).pushFloat(1).native(Native::ADD).storeGlobal32(t * 4);
+                   if (cost > 0)
+                       code.pushFloat(cost).call(FN_TAKE_TIME);
+                   code.call(fn::BASIC_YIELD); });
+        code.call(fn::BASIC_END_THREAD);
+    }
+    return program.build();
+}
+
+// the runs of the threads differ by at most one, the ones which ran more come first
+bool fair()
+{
+    for (uint16_t t = 1; t < THREAD_COUNT; t++)
+    {
+        if (runs(t) > runs(t - 1) || runs(t) < runs(0) - 1)
+            return false;
+    }
+    return true;
+}
+
+void testAllInOneLoop()
+{
+    hostClock::simulate(true);
+    // loading runs each thread once
+    CHECK(host::load(program(10, 0)));
+    for (int loop = 0; loop < 5; loop++)
+    {
+        host::loop();
+        CHECK_EQUAL(loop + 2, runs(0));
+        CHECK_EQUAL(loop + 2, runs(THREAD_COUNT - 1));
+    }
+    auto &statistics = basicModule::dispatchStatistics(host::machine());
+    CHECK_EQUAL(5u, statistics.loops);
+    CHECK_EQUAL(5u * THREAD_COUNT, statistics.resumptions);
+    CHECK_EQUAL(0u, statistics.budgetExhausted);
+}
+
+void testBudget()
+{
+    // a budget of 1 ms and threads running 100 us each, thus 10 threads per loop
+    basicModule::dispatchBudget = 1000;
+    hostClock::simulate(true);
+    CHECK(host::load(program(1000, 100)));
+    bool alwaysFair = true;
+    for (int loop = 0; loop < 25; loop++)
+    {
+        host::loop();
+        alwaysFair = alwaysFair && fair();
+    }
+    CHECK(alwaysFair);
+    // each thread ran once when loading, then 250 threads were resumed
+    CHECK_EQUAL(4, runs(0));
+    CHECK_EQUAL(3, runs(THREAD_COUNT - 1));
+    auto &statistics = basicModule::dispatchStatistics(host::machine());
+    CHECK_EQUAL(25u, statistics.loops);
+    CHECK_EQUAL(250u, statistics.resumptions);
+    CHECK_EQUAL(25u, statistics.budgetExhausted);
+    CHECK_EQUAL(1000u, statistics.maxLoopTime);
+    basicModule::dispatchBudget = 10000;
+}
+
+double resumptionsPerSecond(int yields)
+{
+    hostClock::simulate(false);
+    auto start = std::chrono::steady_clock::now();
+    CHECK(host::load(program(yields, 0)));
+    CHECK(host::runUntilIdle(60000));
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    CHECK_EQUAL(yields, runs(0));
+    CHECK_EQUAL(yields, runs(THREAD_COUNT - 1));
+    return basicModule::dispatchStatistics(host::machine()).resumptions / seconds;
+}
+
+int main(int argc, char **argv)
+{
+    int yields = 1000;
+    if (argc > 2 && std::string(argv[1]) == "--yields")
+        yields = std::max(1, atoi(argv[2]));
+
+    host::setup();
+    machine::registerFunction<FN_TAKE_TIME>(+[](float micros)
+                                            { hostClock::advance(micros); });
+    Serial.enabled = false;
+    testAllInOneLoop();
+    testBudget();
+    double rate = resumptionsPerSecond(yields);
+    Serial.enabled = true;
+    printf("%u threads, %.0f resumptions/s\n", THREAD_COUNT, rate);
+    return checkResult();
+}
@@ -0,0 +1,92 @@
+// Machines running at once, each on a thread of its own: every machine runs a different program
+// on channel 0 and ends with its own sum, thus the module state of one machine is not seen by
+// the others. Runs on the real clock, the delays of the machines interleave.
+#include <Arduino.h>
+#include <memory>
+#include <thread>
+#include "machine.h"
+#include "host.h"
+#include "bytecode.h"
+#include "check.h"
+
+using namespace bytecode;
+
+const int MACHINES = 8;
+const int VALUES = 30;
+const uint16_t RECEIVED = 0, SENT = 4, SUM = 8;
+
+// The producer sends the multiples of seed to a channel with a capacity of seed, with a delay
+// of a millisecond after each value. The consumer adds the received values.
+std::vector<uint8_t> multiples(int seed)
+{
+    Program program(2, 12);
+    Code &consumer = program.thread(0, 16);
+    consumer.pushUint16(0).pushFloat(seed).pushUint8(0).call(fn::CHANNEL_SETUP);
+    consumer.pushFloat(0).storeGlobal32(SUM);
+    count(consumer, RECEIVED, 1, VALUES + 1, 1, [](Code &code)
+          {
+              code.pushUint16(0).call(fn::CHANNEL_WAIT_VALUE).pushUint16(0).call(fn::CHANNEL_RECEIVE_NUMBER);
+              code.loadGlobal32(SUM).native(Native::ADD).storeGlobal32(SUM); });
+    consumer.call(fn::BASIC_END_THREAD);
+
+    Code &producer = program.thread(1, 16);
+    producer.pushUint16(0).pushFloat(seed).pushUint8(0).call(fn::CHANNEL_SETUP);
+    count(producer, SENT, 1, VALUES + 1, 1, [&](Code &code)
+          {
+              code.pushUint16(0).loadGlobal32(SENT).pushFloat(seed).native(Native::MUL);
+              code.pushUint16(0).call(fn::CHANNEL_WAIT_SLOT).call(fn::CHANNEL_SEND_NUMBER);
+              code.pushFloat(1).call(fn::BASIC_DELAY); });
+    producer.call(fn::BASIC_END_THREAD);
+    return program.build();
+}
+
+void testParallelMachines()
+{
+    std::vector<std::unique_ptr<machine::Machine>> machines;
+    std::vector<std::vector<uint8_t>> programs;
+    for (int i = 0; i < MACHINES; i++)
+    {
+        machines.emplace_back(new machine::Machine());
+        programs.push_back(multiples(i + 1));
+    }
+
+    bool loaded[MACHINES], ended[MACHINES];
+    std::vector<std::thread> threads;
+    for (int i = 0; i < MACHINES; i++)
+        threads.emplace_back([&, i]()
+                             {
+                                 loaded[i] = host::load(*machines[i], programs[i]);
+                                 ended[i] = host::runUntilIdle(*machines[i], 5000); });
+    for (auto &thread : threads)
+        thread.join();
+
+    for (int i = 0; i < MACHINES; i++)
+    {
+        CHECK(loaded[i]);
+        CHECK(ended[i]);
+        CHECK_EQUAL((i + 1) * VALUES * (VALUES + 1) / 2, (int)*(float *)machines[i]->variable(SUM));
+        CHECK_EQUAL(VALUES + 1, (int)*(float *)machines[i]->variable(RECEIVED));
+    }
+}
+
+// machines loaded one after the other, then run in the opposite order, on a single thread
+void testInterleavedLoads()
+{
+    machine::Machine first, second;
+    CHECK(host::load(first, multiples(2)));
+    CHECK(host::load(second, multiples(3)));
+    CHECK(host::runUntilIdle(second, 5000));
+    CHECK(host::runUntilIdle(first, 5000));
+    CHECK_EQUAL(2 * VALUES * (VALUES + 1) / 2, (int)*(float *)first.variable(SUM));
+    CHECK_EQUAL(3 * VALUES * (VALUES + 1) / 2, (int)*(float *)second.variable(SUM));
+}
+
+int main()
+{
+    host::setup();
+    Serial.enabled = false;
+    testParallelMachines();
+    testInterleavedLoads();
+    Serial.enabled = true;
+    return checkResult();
+}
@@ -0,0 +1,146 @@
+// Scheduling by priority, deterministic with the simulated clock: runnable threads of higher
+// priority run first, busy background threads are preempted after their shorter time slice,
+// and background threads still run while higher priority threads use up every loop.
+#include <Arduino.h>
+#include "machine.h"
+#include "host.h"
+#include "bytecode.h"
+#include "check.h"
+#include "modules/basic.h"
+
+using namespace bytecode;
+
+// advances the simulated clock by its argument in microseconds, and records the calling
+// thread and the time, not in the function table of the frontend
+const uint16_t FN_TAKE_TIME = 254, FN_TRACE = 255;
+
+const uint8_t BACKGROUND = 0, NORMAL = 1, INTERACTIVE = 2;
+
+typedef struct
+{
+    uint16_t threadNr;
+    unsigned long time;
+} TraceEntry;
+
+std::vector<TraceEntry> trace;
+
+Code &setPriority(Code &code, uint8_t priority)
+{
+    return code.pushUint8(priority).call(fn::BASIC_SET_PRIORITY);
+}
+
+Code &takeTime(Code &code, float micros)
+{
+    return code.pushFloat(micros).call(FN_TAKE_TIME);
+}
+
+void testOrder()
+{
+    // thread i has priority i, each one yields after tracing its runs
+    Program program(3, 4);
+    for (uint8_t priority : {BACKGROUND, NORMAL, INTERACTIVE})
+    {
+        Code &code = setPriority(program.thread(priority, 16), priority);
+        repeat(code, 3, [](Code &code)
+               { code.call(FN_TRACE).call(fn::BASIC_YIELD); });
+        code.call(fn::BASIC_END_THREAD);
+    }
+
+    trace.clear();
+    CHECK(host::load(program.build()));
+    CHECK(host::runUntilIdle(1000));
+    // loading runs the threads in order, then each loop runs them by priority
+    const uint16_t expected[] = {0, 1, 2, 2, 1, 0, 2, 1, 0};
+    CHECK_EQUAL(9, (int)trace.size());
+    for (size_t i = 0; i < 9 && i < trace.size(); i++)
+        CHECK_EQUAL(expected[i], trace[i].threadNr);
+}
+
+// A busy thread of the given priority runs 300 ms, while another thread waits for 5 ms
+// twenty times. Returns the longest time the waiting thread woke late, in microseconds.
+unsigned long wakeupLatency(uint8_t busyPriority)
+{
+    Program program(2, 4);
+    Code &busy = setPriority(program.thread(0, 16), busyPriority);
+    repeat(busy, 3000, [](Code &code)
+           { takeTime(code, 100); });
+    busy.call(fn::BASIC_END_THREAD);
+
+    Code &waiting = program.thread(1, 16);
+    repeat(waiting, 20, [](Code &code)
+           { code.call(FN_TRACE).pushFloat(5).call(fn::BASIC_DELAY).call(FN_TRACE); });
+    waiting.call(fn::BASIC_END_THREAD);
+
+    trace.clear();
+    CHECK(host::load(program.build()));
+    CHECK(host::runUntilIdle(1000));
+    CHECK_EQUAL(40, (int)trace.size());
+    unsigned long latency = 0;
+    for (size_t i = 0; i + 1 < trace.size(); i += 2)
+        latency = std::max(latency, trace[i + 1].time - trace[i].time - 5000);
+    return latency;
+}
+
+void testTimeSlices()
+{
+    // background threads are preempted after 10 ms, normal ones after 50 ms
+    unsigned long background = wakeupLatency(BACKGROUND);
+    unsigned long normal = wakeupLatency(NORMAL);
+    CHECK(background <= 11000);
+    CHECK(normal > 11000);
+    CHECK(normal <= 51000);
+}
+
+void testStarvation()
+{
+    // Five interactive threads run 3 ms each between yields, thus each loop uses up its
+    // budget of 10 ms before reaching the background thread.
+    Program program(6, 4);
+    for (uint16_t t = 0; t < 5; t++)
+    {
+        Code &code = setPriority(program.thread(t, 16), INTERACTIVE);
+        repeat(code, 200, [](Code &code)
+               { takeTime(code, 3000).call(fn::BASIC_YIELD); });
+        code.call(fn::BASIC_END_THREAD);
+    }
+    Code &background = setPriority(program.thread(5, 16), BACKGROUND);
+    repeat(background, 1000, [](Code &code)
+           { code.call(FN_TRACE).call(fn::BASIC_YIELD); });
+    background.call(fn::BASIC_END_THREAD);
+
+    trace.clear();
+    // the times are relative to the start of the program
+    hostClock::simulate(true);
+    CHECK(host::load(program.build()));
+    CHECK(host::runUntilIdle(10000));
+
+    // while the interactive threads ran 3 s, the background thread ran about once per
+    // starvation time
+    size_t runsWhileBusy = 0;
+    unsigned long longestGap = 0;
+    for (size_t i = 0; i < trace.size() && trace[i].time < 3000000; i++)
+    {
+        runsWhileBusy++;
+        if (i > 0)
+            longestGap = std::max(longestGap, trace[i].time - trace[i - 1].time);
+    }
+    CHECK(runsWhileBusy >= 3000000 / (basicModule::starvationTime + 20000));
+    CHECK(longestGap > 10000);
+    CHECK(longestGap <= basicModule::starvationTime + 20000);
+}
+
+int main()
+{
+    host::setup();
+    machine::registerFunction<FN_TAKE_TIME>(+[](float micros)
+                                            { hostClock::advance(micros); });
+    machine::registerFunction<FN_TRACE>(+[](machine::Machine &machine)
+                                        { trace.push_back(TraceEntry{machine.currentThreadNr, micros()}); });
+    hostClock::simulate(true);
+    Serial.enabled = false;
+    testOrder();
+    testTimeSlices();
+    testStarvation();
+    Serial.enabled = true;
+    return checkResult();
+}
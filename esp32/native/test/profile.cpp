@@ -0,0 +1,96 @@
+// Profile of two threads with a simulated clock, which only advances by the time a test
+// function is told to take. The samples are taken at the calls and backward jumps which
+// check the time slice, about once per millisecond. Both threads run the same loop, thus
+// the samples split between them like the time they ran.
+#include <Arduino.h>
+#include "machine.h"
+#include "host.h"
+#include "bytecode.h"
+#include "check.h"
+
+using namespace bytecode;
+
+// advances the simulated clock by its argument in microseconds, not in the function table
+// of the frontend
+const uint16_t FN_TAKE_TIME = 254;
+
+// repetitions of the loop of each thread, each taking 20us
+const int REPETITIONS[] = {3000, 1000};
+const float COST = 20;
+const uint16_t GLOBALS_SIZE = 16;
+
+std::vector<uint8_t> program()
+{
+    Program program(2, GLOBALS_SIZE);
+    for (uint16_t t = 0; t < 2; t++)
+    {
+        // the loop starts and ends with instructions which never check the time slice
+        uint16_t counter = t * 8, copy = t * 8 + 4;
+        Code &code = program.thread(t, 16);
+        repeat(code, REPETITIONS[t], [&](Code &code)
+               {
+                   code.loadGlobal32(counter).pushFloat(1).native(Native::ADD).storeGlobal32(counter);
+                   code.pushFloat(COST).call(FN_TAKE_TIME);
+                   code.loadGlobal32(counter).storeGlobal32(copy); });
+        code.call(fn::BASIC_END_THREAD);
+    }
+    return program.build();
+}
+
+uint16_t codeOffset(const std::vector<uint8_t> &program, uint16_t threadNr)
+{
+    // header of 7 bytes, then the thread table entries of code and stack offset
+    size_t position = 7 + threadNr * 4;
+    return program[position] | program[position + 1] << 8;
+}
+
+void samples(bool optimize)
+{
+    machine::optimizeCode = optimize;
+    hostClock::simulate(true);
+    auto code = program();
+    CHECK(host::load(code));
+    CHECK(host::runUntilIdle(1000));
+    CHECK_EQUAL(REPETITIONS[0], *(float *)host::machine().variable(0));
+    CHECK_EQUAL(REPETITIONS[1], *(float *)host::machine().variable(8));
+
+    uint32_t threadSamples[2] = {0, 0};
+    for (auto &entry : host::machine().samples())
+    {
+        // each sample is at a call, either of the test function or of controlsRepeatExtDone,
+        // or the jz following it without superinstructions
+        uint8_t opcode = code[entry.first];
+        CHECK(opcode >> 6 == 0b11 || (!optimize && opcode >> 6 == 0b10));
+        threadSamples[entry.first < codeOffset(code, 1) ? 0 : 1] += entry.second;
+    }
+
+    // sampled about once per millisecond, the threads ran 60 and 20 ms
+    uint32_t total = threadSamples[0] + threadSamples[1];
+    CHECK(total >= 25 && total <= 160);
+    CHECK(threadSamples[1] > 0);
+    if (threadSamples[1] > 0)
+    {
+        double ratio = (double)threadSamples[0] / threadSamples[1];
+        CHECK(ratio > 2.5 && ratio < 3.5);
+    }
+
+    // the cycles of the threads follow from the simulated time at 240 MHz
+    auto &threads = host::machine().threadProfiles();
+    CHECK_EQUAL(2u, threads.size());
+    CHECK_EQUAL(REPETITIONS[0] * 20 * 240ull, threads[0].cycles);
+    CHECK_EQUAL(REPETITIONS[1] * 20 * 240ull, threads[1].cycles);
+    // the time slice of 50 ms expires once for the first thread
+    CHECK_EQUAL(1u, threads[0].timeSliceOverruns);
+    CHECK_EQUAL(0u, threads[1].timeSliceOverruns);
+    CHECK_EQUAL((uint32_t)(REPETITIONS[0] + REPETITIONS[1]), host::machine().functionProfile(FN_TAKE_TIME)->calls);
+}
+
+int main()
+{
+    host::setup();
+    machine::registerFunction<FN_TAKE_TIME>(+[](float micros)
+                                            { hostClock::advance(micros); });
+    samples(true);
+    samples(false);
+    return checkResult();
+}
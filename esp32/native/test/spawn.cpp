@@ -0,0 +1,69 @@
+// Threads spawned by basicRunInBackground reuse the stack slots of ended threads without
+// taking over their state, and run with the priority and time slice of the spawning thread.
+#include <Arduino.h>
+#include "machine.h"
+#include "host.h"
+#include "bytecode.h"
+#include "check.h"
+
+using namespace bytecode;
+
+// advances the simulated clock by its argument in microseconds
+const uint16_t FN_TAKE_TIME = 254;
+
+const uint16_t THREAD_COUNT = 4;
+const uint16_t CALLBACK_RAN = 0, LOOP_DONE = 4;
+
+Code &spawn(Code &code, uint16_t templateThreadNr)
+{
+    return code.pushUint16(templateThreadNr).pushFloat(0).call(fn::BASIC_RUN_IN_BACKGROUND);
+}
+
+std::vector<uint8_t> program()
+{
+    Program program(THREAD_COUNT, 8);
+
+    // The first background thread runs periodically and ends, the second one takes its slot
+    // and waits for a callback, which is never triggered. The third one runs with the
+    // background priority of the main thread.
+    Code &main = program.thread(0, 16);
+    spawn(main, 1).pushFloat(5).call(fn::BASIC_DELAY);
+    spawn(main, 2).pushFloat(5).call(fn::BASIC_DELAY);
+    main.pushUint8(0).call(fn::BASIC_SET_PRIORITY);
+    spawn(main, 3).call(fn::BASIC_END_THREAD);
+
+    program.thread(1, 16).call(fn::BASIC_BACKGROUND_THREAD).pushFloat(1).call(fn::BASIC_SETUP_PERIODIC).call(fn::BASIC_END_THREAD);
+
+    program.thread(2, 16).call(fn::BASIC_BACKGROUND_THREAD).call(fn::BASIC_CALLBACK_READY).pushFloat(1).storeGlobal32(CALLBACK_RAN).call(fn::BASIC_END_THREAD);
+
+    // runs 30 ms
+    Code &busy = program.thread(3, 16);
+    busy.call(fn::BASIC_BACKGROUND_THREAD);
+    repeat(busy, 3000, [](Code &code)
+           { code.pushFloat(10).call(FN_TAKE_TIME); });
+    busy.pushFloat(1).storeGlobal32(LOOP_DONE).call(fn::BASIC_END_THREAD);
+    return program.build();
+}
+
+int main()
+{
+    host::setup();
+    machine::registerFunction<FN_TAKE_TIME>(+[](float micros)
+                                            { hostClock::advance(micros); });
+    hostClock::simulate(true);
+    machine::spawnSlots = 2;
+
+    CHECK(host::load(program()));
+    // the periodic deadlines of the ended thread would keep the loop busy
+    CHECK(host::runUntilIdle(1000));
+    CHECK_EQUAL(0, *(float *)host::machine().variable(CALLBACK_RAN));
+    CHECK_EQUAL(1, *(float *)host::machine().variable(LOOP_DONE));
+
+    // the busy thread ran with the time slice of background threads, 10 ms
+    uint32_t overruns = 0;
+    auto &threads = host::machine().threadProfiles();
+    for (uint16_t threadNr = THREAD_COUNT; threadNr < threads.size(); threadNr++)
+        overruns += threads[threadNr].timeSliceOverruns;
+    CHECK(overruns >= 2);
+    return checkResult();
+}
@@ -0,0 +1,307 @@
+// The queues between the network task and the VM task, used like websocket.cpp uses them.
+// Received messages are passed in preallocated slots: the producer sends 10000 messages per
+// second, the consumer drains the queue once per millisecond like the loop of the VM task.
+// Then both run as fast as they can. Outgoing snapshots are allocated by the VM task and
+// freed by the network task, which keeps the last one of each type for HTTP handlers
+// copying it from a third thread.
+//
+// Usage: spscQueue [--seconds s]
+//
+// Every message has to arrive once, in order and intact, unless it was dropped because the
+// queue was full. Reports the dropped messages and the rate without pacing.
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spscQueue.h"
+#include "check.h"
+
+const size_t MAX_MESSAGE_SIZE = 32;
+const size_t QUEUE_SIZE = 64;
+
+struct Message
+{
+    size_t size;
+    uint8_t data[MAX_MESSAGE_SIZE];
+};
+
+// the message with a sequence number, of a size and content following from it
+void fill(Message &message, uint32_t sequence)
+{
+    message.size = sizeof(sequence) + sequence % (MAX_MESSAGE_SIZE - sizeof(sequence) + 1);
+    memcpy(message.data, &sequence, sizeof(sequence));
+    for (size_t i = sizeof(sequence); i < message.size; i++)
+        message.data[i] = (uint8_t)(sequence * 31 + i);
+}
+
+bool intact(const Message &message, uint32_t &sequence)
+{
+    if (message.size < sizeof(sequence) || message.size > MAX_MESSAGE_SIZE)
+        return false;
+    memcpy(&sequence, message.data, sizeof(sequence));
+    Message expected;
+    fill(expected, sequence);
+    return expected.size == message.size && memcmp(expected.data, message.data, message.size) == 0;
+}
+
+void testSingleThread()
+{
+    SpscQueue<int, 4> queue;
+    int value;
+    CHECK(!queue.pop(value));
+    // wraps around several times
+    for (int round = 0; round < 5; round++)
+    {
+        for (int i = 0; i < 4; i++)
+            CHECK(queue.push(round * 10 + i));
+        CHECK(!queue.push(99));
+        CHECK(queue.prepare() == NULL);
+        for (int i = 0; i < 4; i++)
+        {
+            CHECK(queue.pop(value));
+            CHECK_EQUAL(round * 10 + i, value);
+        }
+        CHECK(!queue.pop(value));
+        CHECK(queue.front() == NULL);
+    }
+
+    // values constructed and taken in place
+    *queue.prepare() = 7;
+    queue.commit();
+    CHECK_EQUAL(7, *queue.front());
+    CHECK_EQUAL(7, *queue.front());
+    queue.release();
+    CHECK(queue.front() == NULL);
+}
+
+typedef struct
+{
+    uint32_t sent;
+    uint32_t dropped;
+    uint32_t received;
+    bool ordered;
+    bool intact;
+    double seconds;
+} StressResult;
+
+// messagesPerSecond and drainInterval 0 run the threads without pausing
+StressResult stress(double seconds, uint32_t messagesPerSecond, std::chrono::microseconds drainInterval)
+{
+    static SpscQueue<Message, QUEUE_SIZE> queue;
+    std::atomic<bool> done{false};
+    StressResult result = {0, 0, 0, true, true, 0};
+
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+    std::thread producer([&]()
+                         {
+                             auto next = start;
+                             auto interval = std::chrono::nanoseconds(messagesPerSecond > 0 ? 1000000000 / messagesPerSecond : 0);
+                             while (next < end)
+                             {
+                                 if (messagesPerSecond > 0)
+                                 {
+                                     std::this_thread::sleep_until(next);
+                                     next += interval;
+                                 }
+                                 else
+                                     next = std::chrono::steady_clock::now();
+                                 Message *message = queue.prepare();
+                                 if (message == NULL)
+                                     result.dropped++;
+                                 else
+                                 {
+                                     fill(*message, result.sent);
+                                     queue.commit();
+                                 }
+                                 result.sent++;
+                             }
+                             done = true; });
+
+    uint32_t expected = 0;
+    while (true)
+    {
+        bool finished = done;
+        Message *message;
+        while ((message = queue.front()) != NULL)
+        {
+            uint32_t sequence;
+            if (!intact(*message, sequence))
+                result.intact = false;
+            else
+            {
+                // dropped messages leave gaps
+                if (sequence < expected)
+                    result.ordered = false;
+                expected = sequence + 1;
+            }
+            result.received++;
+            queue.release();
+        }
+        if (finished)
+            break;
+        if (drainInterval.count() > 0)
+            std::this_thread::sleep_for(drainInterval);
+    }
+    producer.join();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+void check(const char *name, const StressResult &result)
+{
+    CHECK(result.ordered);
+    CHECK(result.intact);
+    CHECK_EQUAL(result.sent, result.received + result.dropped);
+    printf("%-8s %10u sent %10u dropped %12.0f received/s\n", name, result.sent, result.dropped, result.received / result.seconds);
+}
+
+// outgoing snapshot, allocated by the VM task, holding a Message
+struct Outgoing
+{
+    size_t size;
+    uint8_t *data;
+};
+
+std::atomic<uint32_t> allocated{0}, freed{0};
+
+Outgoing allocate(uint32_t sequence)
+{
+    Message message;
+    fill(message, sequence);
+    Outgoing outgoing = {message.size, (uint8_t *)malloc(message.size)};
+    memcpy(outgoing.data, message.data, message.size);
+    allocated++;
+    return outgoing;
+}
+
+void release(Outgoing &outgoing)
+{
+    free(outgoing.data);
+    outgoing.data = NULL;
+    freed++;
+}
+
+bool intact(const Outgoing &outgoing, uint32_t &sequence)
+{
+    Message message;
+    message.size = outgoing.size;
+    if (message.size > MAX_MESSAGE_SIZE)
+        return false;
+    memcpy(message.data, outgoing.data, outgoing.size);
+    return intact(message, sequence);
+}
+
+void testOutgoing(uint32_t count)
+{
+    const uint32_t TYPES = 3;
+    SpscQueue<Outgoing, 16> queue;
+    // the last message of each type, by sequence number modulo TYPES
+    Outgoing last[TYPES] = {};
+    std::mutex lastMutex;
+    std::atomic<bool> done{false};
+    uint32_t sent = 0, dropped = 0, received = 0, copied = 0;
+    bool ordered = true, sentIntact = true, copiesIntact = true;
+
+    std::thread vmTask([&]()
+                       {
+                           for (; sent < count; sent++)
+                           {
+                               Outgoing outgoing = allocate(sent);
+                               if (!queue.push(outgoing))
+                               {
+                                   release(outgoing);
+                                   dropped++;
+                               }
+                           }
+                           done = true; });
+
+    std::thread httpHandler([&]()
+                            {
+                                while (!done)
+                                {
+                                    for (uint32_t type = 0; type < TYPES; type++)
+                                    {
+                                        std::vector<uint8_t> copy;
+                                        {
+                                            std::lock_guard<std::mutex> lock(lastMutex);
+                                            if (last[type].data == NULL)
+                                                continue;
+                                            copy.assign(last[type].data, last[type].data + last[type].size);
+                                        }
+                                        uint32_t sequence;
+                                        Outgoing outgoing = {copy.size(), copy.data()};
+                                        copiesIntact = copiesIntact && intact(outgoing, sequence) && sequence % TYPES == type;
+                                        copied++;
+                                    }
+                                } });
+
+    uint32_t expected = 0;
+    while (true)
+    {
+        bool finished = done;
+        Outgoing outgoing;
+        while (queue.pop(outgoing))
+        {
+            uint32_t sequence;
+            if (!intact(outgoing, sequence))
+            {
+                sentIntact = false;
+                release(outgoing);
+            }
+            else
+            {
+                ordered = ordered && sequence >= expected;
+                expected = sequence + 1;
+                std::lock_guard<std::mutex> lock(lastMutex);
+                if (last[sequence % TYPES].data != NULL)
+                    release(last[sequence % TYPES]);
+                last[sequence % TYPES] = outgoing;
+            }
+            received++;
+        }
+        if (finished)
+            break;
+        std::this_thread::yield();
+    }
+    vmTask.join();
+    httpHandler.join();
+    for (auto &outgoing : last)
+    {
+        if (outgoing.data != NULL)
+            release(outgoing);
+    }
+
+    CHECK(ordered);
+    CHECK(sentIntact);
+    CHECK(copiesIntact);
+    CHECK_EQUAL(sent, received + dropped);
+    CHECK_EQUAL(allocated.load(), freed.load());
+    printf("%-8s %10u sent %10u dropped %10u copied\n", "outgoing", sent, dropped, copied);
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = 1;
+    if (argc > 2 && std::string(argv[1]) == "--seconds")
+        seconds = atof(argv[2]);
+
+    testSingleThread();
+
+    auto paced = stress(seconds, 10000, std::chrono::milliseconds(1));
+    check("paced", paced);
+    CHECK(paced.sent >= 10000 * seconds * 0.9);
+    // the queue holds more than the messages of several milliseconds, only a stalled
+    // consumer drops some
+    CHECK(paced.dropped <= paced.sent / 100);
+
+    check("unpaced", stress(seconds / 10, 0, std::chrono::microseconds(0)));
+
+    testOutgoing(200000 * seconds);
+    return checkResult();
+}
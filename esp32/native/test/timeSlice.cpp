@@ -0,0 +1,113 @@
+// Preemption of busy threads: a thread is yielded once its time slice expired, which is only
+// checked at calls and backward jumps, so other threads run in between. Also busy loops
+// without any calls are preempted, and threads running after such a loop check their time
+// slice as often as their own calls need.
+#include <Arduino.h>
+#include "machine.h"
+#include "host.h"
+#include "bytecode.h"
+#include "check.h"
+
+using namespace bytecode;
+
+// advances the simulated clock by its argument in microseconds, and records the time a
+// thread started or, with a non-zero argument, ended. Not in the function table of the frontend
+const uint16_t FN_TAKE_TIME = 254, FN_STARTED = 253;
+
+const uint16_t BUSY = 0, SHORT = 1;
+const uint16_t DONE = 0, COUNTER = 8;
+
+unsigned long started[3];
+unsigned long ended[3];
+
+// the busy thread runs 200 ms, the short one 10 ms
+std::vector<uint8_t> busyAndShort()
+{
+    Program program(2, 8);
+    const int repetitions[] = {2000, 100};
+    for (uint16_t t = 0; t < 2; t++)
+    {
+        Code &code = program.thread(t, 16);
+        code.pushUint8(0).call(FN_STARTED);
+        repeat(code, repetitions[t], [](Code &code)
+               { code.pushFloat(100).call(FN_TAKE_TIME); });
+        code.pushUint8(1).call(FN_STARTED).call(fn::BASIC_END_THREAD);
+    }
+    return program.build();
+}
+
+void testBusyThread(unsigned long timeSlice)
+{
+    machine::timeSlice = timeSlice;
+    hostClock::simulate(true);
+    CHECK(host::load(busyAndShort()));
+    CHECK(host::runUntilIdle(1000));
+
+    // the short thread started once the busy one used up its time slice, the time is
+    // checked about once per millisecond
+    CHECK(started[SHORT] >= timeSlice);
+    CHECK(started[SHORT] <= timeSlice + 5);
+    CHECK_EQUAL(started[SHORT] + 10, ended[SHORT]);
+    CHECK_EQUAL(210u, ended[BUSY]);
+}
+
+void testAfterFastLoop()
+{
+    // A loop without calls taking no simulated time, which checks the time slice as rarely
+    // as possible. Then a busy thread of 100 us calls and a short thread.
+    Program program(3, 16);
+    Code &fast = program.thread(0, 16);
+    count(fast, COUNTER, 0, 300000, 1, [](Code &) {});
+    fast.call(fn::BASIC_END_THREAD);
+    Code &busy = program.thread(1, 16);
+    repeat(busy, 3000, [](Code &code)
+           { code.pushFloat(100).call(FN_TAKE_TIME); });
+    busy.call(fn::BASIC_END_THREAD);
+    program.thread(2, 16).pushUint8(0).call(FN_STARTED).call(fn::BASIC_END_THREAD);
+
+    machine::timeSlice = 50;
+    hostClock::simulate(true);
+    CHECK(host::load(program.build()));
+    CHECK(host::runUntilIdle(1000));
+    // the busy thread checked its time slice from its start on, not as rarely as the loop
+    CHECK(started[2] >= 50);
+    CHECK(started[2] <= 55);
+}
+
+void testLoopWithoutCalls()
+{
+    // counts up in floats, which get stuck at 2^24, thus runs forever
+    Program program(2, 16);
+    Code &busy = program.thread(BUSY, 16);
+    count(busy, COUNTER, 0, 1e9, 1, [](Code &) {});
+    busy.call(fn::BASIC_END_THREAD);
+    program.thread(SHORT, 16).pushFloat(1).storeGlobal32(DONE).call(fn::BASIC_END_THREAD);
+
+    machine::timeSlice = 10;
+    hostClock::simulate(false);
+    // loading runs each thread until it yields
+    CHECK(host::load(program.build()));
+    CHECK_EQUAL(1, *(float *)host::machine().variable(DONE));
+
+    // the busy thread continues when run again
+    float counted = *(float *)host::machine().variable(COUNTER);
+    CHECK(counted > 0);
+    host::loop();
+    CHECK(*(float *)host::machine().variable(COUNTER) > counted);
+}
+
+int main()
+{
+    host::setup();
+    machine::registerFunction<FN_TAKE_TIME>(+[](float micros)
+                                            { hostClock::advance(micros); });
+    machine::registerFunction<FN_STARTED>(+[](machine::Machine &machine, uint8_t end)
+                                          { (end ? ended : started)[machine.currentThreadNr] = millis(); });
+    Serial.enabled = false;
+    testBusyThread(50);
+    testBusyThread(10);
+    testAfterFastLoop();
+    testLoopWithoutCalls();
+    Serial.enabled = true;
+    return checkResult();
+}
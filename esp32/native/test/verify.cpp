@@ -0,0 +1,238 @@
+// Programs which are malformed or fail the verification are not started, valid ones are
+#include <Arduino.h>
+#include "machine.h"
+#include "host.h"
+#include "bytecode.h"
+#include "check.h"
+
+using namespace bytecode;
+
+bool loads(const std::vector<uint8_t> &program)
+{
+    Serial.enabled = false;
+    bool result = host::load(program);
+    Serial.enabled = true;
+    return result;
+}
+
+// a program with a single thread consisting of the given code, followed by basicEndThread
+std::vector<uint8_t> singleThread(std::initializer_list<uint8_t> bytes, uint16_t stackSize = 8, uint16_t globalsSize = 4, uint8_t version = 1)
+{
+    Program program(1, globalsSize, version);
+    program.thread(0, stackSize).raw(bytes).call(fn::BASIC_END_THREAD);
+    return program.build();
+}
+
+void header()
+{
+    auto valid = singleThread({});
+    CHECK(loads(valid));
+
+    CHECK(!loads({}));
+    CHECK(!loads({'M', 'B', 1}));
+
+    auto wrongMagic = valid;
+    wrongMagic[0] = 'X';
+    CHECK(!loads(wrongMagic));
+
+    auto unknownVersion = valid;
+    unknownVersion[2] = 2;
+    CHECK(!loads(unknownVersion));
+
+    // the thread table exceeds the code
+    auto manyThreads = valid;
+    manyThreads[3] = 200;
+    CHECK(!loads(manyThreads));
+    std::vector<uint8_t> truncatedTable(valid.begin(), valid.begin() + 9);
+    CHECK(!loads(truncatedTable));
+}
+
+void threadTable()
+{
+    auto valid = singleThread({});
+
+    // code offset in the header, behind the code
+    auto inHeader = valid;
+    inHeader[7] = 3;
+    CHECK(!loads(inHeader));
+    auto behindCode = valid;
+    behindCode[7] = valid.size() + 1;
+    CHECK(!loads(behindCode));
+
+    // stack offset beyond the memory
+    auto stackBeyondMemory = valid;
+    stackBeyondMemory[9] = 100;
+    CHECK(!loads(stackBeyondMemory));
+}
+
+void truncatedInstructions()
+{
+    // push of a float with only two of its bytes, push and call with a missing argument byte
+    Program push(1, 0);
+    push.thread(0, 8).call(fn::BASIC_END_THREAD).raw({0x04, 0, 0});
+    CHECK(!loads(push.build()));
+
+    Program pushArgument(1, 0);
+    pushArgument.thread(0, 8).call(fn::BASIC_END_THREAD).raw({0x10});
+    CHECK(!loads(pushArgument.build()));
+
+    Program call(1, 0);
+    call.thread(0, 8).call(fn::BASIC_END_THREAD).raw({0xe0, 0x01});
+    CHECK(!loads(call.build()));
+
+    Program jump(1, 0);
+    jump.thread(0, 8).call(fn::BASIC_END_THREAD).raw({0x50});
+    CHECK(!loads(jump.build()));
+
+    Program global(1, 4);
+    global.thread(0, 8).call(fn::BASIC_END_THREAD).raw({LOAD_GLOBAL32, 0});
+    CHECK(!loads(global.build()));
+}
+
+void jumps()
+{
+    // jump behind the code, before the code and into the argument of a push
+    CHECK(!loads(singleThread({0x47})));
+    CHECK(!loads(singleThread({0x01, 0, 0x4c})));
+    CHECK(!loads(singleThread({0x41, 0x01, 0})));
+
+    // jz needs a value on the stack
+    CHECK(!loads(singleThread({0x80})));
+    CHECK(loads(singleThread({0x01, 0, 0x80})));
+}
+
+void stackUsage()
+{
+    // the float exceeds the stack
+    CHECK(!loads(singleThread({0x04, 0, 0, 0, 0, (uint8_t)Native::DROP32}, 2)));
+    CHECK(loads(singleThread({0x04, 0, 0, 0, 0, (uint8_t)Native::DROP32}, 4)));
+
+    // drop of an empty stack, addition of a single float
+    CHECK(!loads(singleThread({(uint8_t)Native::DROP32})));
+    CHECK(!loads(singleThread({0x04, 0, 0, 0, 0, (uint8_t)Native::ADD})));
+
+    // the depth after the jz differs on both paths
+    Program differentDepths(1, 0);
+    Code &code = differentDepths.thread(0, 16);
+    Label end = code.label();
+    code.pushUint8(0).jz(end).pushFloat(1);
+    code.bind(end).call(fn::BASIC_END_THREAD);
+    CHECK(!loads(differentDepths.build()));
+
+    // the end of the code ends the last thread
+    Program noEnd(1, 0);
+    noEnd.thread(0, 8).pushFloat(1).native(Native::DROP32);
+    CHECK(loads(noEnd.build()));
+}
+
+void functionsAndGlobals()
+{
+    // unknown function
+    CHECK(!loads(singleThread({0xe0, 200})));
+
+    // a global beyond the globals, which are followed by the stack
+    CHECK(loads(singleThread({LOAD_GLOBAL32, 0, 0, (uint8_t)Native::DROP32})));
+    CHECK(!loads(singleThread({LOAD_GLOBAL32, 2, 0, (uint8_t)Native::DROP32})));
+    CHECK(!loads(singleThread({0x04, 0, 0, 0, 0, STORE_GLOBAL32, 4, 0})));
+
+    // the extended opcodes require version 1
+    CHECK(!loads(singleThread({LOAD_GLOBAL32, 0, 0, (uint8_t)Native::DROP32}, 8, 4, 0)));
+}
+
+// a program with 12 bytes of globals, accessing the global at the given offset by the
+// function, followed by basicEndThread
+template <typename Access>
+bool accessLoads(uint16_t offset, Access access)
+{
+    Program program(1, 12);
+    Code &code = program.thread(0, 16).pushUint16(offset);
+    access(code);
+    code.call(fn::BASIC_END_THREAD);
+    return loads(program.build());
+}
+
+void variableFunctions()
+{
+    // each function reads or writes its global behind the literal offset, the valid programs
+    // are run, thus handles are only read when rejected
+    auto getVar32 = [](Code &code)
+    { code.call(fn::VARIABLES_GET_VAR32).native(Native::DROP32); };
+    auto setVar32 = [](Code &code)
+    { code.pushFloat(1).pushFloat(2).native(Native::ADD).call(fn::VARIABLES_SET_VAR32); };
+    auto getVar8 = [](Code &code)
+    { code.call(fn::VARIABLES_GET_VAR8); };
+    auto setVar8 = [](Code &code)
+    { code.pushUint8(1).call(fn::VARIABLES_SET_VAR8); };
+    auto getResourceHandle = [](Code &code)
+    { code.call(fn::VARIABLES_GET_RESOURCE_HANDLE).native(Native::DROP32); };
+    auto setResourceHandle = [](Code &code)
+    { code.pushFloat(0).call(fn::VARIABLES_SET_RESOURCE_HANDLE); };
+    auto colourSetVar = [](Code &code)
+    { code.pushFloat(1).pushFloat(0).pushFloat(0).call(fn::COLOUR_SET_VAR); };
+
+    CHECK(accessLoads(8, getVar32));
+    CHECK(!accessLoads(10, getVar32));
+    CHECK(accessLoads(8, setVar32));
+    CHECK(!accessLoads(9, setVar32));
+    CHECK(accessLoads(11, setVar8));
+    CHECK(!accessLoads(12, setVar8));
+    CHECK(!accessLoads(12, getResourceHandle));
+    CHECK(accessLoads(8, setResourceHandle));
+    CHECK(!accessLoads(9, setResourceHandle));
+    CHECK(accessLoads(0, colourSetVar));
+    CHECK(!accessLoads(4, colourSetVar));
+
+    // getVar8 is fused into a load of the global, which is checked without the fusion as well
+    for (bool optimize : {true, false})
+    {
+        machine::optimizeCode = optimize;
+        CHECK(accessLoads(11, getVar8));
+        CHECK(!accessLoads(12, getVar8));
+        CHECK(!accessLoads(0xffff, getVar32));
+    }
+    machine::optimizeCode = true;
+
+    // the offset has to be a literal of the straight code before the call, also if all
+    // paths reaching the call push one in range
+    Program computed(1, 12);
+    computed.thread(0, 16).pushUint8(0).pushUint8(0).call(fn::VARIABLES_GET_VAR32).native(Native::DROP32).call(fn::BASIC_END_THREAD);
+    CHECK(!loads(computed.build()));
+
+    Program branches(1, 12);
+    Code &code = branches.thread(0, 16);
+    Label call = code.label(), literal = code.label();
+    code.pushUint8(1).jz(literal).pushUint16(0).jump(call);
+    code.bind(literal).pushUint16(4);
+    code.bind(call).call(fn::VARIABLES_GET_VAR32).native(Native::DROP32).call(fn::BASIC_END_THREAD);
+    CHECK(!loads(branches.build()));
+}
+
+void threadEnds()
+{
+    // Each thread is checked against its own stack, also if it follows a thread ending with
+    // basicEndThread. The init thread has no stack at all.
+    Program program(2, 0);
+    program.thread(0, 0).call(fn::BASIC_END_THREAD);
+    program.thread(1, 4).pushFloat(1).native(Native::DROP32).call(fn::BASIC_END_THREAD);
+    CHECK(loads(program.build()));
+
+    // the code behind a template's basicBackgroundThread is checked against its stack
+    Program background(2, 0);
+    background.thread(0, 0).call(fn::BASIC_END_THREAD);
+    background.thread(1, 2).call(fn::BASIC_BACKGROUND_THREAD).pushFloat(1).native(Native::DROP32).call(fn::BASIC_END_THREAD);
+    CHECK(!loads(background.build()));
+}
+
+int main()
+{
+    host::setup();
+    header();
+    threadTable();
+    truncatedInstructions();
+    jumps();
+    stackUsage();
+    functionsAndGlobals();
+    variableFunctions();
+    threadEnds();
+    return checkResult();
+}
@@ -0,0 +1,101 @@
+// Times loading large programs, thus decoding, fusing and verifying their code, which happens
+// on the ESP32 whenever new code arrives. Usage: verifyBenchmark [--runs n]
+#include <Arduino.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "machine.h"
+#include "host.h"
+#include "bytecode.h"
+
+using namespace bytecode;
+
+const uint16_t STACK_SIZE = 64;
+// thread offsets in the code are 16 bit, the programs stay below that
+const size_t MAX_CODE_SIZE = 60000;
+
+// a single thread of straight line arithmetic on globals
+std::vector<uint8_t> longThread()
+{
+    const uint16_t a = 0, b = 4;
+    Program program(1, 8);
+    Code &code = program.thread(0, STACK_SIZE);
+    for (int i = 0; i < 5000; i++)
+        code.loadGlobal32(a).loadGlobal32(b).native(Native::ADD).storeGlobal32(a);
+    code.call(fn::BASIC_END_THREAD);
+    return program.build();
+}
+
+// a thread of many conditional blocks, each skipped by a jz, with nested loops
+std::vector<uint8_t> branches()
+{
+    const uint16_t a = 0, i = 4;
+    Program program(1, 8);
+    Code &code = program.thread(0, STACK_SIZE);
+    for (int block = 0; block < 600; block++)
+    {
+        Label skip = code.label();
+        code.loadGlobal32(a).pushFloat(block).native(Native::LT).jz(skip);
+        count(code, i, 0, 10, 1, [&](Code &code)
+              { repeat(code, 3, [&](Code &code)
+                       { code.loadGlobal32(a).pushFloat(1).native(Native::ADD).storeGlobal32(a); }); });
+        code.bind(skip);
+    }
+    code.call(fn::BASIC_END_THREAD);
+    return program.build();
+}
+
+// many small threads, like a program of many event handlers
+std::vector<uint8_t> manyThreads()
+{
+    const uint16_t threadCount = 1000;
+    Program program(threadCount, 4);
+    for (uint16_t t = 0; t < threadCount; t++)
+    {
+        Code &code = program.thread(t, 12);
+        repeat(code, 2, [&](Code &code)
+               { code.loadGlobal32(0).pushFloat(t).native(Native::ADD).storeGlobal32(0); });
+        code.call(fn::BASIC_END_THREAD);
+    }
+    return program.build();
+}
+
+void time(const char *name, const std::vector<uint8_t> &program, int runs)
+{
+    if (program.size() > MAX_CODE_SIZE)
+    {
+        fprintf(stderr, "%s has %zu bytes, too large\n", name, program.size());
+        exit(1);
+    }
+    double seconds = 0;
+    for (int i = 0; i < runs; i++)
+    {
+        Serial.enabled = getenv("VERBOSE") != NULL;
+        auto start = std::chrono::steady_clock::now();
+        bool loaded = host::load(program);
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        Serial.enabled = true;
+        if (!loaded)
+        {
+            fprintf(stderr, "%s was not loaded\n", name);
+            exit(1);
+        }
+    }
+    seconds /= runs;
+    printf("%-14s %8zu %8u %10.3f %10.1f\n", name, program.size(), host::machine().threadCount(), seconds * 1000,
+           program.size() / seconds / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    int runs = 20;
+    if (argc > 2 && std::string(argv[1]) == "--runs")
+        runs = std::max(1, atoi(argv[2]));
+
+    host::setup();
+    printf("%-14s %8s %8s %10s %10s\n", "program", "bytes", "threads", "ms/load", "MB/s");
+    time("longThread", longThread(), runs);
+    time("branches", branches(), runs);
+    time("manyThreads", manyThreads(), runs);
+    return 0;
+}
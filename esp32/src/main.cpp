@@ -21,6 +21,16 @@
 #define LED 2
 namespace main
 {
+  // The VM and the modules run on the application core, WiFi and everything facing the
+  // network on the protocol core. Both sides only communicate through the queues of the
+  // websocket and the snapshots the VM task publishes for the web API (profile, system
+  // status), thus slow network operations do not delay the execution of the program.
+  const BaseType_t VM_CORE = 1;
+  const BaseType_t NETWORK_CORE = 0;
+  const uint32_t TASK_STACK_SIZE = 8192;
+
+  TaskHandle_t vmTask;
+  TaskHandle_t networkTask;
 
   fs::LittleFSFS dataFS;
 
@@ -81,6 +91,30 @@ namespace main
     printDirectory(dir);
   }
 
+  void runVm(void *parameter)
+  {
+    while (true)
+    {
+      microBlocks::loop();
+      microBlocks::waitForEvent();
+    }
+  }
+
+  void runNetwork(void *parameter)
+  {
+    while (true)
+    {
+      wifiManager::loop();
+
+      // serialRequest::loop();
+      otaUpdate::loop();
+
+      websocket::loop();
+
+      delay(1);
+    }
+  }
+
   void setup()
   {
     Serial.begin(115200);
@@ -120,21 +154,16 @@ namespace main
     microBlocks::setup();
     websocket::setup();
     webServer::setup();
+
+    xTaskCreatePinnedToCore(runVm, "vm", TASK_STACK_SIZE, NULL, 1, &vmTask, VM_CORE);
+    xTaskCreatePinnedToCore(runNetwork, "network", TASK_STACK_SIZE, NULL, 1, &networkTask, NETWORK_CORE);
     Serial.println("Setup complete");
   }
 
   void loop()
   {
-    wifiManager::loop();
-
-    // serialRequest::loop();
-    otaUpdate::loop();
-
-    websocket::loop();
-
-    microBlocks::loop();
-
-    delay(1);
+    // all work is done by the tasks started in setup()
+    vTaskDelete(NULL);
   }
 
 }
@@ -0,0 +1,125 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// What happens to an event which arrives while the previous events were not taken yet
+enum class EventPolicy : uint8_t
+{
+    // keep a single pending event, updated to the latest payload but keeping the time of the first
+    COALESCE,
+    // queue up to depth events, further events are dropped
+    QUEUE,
+    // queue up to depth events, a full queue drops its oldest event
+    DROP_OLDEST,
+    COUNT
+};
+
+typedef struct
+{
+    EventPolicy policy;
+    uint8_t depth;
+} EventQueueConfig;
+
+const EventQueueConfig DEFAULT_EVENT_QUEUE_CONFIG = {EventPolicy::COALESCE, 1};
+
+// Ring buffer of the pending events of a single subscription, each with its payload and the
+// time (micros()) it happened. Memory is only allocated when the queue is configured, thus
+// at most a few times per program, never when queueing or taking events.
+template <typename T>
+class EventQueue
+{
+public:
+    typedef struct
+    {
+        T value;
+        unsigned long time;
+    } Event;
+
+    EventQueue()
+    {
+        configure(DEFAULT_EVENT_QUEUE_CONFIG);
+    }
+
+    // Change the policy and depth, keeping the newest pending events which still fit.
+    void configure(const EventQueueConfig &newConfig)
+    {
+        size_t size = capacity(newConfig);
+        if (newConfig.policy == config.policy && size == events.size())
+            return;
+
+        std::vector<Event> resized(size);
+        size_t kept = count < size ? count : size;
+        for (size_t i = 0; i < kept; i++)
+            resized[i] = at(count - kept + i);
+        events.swap(resized);
+        config = newConfig;
+        head = 0;
+        count = kept;
+    }
+
+    // Queue an event. Returns false if an event was dropped or coalesced.
+    bool push(const T &value, unsigned long time)
+    {
+        if (config.policy == EventPolicy::COALESCE && count > 0)
+        {
+            at(count - 1).value = value;
+            return false;
+        }
+
+        bool dropped = false;
+        if (count == events.size())
+        {
+            if (config.policy == EventPolicy::QUEUE)
+                return false;
+            head = (head + 1) % events.size();
+            count--;
+            dropped = true;
+        }
+        Event &event = at(count);
+        event.value = value;
+        event.time = time;
+        count++;
+        return !dropped;
+    }
+
+    // Take the oldest event. Returns false if there is none.
+    bool pop(Event &event)
+    {
+        if (count == 0)
+            return false;
+        event = at(0);
+        head = (head + 1) % events.size();
+        count--;
+        return true;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    // remove all pending events, keeping the memory
+    void clear()
+    {
+        head = 0;
+        count = 0;
+    }
+
+private:
+    static size_t capacity(const EventQueueConfig &config)
+    {
+        // a coalescing queue holds a single event
+        return config.policy == EventPolicy::COALESCE || config.depth == 0 ? 1 : config.depth;
+    }
+
+    Event &at(size_t index)
+    {
+        return events[(head + index) % events.size()];
+    }
+
+    std::vector<Event> events;
+    EventQueueConfig config = {EventPolicy::COUNT, 0};
+    size_t head = 0;
+    size_t count = 0;
+};
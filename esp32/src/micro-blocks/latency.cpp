@@ -0,0 +1,56 @@
+#include "latency.h"
+#include <string.h>
+#include "machine.h"
+
+namespace latency
+{
+    typedef struct
+    {
+        Histogram bySource[(int)Source::COUNT];
+    } Histograms;
+
+    void record(machine::Machine &machine, Source source, unsigned long latency)
+    {
+        auto &histogram = machine.state<Histograms>().bySource[(int)source];
+        histogram.count++;
+        histogram.sum += latency;
+        if (latency > histogram.max)
+            histogram.max = latency;
+
+        int bucket = 0;
+        while (bucket < BUCKET_COUNT - 1 && latency >= (2ul << bucket))
+            bucket++;
+        histogram.buckets[bucket]++;
+    }
+
+    const Histogram &histogram(machine::Machine &machine, Source source)
+    {
+        return machine.state<Histograms>().bySource[(int)source];
+    }
+
+    const char *name(Source source)
+    {
+        switch (source)
+        {
+        case Source::DELAY:
+            return "delay";
+        case Source::CALLBACK:
+            return "callback";
+        case Source::PIN_CHANGE:
+            return "pinChange";
+        case Source::GRAVITY_SENSOR:
+            return "gravitySensor";
+        case Source::PERIODIC:
+            return "periodic";
+        case Source::CHANNEL:
+            return "channel";
+        default:
+            return "unknown";
+        }
+    }
+
+    void clear(machine::Machine &machine)
+    {
+        memset(&machine.state<Histograms>(), 0, sizeof(Histograms));
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <stdint.h>
+
+namespace machine
+{
+    class Machine;
+}
+
+// The histograms are kept per machine.
+namespace latency
+{
+    // sources making a thread runnable
+    enum class Source : uint8_t
+    {
+        DELAY,
+        CALLBACK,
+        PIN_CHANGE,
+        GRAVITY_SENSOR,
+        // deadline of a periodic thread, thus the jitter of its period
+        PERIODIC,
+        // value or free slot in a channel
+        CHANNEL,
+        COUNT
+    };
+
+    const int BUCKET_COUNT = 20;
+
+    // Histogram of the time between a thread becoming runnable and the thread actually
+    // running, in microseconds. Bucket 0 counts latencies below 2us, bucket i latencies
+    // from 2^i us up to 2^(i+1) us. The last bucket counts all larger latencies as well.
+    typedef struct
+    {
+        uint32_t count;
+        uint32_t max;
+        uint64_t sum;
+        uint32_t buckets[BUCKET_COUNT];
+    } Histogram;
+
+    // record the latency of a thread which is about to run
+    void record(machine::Machine &machine, Source source, unsigned long latency);
+
+    const Histogram &histogram(machine::Machine &machine, Source source);
+    const char *name(Source source);
+
+    void clear(machine::Machine &machine);
+}
@@ -1,5 +1,10 @@
 #include "machine.h"
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
 #include <Arduino.h>
 #include "modules/basic.h"
 #include "resourcePool.h"
@@ -8,18 +13,44 @@ namespace machine
 {
 
     const int MAX_FUNCTIONS = 256;
-    MachineFunction functions[MAX_FUNCTIONS];
 
-    uint8_t *code = NULL;
-    uint8_t *memory = NULL;
+    // highest version of the code format supported
+    const uint8_t MAX_VERSION = 1;
+    MachineFunction functions[MAX_FUNCTIONS];
 
+    // stack usage of the registered functions, used by verify()
     typedef struct
     {
-        uint16_t pc;
+        uint8_t argumentSize;
+        uint8_t resultSize;
+    } FunctionStackUsage;
+    FunctionStackUsage functionStackUsages[MAX_FUNCTIONS];
+
+    // Fixed width instruction, translated from the bytecode by applyCode()
+    typedef struct Instruction
+    {
+        const void *handler;
+        union
+        {
+            uint32_t immediate;
+            const uint8_t *data;
+            const Instruction *target;
+            MachineFunction function;
+        };
+        uint16_t length;
+        // function number of calls, for diagnostics
+        uint16_t functionNr;
+    } Instruction;
+
+    struct ThreadInfo
+    {
+        const Instruction *pc;
         uint16_t sp;
-    } ThreadInfo;
+        // time in milliseconds the thread may run before it is yielded
+        unsigned long timeSlice;
+    };
 
-    typedef struct __packed
+    typedef struct __attribute__((packed))
     {
         uint8_t magic[2];
         uint8_t version;
@@ -27,90 +58,152 @@ namespace machine
         uint16_t memorySize;
     } CodeHeader;
 
-    typedef struct __packed
+    typedef struct __attribute__((packed))
     {
         uint16_t codeOffset;
         uint16_t stackOffset;
     } CodeThreadTableEntry;
 
-    ThreadInfo *threads = NULL;
+    // A loaded program: the bytecode, the memory holding the globals and the stacks, the
+    // translated instructions and the state of each thread. Loading a program replaces the
+    // whole program, thus nothing of the previous one survives.
+    class Program
+    {
+    public:
+        uint8_t *code;
+        uint8_t *memory;
+        std::vector<Instruction> instructions;
+        // the threads of the program, followed by the slots of the spawned threads
+        ThreadInfo *threads;
+        // first instruction of each thread of the program and whether it is a template
+        std::vector<const Instruction *> entryPoints;
+        std::vector<bool> isTemplate;
+        // The stack slots of the spawned threads follow the stacks of the threads of the
+        // program in memory. The free slots are kept as a stack, to take and return them in O(1).
+        uint16_t slotCount;
+        uint16_t slotSize;
+        uint16_t slotsOffset;
+        std::vector<uint16_t> freeSlots;
+#ifdef MACHINE_PROFILE
+        // bytecode offset of each instruction, to attribute samples
+        std::vector<uint16_t> instructionOffsets;
+#endif
 
-    uint16_t currentThreadNr;
-    bool threadYielded;
+        Program(uint8_t *code)
+            : code(code), memory(NULL), threads(NULL), slotCount(0), slotSize(0), slotsOffset(0)
+        {
+        }
 
-    ThreadInfo &currentThread()
-    {
-        return threads[currentThreadNr];
-    }
+        Program(const Program &) = delete;
+        Program &operator=(const Program &) = delete;
 
-    uint8_t popUint8()
-    {
-        return memory[--currentThread().sp];
-    }
+        ~Program()
+        {
+            free(code);
+            free(memory);
+            free(threads);
+        }
 
-    uint16_t popUint16()
-    {
-        currentThread().sp -= 2;
-        return *(uint16_t *)(memory + currentThread().sp);
-    }
+        CodeHeader &header() const
+        {
+            return *(CodeHeader *)code;
+        }
+
+        CodeThreadTableEntry &threadTableEntry(uint16_t threadNr) const
+        {
+            return *(CodeThreadTableEntry *)(code + sizeof(CodeHeader) + threadNr * sizeof(CodeThreadTableEntry));
+        }
+    };
+
+    unsigned long timeSlice = 50;
 
-    uint32_t popUint32()
+    uint16_t spawnSlots = 16;
+
+    bool optimizeCode = true;
+
+    // Number of backward jumps and calls between two checks of the time slice. Each run of a
+    // thread starts with the initial interval, as the previous thread might have run a much
+    // faster loop. The maximum bounds how far a thread whose calls suddenly get slow can
+    // overrun its time slice.
+    const int32_t INITIAL_CHECK_INTERVAL = 16;
+    const int32_t MAX_CHECK_INTERVAL = 1024;
+
+    size_t nextStateIndex()
     {
-        currentThread().sp -= 4;
-        return *(uint32_t *)(memory + currentThread().sp);
+        // machines on different tasks may use a kind of state for the first time at once
+        static std::atomic<size_t> count(0);
+        return count++;
     }
 
-    uint8_t *variable(uint16_t offset)
+    Machine::Machine()
+        : currentThreadNr(NO_THREAD), program(NULL), threadYielded(false)
     {
-        return memory + offset;
+#ifdef MACHINE_PROFILE
+        clearProfile();
+#endif
     }
 
-    uint8_t *constantPool(uint16_t offset)
+    Machine::~Machine()
     {
-        return code + offset;
+        delete program;
     }
 
-    float popFloat()
+    uint8_t *Machine::variable(uint16_t offset)
     {
-        currentThread().sp -= 4;
-        return *(float *)(memory + currentThread().sp);
+        return program->memory + offset;
     }
 
-    void pushUint8(uint8_t value)
+    uint8_t *Machine::constantPool(uint16_t offset)
     {
-        memory[currentThread().sp++] = value;
+        return program->code + offset;
     }
 
-    void pushUint16(uint16_t value)
+    void registerFunction(uint16_t functionNr, MachineFunction function, size_t argumentSize, size_t resultSize)
     {
-        *((uint16_t *)(memory + currentThread().sp)) = value;
-        currentThread().sp += 2;
+        if (functionNr >= MAX_FUNCTIONS)
+        {
+            Serial.println(String("Function number ") + functionNr + " is out of range");
+            return;
+        }
+        functions[functionNr] = function;
+        functionStackUsages[functionNr].argumentSize = argumentSize;
+        functionStackUsages[functionNr].resultSize = resultSize;
     }
-    void pushUint32(uint32_t value)
+
+    // handlers of the operations of functions selecting an operation by their last argument
+    std::unordered_map<uint16_t, std::vector<MachineFunction>> operations;
+
+    void registerOperation(uint16_t functionNr, uint8_t operation, MachineFunction function)
     {
-        *((uint32_t *)(memory + currentThread().sp)) = value;
-        currentThread().sp += 4;
+        auto &entries = operations[functionNr];
+        if (entries.size() <= operation)
+            entries.resize(operation + 1, NULL);
+        entries[operation] = function;
     }
 
-    void pushFloat(float value)
+    MachineFunction operation(uint16_t functionNr, uint8_t operation)
     {
-        *((float *)(memory + currentThread().sp)) = value;
-        currentThread().sp += 4;
+        auto entries = operations.find(functionNr);
+        if (entries == operations.end() || entries->second.size() <= operation)
+            return NULL;
+        return entries->second[operation];
     }
 
-    void registerFunction(uint16_t functionNr, MachineFunction function)
+    void invalidOperation(Machine &machine, uint16_t functionNr, uint8_t operation)
     {
-        functions[functionNr] = function;
+        Serial.println(String("Invalid operation ") + operation + " for function " + functionNr + ", stopping thread " + machine.currentThreadNr);
+        machine.suspendCurrentThread();
     }
 
-    void suspendCurrentThread()
+    void Machine::suspendCurrentThread()
     {
         threadYielded = true;
     }
 
-    int32_t readArgument(uint16_t &pc, bool isSigned)
+    // Read the argument of the instruction at pc, advancing pc behind it. Returns false if
+    // the argument exceeds the code.
+    bool readArgument(const uint8_t *code, size_t size, size_t &pc, bool isSigned, int32_t &result)
     {
-        int32_t result = 0;
         uint8_t opcode = code[pc++];
 
         if (isSigned)
@@ -120,125 +213,1286 @@ namespace machine
 
         switch (opcode >> 4 & 0b11)
         {
-        case 0b00:
-            return result;
         case 0b01:
-            return result << 8 | code[pc++];
+            if (pc + 1 > size)
+                return false;
+            result = result << 8 | code[pc++];
+            break;
         case 0b10:
-            return result << 16 | code[pc++] | code[pc++] << 8;
+        {
+            if (pc + 2 > size)
+                return false;
+            int32_t low = code[pc++];
+            int32_t high = code[pc++];
+            result = result << 16 | low | high << 8;
+            break;
         }
-        return result;
+        }
+        return true;
+    }
+
+#ifdef MACHINE_PROFILE
+    const FunctionProfile *Machine::functionProfile(uint16_t functionNr) const
+    {
+        if (functionNr >= MAX_FUNCTIONS)
+            return NULL;
+        return &functionProfiles[functionNr];
     }
 
-    CodeHeader &header()
+    const std::vector<ThreadProfile> &Machine::threadProfiles() const
     {
-        return *(CodeHeader *)code;
+        return threadProfileEntries;
     }
 
-    CodeThreadTableEntry &threadTableEntry(uint16_t threadNr)
+    const std::unordered_map<uint16_t, uint32_t> &Machine::samples() const
     {
-        return *(CodeThreadTableEntry *)(code + sizeof(CodeHeader) + threadNr * sizeof(CodeThreadTableEntry));
+        return sampleCounts;
     }
 
+    uint64_t Machine::executedInstructions() const
+    {
+        return instructionCount;
+    }
+
+    void Machine::clearProfile()
+    {
+        sampleCounts.clear();
+        instructionCount = 0;
+        functionProfiles.assign(MAX_FUNCTIONS, FunctionProfile());
+        threadProfileEntries.assign(threadCount(), ThreadProfile());
+    }
+#endif
+
+    void interpret(Machine *machine, ThreadInfo *thread);
+
     void setup()
     {
         for (int i = 0; i < MAX_FUNCTIONS; i++)
             functions[i] = NULL;
+
+        // publish the handler addresses for the decoder
+        interpret(NULL, NULL);
     }
 
-    void runThread(uint16_t threadNr)
+    // operations of the internal instruction stream
+    enum Operation : uint8_t
     {
+        OP_PUSH8,
+        OP_PUSH16,
+        OP_PUSH32,
+        OP_PUSH,
+        OP_JUMP,
+        OP_JZ,
+        OP_CALL,
+        OP_END,
+
+        // native operations of the extended opcode page, available from version 1
+        OP_ADD,
+        OP_SUB,
+        OP_MUL,
+        OP_DIV,
+        OP_EQ,
+        OP_NEQ,
+        OP_LT,
+        OP_LTE,
+        OP_GT,
+        OP_GTE,
+        OP_AND,
+        OP_OR,
+        OP_NOT,
+        OP_DUP32,
+        OP_DROP32,
+        OP_STORE_GLOBAL32,
+
+        // also used as superinstruction, created by fuse()
+        OP_LOAD_GLOBAL32,
+
+        // superinstructions, created by fuse()
+        OP_LOAD_GLOBAL8,
+        OP_ADD_IMMEDIATE,
+        OP_SUB_IMMEDIATE,
+        OP_MUL_IMMEDIATE,
+        OP_DIV_IMMEDIATE,
+        OP_COMPARE_JZ,
+        OP_REPEAT_JZ,
+        OP_COUNT
+    };
+
+    // threads starting with a call of this function are templates for spawned threads
+    const uint16_t FN_BASIC_END_THREAD = 11;
+    const uint16_t FN_BASIC_BACKGROUND_THREAD = 57;
+
+    // functions the superinstructions are derived from, see functionTable.ts
+    const uint16_t FN_VARIABLES_GET_VAR32 = 5;
+    const uint16_t FN_MATH_BINARY = 6;
+    const uint16_t FN_LOGIC_COMPARE = 7;
+    const uint16_t FN_CONTROLS_REPEAT_EXT_DONE = 10;
+    const uint16_t FN_VARIABLES_GET_VAR8 = 37;
+
+    // functions accessing a global at an offset passed as their first argument, with the
+    // size of the global, see functionTable.ts
+    typedef struct
+    {
+        uint16_t functionNr;
+        uint8_t size;
+    } VariableAccess;
+
+    const VariableAccess VARIABLE_ACCESSES[] = {
+        {4, 4},   // variablesSetVar32
+        {FN_VARIABLES_GET_VAR32, 4},
+        {28, 4},  // variablesGetResourceHandle
+        {29, 4},  // variablesSetResourceHandle
+        {36, 1},  // variablesSetVar8
+        {FN_VARIABLES_GET_VAR8, 1},
+        {39, 12}, // colourSetVar
+    };
+
+    // handler addresses of the operations, published by interpret()
+    const void *const *handlers = NULL;
+
+    void interpret(Machine *machine, ThreadInfo *thread)
+    {
+        // must be kept in the order of the Operation enum
+        static const void *const dispatchTable[OP_COUNT] = {
+            &&push8,
+            &&push16,
+            &&push32,
+            &&push,
+            &&jump,
+            &&jz,
+            &&call,
+            &&end,
+            &&add,
+            &&sub,
+            &&mul,
+            &&div,
+            &&eq,
+            &&neq,
+            &&lt,
+            &&lte,
+            &&gt,
+            &&gte,
+            &&logicalAnd,
+            &&logicalOr,
+            &&logicalNot,
+            &&dup32,
+            &&drop32,
+            &&storeGlobal32,
+            &&loadGlobal32,
+            &&loadGlobal8,
+            &&addImmediate,
+            &&subImmediate,
+            &&mulImmediate,
+            &&divImmediate,
+            &&compareJz,
+            &&repeatJz,
+        };
+
+        if (machine == NULL)
+        {
+            handlers = dispatchTable;
+            return;
+        }
+
         unsigned long startTime = millis();
+        unsigned long lastCheck = startTime;
+        int32_t checkInterval = INITIAL_CHECK_INTERVAL;
+        int32_t budget = checkInterval;
+        // kept in locals while running, to allow the compiler to hold them in registers
+        uint8_t *memory = machine->program->memory;
+        const Instruction *pc = thread->pc;
+        uint8_t *stackPointer = memory + thread->sp;
+
+#ifdef MACHINE_PROFILE
+        // the call or jump which used up the budget, sampled as position of the thread
+        const Instruction *sampledPc = pc;
+#define DISPATCH()          \
+    {                       \
+        machine->instructionCount++; \
+        goto *pc->handler;  \
+    }
+#define SAMPLE_AT(instruction) sampledPc = instruction
+#else
+#define DISPATCH() goto *pc->handler
+#define SAMPLE_AT(instruction)
+#endif
+
+// Continue at the destination. Backward jumps consume budget, as every loop contains one
+#define JUMP_TO(destination)                   \
+    {                                          \
+        const Instruction *next = destination; \
+        bool backward = next <= pc;            \
+        if (backward && --budget <= 0)         \
+        {                                      \
+            SAMPLE_AT(pc);                     \
+            pc = next;                         \
+            goto budgetExhausted;              \
+        }                                      \
+        pc = next;                             \
+        DISPATCH();                            \
+    }
+
+        DISPATCH();
+
+    push8:
+        *stackPointer++ = pc->immediate;
+        pc++;
+        DISPATCH();
+
+    push16:
+        memcpy(stackPointer, &pc->immediate, 2);
+        stackPointer += 2;
+        pc++;
+        DISPATCH();
 
+    push32:
+        memcpy(stackPointer, &pc->immediate, 4);
+        stackPointer += 4;
+        pc++;
+        DISPATCH();
+
+    push:
+        memcpy(stackPointer, pc->data, pc->length);
+        stackPointer += pc->length;
+        pc++;
+        DISPATCH();
+
+    jump:
+        JUMP_TO(pc->target);
+
+    jz:
+        if (*--stackPointer == 0)
+            JUMP_TO(pc->target);
+        pc++;
+        DISPATCH();
+
+    call:
+    {
+        // Serial.println(String("Calling function, SP: ") + (stackPointer - memory));
+#ifdef MACHINE_PROFILE
+        uint32_t callStart = ESP.getCycleCount();
+#endif
+        Context context = {stackPointer, machine};
+        pc->function(context);
+        stackPointer = context.stackPointer;
+#ifdef MACHINE_PROFILE
+        machine->functionProfiles[pc->functionNr].calls++;
+        machine->functionProfiles[pc->functionNr].cycles += ESP.getCycleCount() - callStart;
+#endif
+        pc++;
+        if (machine->threadYielded)
+        {
+            thread->pc = pc;
+            thread->sp = stackPointer - memory;
+            return;
+        }
+        if (--budget <= 0)
+        {
+            SAMPLE_AT(pc - 1);
+            goto budgetExhausted;
+        }
+        DISPATCH();
+    }
+
+#define FLOAT_BINARY_OPERATION(op)                                     \
+    {                                                                  \
+        stackPointer -= 4;                                             \
+        float left = StackValue<float>::read(stackPointer - 4);        \
+        float right = StackValue<float>::read(stackPointer);           \
+        StackValue<float>::write(stackPointer - 4, left op right);     \
+        pc++;                                                          \
+        DISPATCH();                                                    \
+    }
+
+    add:
+        FLOAT_BINARY_OPERATION(+)
+    sub:
+        FLOAT_BINARY_OPERATION(-)
+    mul:
+        FLOAT_BINARY_OPERATION(*)
+    div:
+        FLOAT_BINARY_OPERATION(/)
+
+#undef FLOAT_BINARY_OPERATION
+
+#define FLOAT_COMPARISON(op)                                           \
+    {                                                                  \
+        stackPointer -= 8;                                             \
+        float a = StackValue<float>::read(stackPointer);               \
+        float b = StackValue<float>::read(stackPointer + 4);           \
+        *stackPointer++ = a op b;                                      \
+        pc++;                                                          \
+        DISPATCH();                                                    \
+    }
+
+    eq:
+        FLOAT_COMPARISON(==)
+    neq:
+        FLOAT_COMPARISON(!=)
+    lt:
+        FLOAT_COMPARISON(<)
+    lte:
+        FLOAT_COMPARISON(<=)
+    gt:
+        FLOAT_COMPARISON(>)
+    gte:
+        FLOAT_COMPARISON(>=)
+
+#undef FLOAT_COMPARISON
+
+    logicalAnd:
+        stackPointer--;
+        stackPointer[-1] = stackPointer[-1] && *stackPointer;
+        pc++;
+        DISPATCH();
+
+    logicalOr:
+        stackPointer--;
+        stackPointer[-1] = stackPointer[-1] || *stackPointer;
+        pc++;
+        DISPATCH();
+
+    logicalNot:
+        stackPointer[-1] = stackPointer[-1] == 0;
+        pc++;
+        DISPATCH();
+
+    dup32:
+        memcpy(stackPointer, stackPointer - 4, 4);
+        stackPointer += 4;
+        pc++;
+        DISPATCH();
+
+    drop32:
+        stackPointer -= 4;
+        pc++;
+        DISPATCH();
+
+    storeGlobal32:
+        stackPointer -= 4;
+        memcpy(memory + pc->immediate, stackPointer, 4);
+        pc++;
+        DISPATCH();
+
+    loadGlobal32:
+        memcpy(stackPointer, memory + pc->immediate, 4);
+        stackPointer += 4;
+        pc++;
+        DISPATCH();
+
+    loadGlobal8:
+        *stackPointer++ = memory[pc->immediate];
+        pc++;
+        DISPATCH();
+
+#define FLOAT_IMMEDIATE_OPERATION(op)                                  \
+    {                                                                  \
+        float left = StackValue<float>::read(stackPointer - 4);        \
+        float right;                                                   \
+        memcpy(&right, &pc->immediate, 4);                             \
+        StackValue<float>::write(stackPointer - 4, left op right);     \
+        pc++;                                                          \
+        DISPATCH();                                                    \
+    }
+
+    addImmediate:
+        FLOAT_IMMEDIATE_OPERATION(+)
+    subImmediate:
+        FLOAT_IMMEDIATE_OPERATION(-)
+    mulImmediate:
+        FLOAT_IMMEDIATE_OPERATION(*)
+    divImmediate:
+        FLOAT_IMMEDIATE_OPERATION(/)
+
+#undef FLOAT_IMMEDIATE_OPERATION
+
+    compareJz:
+    {
+        stackPointer -= 8;
+        float a = StackValue<float>::read(stackPointer);
+        float b = StackValue<float>::read(stackPointer + 4);
+        bool result;
+        switch (pc->length)
+        {
+        case 0:
+            result = a == b;
+            break;
+        case 1:
+            result = a != b;
+            break;
+        case 2:
+            result = a < b;
+            break;
+        case 3:
+            result = a <= b;
+            break;
+        case 4:
+            result = a > b;
+            break;
+        default:
+            result = a >= b;
+            break;
+        }
+        if (!result)
+            JUMP_TO(pc->target);
+        pc++;
+        DISPATCH();
+    }
+
+    repeatJz:
+    {
+        // decrement the remaining repetitions, jump back unless they are done, which like
+        // controlsRepeatExtDone is not the case for NaN
+        float times = StackValue<float>::read(stackPointer - 4) - 1;
+        StackValue<float>::write(stackPointer - 4, times);
+        if (!(times <= 0))
+            JUMP_TO(pc->target);
+        pc++;
+        DISPATCH();
+    }
+
+    end:
+        // the thread ran past the end of the code, it stays here
+        thread->pc = pc;
+        thread->sp = stackPointer - memory;
+        return;
+
+    budgetExhausted:
+    {
+#ifdef MACHINE_PROFILE
+        // the budget is exhausted about once per millisecond, sample the position of the thread
+        machine->sampleCounts[machine->program->instructionOffsets[sampledPc - machine->program->instructions.data()]]++;
+#endif
+        unsigned long now = millis();
+        if (now - startTime > thread->timeSlice)
+        {
+#ifdef MACHINE_PROFILE
+            machine->threadProfileEntries[machine->currentThreadNr].timeSliceOverruns++;
+#endif
+            thread->pc = pc;
+            thread->sp = stackPointer - memory;
+            basicModule::yieldCurrentThread(*machine);
+            return;
+        }
+
+        // adapt the interval such that the time is checked about once per millisecond, it
+        // shrinks by the number of milliseconds which passed
+        if (now == lastCheck && checkInterval < MAX_CHECK_INTERVAL)
+            checkInterval *= 2;
+        else if (now - lastCheck > 1)
+            checkInterval = std::max<int32_t>(1, checkInterval / (int32_t)std::min<unsigned long>(now - lastCheck, MAX_CHECK_INTERVAL));
+        lastCheck = now;
+        budget = checkInterval;
+        DISPATCH();
+    }
+
+#undef JUMP_TO
+#undef SAMPLE_AT
+#undef DISPATCH
+    }
+
+    uint16_t Machine::threadCount() const
+    {
+        return program == NULL ? 0 : program->header().threadCount + program->slotCount;
+    }
+
+    bool Machine::isSpawned(uint16_t threadNr) const
+    {
+        return program != NULL && threadNr >= program->header().threadCount && threadNr < threadCount();
+    }
+
+    uint16_t Machine::spawnThread(uint16_t templateThreadNr)
+    {
+        if (program == NULL || templateThreadNr >= program->header().threadCount || !program->isTemplate[templateThreadNr] || program->freeSlots.empty())
+            return NO_THREAD;
+
+        uint16_t slot = program->freeSlots.back();
+        program->freeSlots.pop_back();
+        uint16_t threadNr = program->header().threadCount + slot;
+        auto &thread = program->threads[threadNr];
+        thread.pc = program->entryPoints[templateThreadNr];
+        thread.sp = program->slotsOffset + slot * program->slotSize;
+        // the time slice depends on the priority, which the new thread takes over as well
+        thread.timeSlice = currentThreadNr < threadCount() ? program->threads[currentThreadNr].timeSlice : timeSlice;
+        return threadNr;
+    }
+
+    void Machine::endCurrentThread()
+    {
+        suspendCurrentThread();
+        // the slot is only taken again by a later spawnThread(), after this thread returned
+        if (isSpawned(currentThreadNr))
+            program->freeSlots.push_back(currentThreadNr - program->header().threadCount);
+    }
+
+    void Machine::setTimeSlice(uint16_t threadNr, unsigned long threadTimeSlice)
+    {
+        if (threadNr < threadCount())
+            program->threads[threadNr].timeSlice = threadTimeSlice;
+    }
+
+    void Machine::runThread(uint16_t threadNr)
+    {
         // Serial.println(String("Running Thread ") + threadNr);
         currentThreadNr = threadNr;
         threadYielded = false;
-        ThreadInfo &thread = threads[threadNr];
+#ifdef MACHINE_PROFILE
+        uint32_t runStart = ESP.getCycleCount();
+        interpret(this, &program->threads[threadNr]);
+        threadProfileEntries[threadNr].runs++;
+        threadProfileEntries[threadNr].cycles += ESP.getCycleCount() - runStart;
+#else
+        interpret(this, &program->threads[threadNr]);
+#endif
+        // Serial.println(String("Thread ") + threadNr + " yielded");
+    }
 
-        while (!threadYielded)
+    // Instruction as decoded from the bytecode, before the handler and the jump target are resolved
+    typedef struct
+    {
+        Operation operation;
+        uint32_t immediate;
+        const uint8_t *data;
+        uint16_t length;
+        uint16_t functionNr;
+        MachineFunction function;
+        size_t offset;
+        size_t target;
+    } DecodedInstruction;
+
+    DecodedInstruction decoded(Operation operation, size_t offset)
+    {
+        DecodedInstruction result;
+        result.operation = operation;
+        result.immediate = 0;
+        result.data = NULL;
+        result.length = 0;
+        result.functionNr = 0;
+        result.function = NULL;
+        result.offset = offset;
+        result.target = 0;
+        return result;
+    }
+
+    bool isJump(Operation operation)
+    {
+        return operation == OP_JUMP || operation == OP_JZ || operation == OP_COMPARE_JZ || operation == OP_REPEAT_JZ;
+    }
+
+    // Decode an instruction of the extended opcode page
+    bool decodeExtended(const Program &program, size_t &pc, size_t size, std::vector<DecodedInstruction> &result)
+    {
+        auto initialPc = pc;
+        if (program.header().version < 1)
+        {
+            Serial.println(String("Extended opcode at ") + pc + " requires version 1");
+            return false;
+        }
+
+        uint8_t opcode = program.code[pc++];
+        if (opcode >= 0b00110000 && opcode <= 0b00111110)
+        {
+            // operations without argument, in the order of the Operation enum
+            result.push_back(decoded((Operation)(OP_ADD + (opcode & 0xf)), initialPc));
+            return true;
+        }
+
+        if (opcode == 0b01110000 || opcode == 0b01110001)
+        {
+            if (pc + 2 > size)
+            {
+                Serial.println(String("Argument of instruction at ") + initialPc + " exceeds the code");
+                return false;
+            }
+            auto instruction = decoded(opcode == 0b01110000 ? OP_LOAD_GLOBAL32 : OP_STORE_GLOBAL32, initialPc);
+            instruction.immediate = program.code[pc] | program.code[pc + 1] << 8;
+            pc += 2;
+            result.push_back(instruction);
+            return true;
+        }
+
+        Serial.println(String("Unknown extended opcode ") + opcode + " at " + initialPc);
+        return false;
+    }
+
+    // Decode the bytecode between codeStart and size
+    bool decodeBytecode(const Program &program, size_t codeStart, size_t size, std::vector<DecodedInstruction> &result)
+    {
+        size_t pc = codeStart;
+        while (pc < size)
         {
-            auto initialPc = thread.pc;
-            switch (code[thread.pc] >> 6)
+            auto initialPc = pc;
+            if ((program.code[pc] >> 4 & 0b11) == 0b11)
+            {
+                if (!decodeExtended(program, pc, size, result))
+                    return false;
+                continue;
+            }
+
+            switch (program.code[pc] >> 6)
             {
             case 0b00:
             {
-                int32_t bytes = readArgument(thread.pc, false);
-                for (auto i = 0; i < bytes; i++)
+                int32_t bytes;
+                if (!readArgument(program.code, size, pc, false, bytes) || pc + bytes > size)
                 {
-                    memory[thread.sp++] = code[thread.pc++];
+                    Serial.println(String("Push at ") + initialPc + " exceeds the code");
+                    return false;
                 }
+                DecodedInstruction instruction;
+                switch (bytes)
+                {
+                case 1:
+                    instruction = decoded(OP_PUSH8, initialPc);
+                    break;
+                case 2:
+                    instruction = decoded(OP_PUSH16, initialPc);
+                    break;
+                case 4:
+                    instruction = decoded(OP_PUSH32, initialPc);
+                    break;
+                default:
+                    instruction = decoded(OP_PUSH, initialPc);
+                }
+                if (bytes <= 4)
+                    memcpy(&instruction.immediate, program.code + pc, bytes);
+                instruction.data = program.code + pc;
+                instruction.length = bytes;
+                result.push_back(instruction);
+                pc += bytes;
                 break;
             }
             case 0b01:
+            case 0b10:
             {
-                auto offset = readArgument(thread.pc, true);
-                if (offset >= 0)
-                    thread.pc += offset;
-                else
-                    thread.pc = initialPc + offset;
+                auto instruction = decoded(program.code[pc] >> 6 == 0b01 ? OP_JUMP : OP_JZ, initialPc);
+                int32_t offset;
+                if (!readArgument(program.code, size, pc, true, offset))
+                {
+                    Serial.println(String("Jump at ") + initialPc + " exceeds the code");
+                    return false;
+                }
+                instruction.target = offset >= 0 ? pc + offset : initialPc + offset;
+                result.push_back(instruction);
                 break;
             }
-            case 0b10:
+            case 0b11:
             {
-                int32_t offset = readArgument(thread.pc, true);
-                if (memory[--thread.sp] == 0)
+                int32_t functionNr;
+                if (!readArgument(program.code, size, pc, false, functionNr))
                 {
-                    if (offset >= 0)
-                        thread.pc += offset;
-                    else
-                        thread.pc = initialPc + offset;
+                    Serial.println(String("Call at ") + initialPc + " exceeds the code");
+                    return false;
                 }
+                if (functionNr >= MAX_FUNCTIONS || functions[functionNr] == NULL)
+                {
+                    // the stack usage of unknown functions is unknown as well, thus the code cannot be verified
+                    Serial.println(String("Call of unknown function ") + functionNr + " at " + initialPc);
+                    return false;
+                }
+                auto instruction = decoded(OP_CALL, initialPc);
+                instruction.functionNr = functionNr;
+                instruction.function = functions[functionNr];
+                result.push_back(instruction);
                 break;
             }
-            case 0b11:
+            }
+        }
+        result.push_back(decoded(OP_END, size));
+        return true;
+    }
+
+    // number of superinstructions created by fuse(), by operation, and of the calls it bound
+    // to an operation
+    typedef struct
+    {
+        uint16_t byOperation[OP_COUNT];
+        uint16_t specializedCalls;
+    } FusionStatistics;
+
+    bool isCall(const DecodedInstruction &instruction, uint16_t functionNr)
+    {
+        return instruction.operation == OP_CALL && instruction.functionNr == functionNr;
+    }
+
+    // Replace common instruction sequences by superinstructions. Sequences
+    // are only fused if no jump targets an instruction after the first one.
+    std::vector<DecodedInstruction> fuse(const std::vector<DecodedInstruction> &input, const std::vector<bool> &isJumpTarget, size_t codeStart, FusionStatistics &statistics)
+    {
+        std::vector<DecodedInstruction> result;
+        for (size_t i = 0; i < input.size();)
+        {
+            // number of instructions following the current one which can be fused, superinstructions
+            // combine at most three instructions thus there is no need to look further
+            size_t available = 0;
+            while (available < 2 && i + available + 1 < input.size() && !isJumpTarget[input[i + available + 1].offset - codeStart])
+                available++;
+
+            auto &first = input[i];
+            DecodedInstruction fused = first;
+            size_t fusedCount = 1;
+
+            if (available >= 1 && first.operation == OP_PUSH16 && isCall(input[i + 1], FN_VARIABLES_GET_VAR32))
             {
-                int32_t functionNr = readArgument(thread.pc, false);
-                // Serial.println(String("Calling function ") + functionNr + " SP: " + (thread.sp - threadTableEntry(threadNr).stackOffset));
-                auto function = functions[functionNr];
-                if (function != NULL)
-                    function();
+                // push <offset>; call variablesGetVar32
+                fused.operation = OP_LOAD_GLOBAL32;
+                fusedCount = 2;
+            }
+            else if (available >= 1 && first.operation == OP_PUSH16 && isCall(input[i + 1], FN_VARIABLES_GET_VAR8))
+            {
+                // push <offset>; call variablesGetVar8
+                fused.operation = OP_LOAD_GLOBAL8;
+                fusedCount = 2;
+            }
+            else if (available >= 2 && first.operation == OP_PUSH32 && input[i + 1].operation == OP_PUSH8 && input[i + 1].immediate <= 3 && isCall(input[i + 2], FN_MATH_BINARY))
+            {
+                // push <float>; push <add|sub|mul|div>; call mathBinary
+                static const Operation operations[] = {OP_ADD_IMMEDIATE, OP_SUB_IMMEDIATE, OP_MUL_IMMEDIATE, OP_DIV_IMMEDIATE};
+                fused.operation = operations[input[i + 1].immediate];
+                fusedCount = 3;
+            }
+            else if (available >= 1 && first.operation == OP_PUSH32 && input[i + 1].operation >= OP_ADD && input[i + 1].operation <= OP_DIV)
+            {
+                // push <float>; <add|sub|mul|div>
+                fused.operation = (Operation)(OP_ADD_IMMEDIATE + (input[i + 1].operation - OP_ADD));
+                fusedCount = 2;
+            }
+            else if (available >= 1 && first.operation >= OP_EQ && first.operation <= OP_GTE && input[i + 1].operation == OP_JZ)
+            {
+                // <comparison>; jz
+                fused.operation = OP_COMPARE_JZ;
+                fused.length = first.operation - OP_EQ;
+                fused.target = input[i + 1].target;
+                fusedCount = 2;
+            }
+            else if (available >= 2 && first.operation == OP_PUSH8 && first.immediate <= 5 && isCall(input[i + 1], FN_LOGIC_COMPARE) && input[i + 2].operation == OP_JZ)
+            {
+                // push <comparison>; call logicCompare; jz
+                fused.operation = OP_COMPARE_JZ;
+                fused.length = first.immediate;
+                fused.target = input[i + 2].target;
+                fusedCount = 3;
+            }
+            else if (available >= 1 && isCall(first, FN_CONTROLS_REPEAT_EXT_DONE) && input[i + 1].operation == OP_JZ)
+            {
+                // call controlsRepeatExtDone; jz
+                fused.operation = OP_REPEAT_JZ;
+                fused.target = input[i + 1].target;
+                fusedCount = 2;
+            }
+            else if (available >= 1 && first.operation == OP_PUSH8 && input[i + 1].operation == OP_CALL && operation(input[i + 1].functionNr, first.immediate) != NULL)
+            {
+                // push <operation>; call <function selecting the operation>
+                fused = input[i + 1];
+                fused.offset = first.offset;
+                fused.function = operation(input[i + 1].functionNr, first.immediate);
+                fusedCount = 2;
+                statistics.specializedCalls++;
+            }
+
+            if (fusedCount > 1)
+                statistics.byOperation[fused.operation]++;
+            result.push_back(fused);
+            i += fusedCount;
+        }
+        return result;
+    }
+
+    // Translate the bytecode of all threads into the instruction stream. Jump
+    // targets and the start of the threads are resolved to instruction pointers.
+    // number of bytes an instruction pops from and pushes to the stack
+    void stackUsage(const DecodedInstruction &instruction, int32_t &popped, int32_t &pushed)
+    {
+        popped = 0;
+        pushed = 0;
+        switch (instruction.operation)
+        {
+        case OP_PUSH8:
+        case OP_PUSH16:
+        case OP_PUSH32:
+        case OP_PUSH:
+            pushed = instruction.length;
+            break;
+        case OP_JZ:
+            popped = 1;
+            break;
+        case OP_CALL:
+            popped = functionStackUsages[instruction.functionNr].argumentSize;
+            pushed = functionStackUsages[instruction.functionNr].resultSize;
+            break;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+            popped = 8;
+            pushed = 4;
+            break;
+        case OP_EQ:
+        case OP_NEQ:
+        case OP_LT:
+        case OP_LTE:
+        case OP_GT:
+        case OP_GTE:
+            popped = 8;
+            pushed = 1;
+            break;
+        case OP_AND:
+        case OP_OR:
+            popped = 2;
+            pushed = 1;
+            break;
+        case OP_NOT:
+            popped = 1;
+            pushed = 1;
+            break;
+        case OP_DUP32:
+            popped = 4;
+            pushed = 8;
+            break;
+        case OP_DROP32:
+        case OP_STORE_GLOBAL32:
+            popped = 4;
+            break;
+        case OP_LOAD_GLOBAL32:
+            pushed = 4;
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Size of the stack of a thread, reaching up to the stack of the next thread. Negative if
+    // the stack offset is beyond the memory.
+    int32_t stackSize(const Program &program, uint16_t threadNr)
+    {
+        auto stackOffset = program.threadTableEntry(threadNr).stackOffset;
+        uint32_t stackEnd = program.header().memorySize;
+        for (uint16_t other = 0; other < program.header().threadCount; other++)
+        {
+            auto otherOffset = program.threadTableEntry(other).stackOffset;
+            if ((otherOffset > stackOffset || (otherOffset == stackOffset && other > threadNr)) && otherOffset < stackEnd)
+                stackEnd = otherOffset;
+        }
+        return (int32_t)stackEnd - (int32_t)stackOffset;
+    }
+
+    // size of the memory before the stacks of the threads, which holds the globals
+    uint32_t globalsSize(const Program &program)
+    {
+        uint32_t size = program.header().memorySize;
+        for (uint16_t t = 0; t < program.header().threadCount; t++)
+        {
+            if (program.threadTableEntry(t).stackOffset < size)
+                size = program.threadTableEntry(t).stackOffset;
+        }
+        return size;
+    }
+
+    // Check the globals accessed directly by the instructions, also by the superinstructions
+    // created by fuse().
+    bool globalsInRange(const std::vector<DecodedInstruction> &input, uint32_t globalsSize)
+    {
+        for (auto &instruction : input)
+        {
+            uint32_t size = 0;
+            if (instruction.operation == OP_LOAD_GLOBAL32 || instruction.operation == OP_STORE_GLOBAL32)
+                size = 4;
+            else if (instruction.operation == OP_LOAD_GLOBAL8)
+                size = 1;
+            if (size > 0 && instruction.immediate + size > globalsSize)
+            {
+                Serial.println(String("Global at ") + instruction.offset + " is out of range");
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // size of the global accessed by a call, 0 if the function does not access one
+    uint8_t variableSize(const DecodedInstruction &instruction)
+    {
+        if (instruction.operation != OP_CALL)
+            return 0;
+        for (auto &access : VARIABLE_ACCESSES)
+        {
+            if (access.functionNr == instruction.functionNr)
+                return access.size;
+        }
+        return 0;
+    }
+
+    // The offset of the global accessed by a call has to be pushed as a literal by the straight
+    // code before the call, as the compiler does, and the global has to be in range. The
+    // instructions in between must not touch the offset on the stack.
+    bool variableInRange(const std::vector<DecodedInstruction> &input, const std::vector<bool> &isJumpTarget, size_t codeStart,
+                         const std::vector<int32_t> &depths, size_t call, uint32_t globalsSize)
+    {
+        auto &instruction = input[call];
+        int32_t offsetDepth = depths[call] - functionStackUsages[instruction.functionNr].argumentSize;
+        // other paths reaching an instruction might push another offset
+        for (size_t i = call; i > 0 && !isJumpTarget[input[i].offset - codeStart];)
+        {
+            i--;
+            if (depths[i] < 0)
                 break;
+            int32_t popped, pushed;
+            stackUsage(input[i], popped, pushed);
+            if (depths[i] - popped >= offsetDepth + 2)
+                continue;
+            if (input[i].operation != OP_PUSH16 || depths[i] != offsetDepth)
+                break;
+            if (input[i].immediate + variableSize(instruction) > globalsSize)
+            {
+                Serial.println(String("Global at ") + input[i].offset + " is out of range");
+                return false;
             }
-            default:
-                return;
+            return true;
+        }
+        Serial.println(String("Offset of the global accessed at ") + instruction.offset + " is not a literal");
+        return false;
+    }
+
+    // Verify the decoded bytecode before it is run, similar to the StackSizeCalculator of the
+    // compiler. All paths of each thread are followed. The stack depth has to be the same on
+    // all paths reaching an instruction and has to stay within the stack of the thread. Jump
+    // targets have to be at the start of an instruction and globals have to be in range, also
+    // the ones accessed through the variables functions. Thus the interpreter does not need
+    // any checks while running.
+    bool verify(const Program &program, const std::vector<DecodedInstruction> &input, const std::vector<bool> &isJumpTarget, size_t codeStart, size_t size)
+    {
+        // instruction index for each bytecode offset, -1 if no instruction starts there
+        std::vector<int32_t> instructionIndex(size - codeStart + 1, -1);
+        for (size_t i = 0; i < input.size(); i++)
+            instructionIndex[input[i].offset - codeStart] = i;
+
+        for (size_t i = 0; i < input.size(); i++)
+        {
+            auto &instruction = input[i];
+            if (isJump(instruction.operation) && instructionIndex[instruction.target - codeStart] < 0)
+            {
+                Serial.println(String("Jump target ") + instruction.target + " is not at the start of an instruction");
+                return false;
             }
+        }
+        uint32_t globals = globalsSize(program);
+        if (!globalsInRange(input, globals))
+            return false;
 
-            if (millis() - startTime > 50)
+        // stack depth before each instruction, -1 if not reached yet by the current thread.
+        // Only the reached entries are reset for the next thread, which keeps verifying many
+        // small threads linear in the size of the code.
+        std::vector<int32_t> depths(input.size(), -1);
+        std::vector<size_t> reached;
+        std::vector<size_t> pending;
+        for (uint16_t t = 0; t < program.header().threadCount; t++)
+        {
+            for (auto index : reached)
+                depths[index] = -1;
+            reached.clear();
+
+            int32_t threadStackSize = stackSize(program, t);
+            if (threadStackSize < 0)
             {
-                basicModule::yieldCurrentThread();
+                Serial.println(String("Invalid stack offset of thread ") + t);
+                return false;
+            }
+
+            auto start = instructionIndex[program.threadTableEntry(t).codeOffset - codeStart];
+            if (start < 0)
+            {
+                Serial.println(String("Invalid code offset of thread ") + t);
+                return false;
+            }
+
+            depths[start] = 0;
+            reached.push_back(start);
+            pending.push_back(start);
+            while (!pending.empty())
+            {
+                auto index = pending.back();
+                pending.pop_back();
+                auto &instruction = input[index];
+
+                int32_t popped, pushed;
+                stackUsage(instruction, popped, pushed);
+                if (depths[index] < popped)
+                {
+                    Serial.println(String("Stack underflow at ") + instruction.offset + " in thread " + t);
+                    return false;
+                }
+                int32_t depth = depths[index] - popped + pushed;
+                if (depth > threadStackSize)
+                {
+                    Serial.println(String("Stack overflow at ") + instruction.offset + " in thread " + t + ", stack size is " + threadStackSize);
+                    return false;
+                }
+
+                // a thread never continues behind its end, the code there belongs to the next thread
+                size_t successors[2];
+                size_t successorCount = 0;
+                if (instruction.operation != OP_END && instruction.operation != OP_JUMP && !isCall(instruction, FN_BASIC_END_THREAD))
+                {
+                    if (index + 1 >= input.size())
+                    {
+                        Serial.println(String("Thread ") + t + " runs past the end of the code");
+                        return false;
+                    }
+                    successors[successorCount++] = index + 1;
+                }
+                if (isJump(instruction.operation))
+                    successors[successorCount++] = instructionIndex[instruction.target - codeStart];
+
+                for (size_t s = 0; s < successorCount; s++)
+                {
+                    auto successor = successors[s];
+                    if (depths[successor] < 0)
+                    {
+                        depths[successor] = depth;
+                        reached.push_back(successor);
+                        pending.push_back(successor);
+                    }
+                    else if (depths[successor] != depth)
+                    {
+                        Serial.println(String("Stack depth at ") + input[successor].offset + " is " + depths[successor] + " or " + depth + " in thread " + t);
+                        return false;
+                    }
+                }
+            }
+
+            // the depths of all instructions before a reached call are known now
+            for (auto index : reached)
+            {
+                if (variableSize(input[index]) > 0 && !variableInRange(input, isJumpTarget, codeStart, depths, index, globals))
+                    return false;
             }
         }
+        return true;
+    }
 
-        // Serial.println(String("Thread ") + threadNr + " yielded");
+    bool decode(Program &program, size_t size, FusionStatistics &statistics)
+    {
+        program.instructions.clear();
+
+        size_t tableEnd = sizeof(CodeHeader) + program.header().threadCount * sizeof(CodeThreadTableEntry);
+        size_t codeStart = size;
+        for (uint16_t i = 0; i < program.header().threadCount; i++)
+        {
+            auto codeOffset = program.threadTableEntry(i).codeOffset;
+            if (codeOffset < tableEnd || codeOffset > size)
+            {
+                Serial.println(String("Invalid code offset of thread ") + i);
+                return false;
+            }
+            if (codeOffset < codeStart)
+                codeStart = codeOffset;
+        }
+
+        std::vector<DecodedInstruction> decodedInstructions;
+        if (!decodeBytecode(program, codeStart, size, decodedInstructions))
+            return false;
+
+        std::vector<bool> isJumpTarget(size - codeStart + 1, false);
+        for (auto &instruction : decodedInstructions)
+        {
+            if (!isJump(instruction.operation))
+                continue;
+            if (instruction.target < codeStart || instruction.target > size)
+            {
+                Serial.println(String("Invalid jump target ") + instruction.target);
+                return false;
+            }
+            isJumpTarget[instruction.target - codeStart] = true;
+        }
+        for (uint16_t i = 0; i < program.header().threadCount; i++)
+            isJumpTarget[program.threadTableEntry(i).codeOffset - codeStart] = true;
+
+        if (!verify(program, decodedInstructions, isJumpTarget, codeStart, size))
+            return false;
+
+        if (optimizeCode)
+        {
+            decodedInstructions = fuse(decodedInstructions, isJumpTarget, codeStart, statistics);
+            // the superinstructions take the offsets of their globals from the verified code,
+            // checked again as the interpreter relies on them
+            if (!globalsInRange(decodedInstructions, globalsSize(program)))
+                return false;
+        }
+
+        // instruction index for each bytecode offset, -1 if no instruction starts there
+        std::vector<int32_t> instructionIndex(size - codeStart + 1, -1);
+        for (size_t i = 0; i < decodedInstructions.size(); i++)
+            instructionIndex[decodedInstructions[i].offset - codeStart] = i;
+
+        program.instructions.resize(decodedInstructions.size());
+#ifdef MACHINE_PROFILE
+        program.instructionOffsets.resize(decodedInstructions.size());
+        for (size_t i = 0; i < decodedInstructions.size(); i++)
+            program.instructionOffsets[i] = decodedInstructions[i].offset;
+#endif
+        for (size_t i = 0; i < decodedInstructions.size(); i++)
+        {
+            auto &source = decodedInstructions[i];
+            auto &instruction = program.instructions[i];
+            instruction.handler = handlers[source.operation];
+            instruction.length = source.length;
+            instruction.immediate = source.immediate;
+            if (source.operation == OP_PUSH)
+                instruction.data = source.data;
+            if (source.operation == OP_CALL)
+            {
+                instruction.function = source.function;
+                instruction.functionNr = source.functionNr;
+            }
+            if (isJump(source.operation))
+            {
+                if (instructionIndex[source.target - codeStart] < 0)
+                {
+                    Serial.println(String("Jump target ") + source.target + " is not at the start of an instruction");
+                    return false;
+                }
+                instruction.target = &program.instructions[instructionIndex[source.target - codeStart]];
+            }
+        }
+
+        program.entryPoints.resize(program.header().threadCount);
+        program.isTemplate.resize(program.header().threadCount);
+        for (uint16_t i = 0; i < program.header().threadCount; i++)
+        {
+            auto index = instructionIndex[program.threadTableEntry(i).codeOffset - codeStart];
+            if (index < 0)
+            {
+                Serial.println(String("Invalid code offset of thread ") + i);
+                return false;
+            }
+            program.threads[i].pc = &program.instructions[index];
+            program.entryPoints[i] = &program.instructions[index];
+            program.isTemplate[i] = isCall(decodedInstructions[index], FN_BASIC_BACKGROUND_THREAD);
+        }
+        return true;
     }
 
-    void applyCode(uint8_t *buf, size_t size)
+    std::vector<FusionCount> superinstructionCounts(const FusionStatistics &statistics)
     {
-        if (code != NULL)
+        const char *names[OP_COUNT] = {};
+        names[OP_LOAD_GLOBAL32] = "loadGlobal32";
+        names[OP_LOAD_GLOBAL8] = "loadGlobal8";
+        names[OP_ADD_IMMEDIATE] = "addImmediate";
+        names[OP_SUB_IMMEDIATE] = "subImmediate";
+        names[OP_MUL_IMMEDIATE] = "mulImmediate";
+        names[OP_DIV_IMMEDIATE] = "divImmediate";
+        names[OP_COMPARE_JZ] = "compareJz";
+        names[OP_REPEAT_JZ] = "repeatJz";
+
+        std::vector<FusionCount> counts;
+        for (int i = 0; i < OP_COUNT; i++)
         {
-            free(code);
+            if (names[i] != NULL)
+                counts.push_back(FusionCount{names[i], statistics.byOperation[i]});
         }
+        counts.push_back(FusionCount{"specializedCalls", statistics.specializedCalls});
+        return counts;
+    }
 
-        if (memory != NULL)
+    const std::vector<FusionCount> &Machine::superinstructionCounts() const
+    {
+        return fusionCounts;
+    }
+
+    void printFusionCounts(const Program &program, const std::vector<FusionCount> &counts)
+    {
+        String report = String("Decoded ") + program.instructions.size() + " instructions, superinstructions:";
+        for (auto &count : counts)
+            report += String(" ") + count.name + "=" + count.count;
+        Serial.println(report);
+    }
+
+    // Reserve the stack slots of the spawned threads behind the memory of the program, if it
+    // contains templates. Stack pointers are 16 bit offsets, which limits the number of slots.
+    void reserveSlots(Program &program)
+    {
+        uint16_t threadCount = program.header().threadCount;
+        uint32_t memorySize = program.header().memorySize;
+        uint32_t slotSize = 0;
+        for (uint16_t i = 0; i < threadCount; i++)
         {
-            free(memory);
+            if (program.isTemplate[i] && (uint32_t)stackSize(program, i) > slotSize)
+                slotSize = stackSize(program, i);
+        }
+        if (slotSize == 0)
+            return;
+
+        uint32_t slotCount = spawnSlots;
+        if (memorySize + slotCount * slotSize > UINT16_MAX)
+            slotCount = (UINT16_MAX - memorySize) / slotSize;
+
+        program.memory = (uint8_t *)realloc(program.memory, memorySize + slotCount * slotSize);
+        bzero(program.memory + memorySize, slotCount * slotSize);
+        program.threads = (ThreadInfo *)realloc(program.threads, (threadCount + slotCount) * sizeof(ThreadInfo));
+        program.slotCount = slotCount;
+        program.slotSize = slotSize;
+        program.slotsOffset = memorySize;
+        for (uint16_t slot = slotCount; slot > 0; slot--)
+            program.freeSlots.push_back(slot - 1);
+        Serial.println(String("Reserved ") + slotCount + " slots of " + slotSize + " bytes for spawned threads");
+    }
+
+    void Machine::applyCode(uint8_t *buf, size_t size)
+    {
+        delete program;
+        program = NULL;
+        FusionStatistics statistics = {};
+        fusionCounts = machine::superinstructionCounts(statistics);
+
+        CodeHeader *codeHeader = (CodeHeader *)buf;
+        if (size < sizeof(CodeHeader) || codeHeader->magic[0] != 0x4D || codeHeader->magic[1] != 0x42 || codeHeader->version > MAX_VERSION)
+        {
+            Serial.println(String("Unsupported code, version ") + (size < sizeof(CodeHeader) ? 0 : codeHeader->version));
+            free(buf);
+#ifdef MACHINE_PROFILE
+            clearProfile();
+#endif
+            return;
         }
-        if (threads != NULL)
+        if (size < sizeof(CodeHeader) + codeHeader->threadCount * sizeof(CodeThreadTableEntry))
         {
-            free(threads);
+            Serial.println(String("Thread table of ") + codeHeader->threadCount + " threads exceeds the code");
+            free(buf);
+#ifdef MACHINE_PROFILE
+            clearProfile();
+#endif
+            return;
+        }
+
+        Program *loaded = new Program(buf);
+        loaded->memory = (uint8_t *)malloc(codeHeader->memorySize);
+        bzero(loaded->memory, codeHeader->memorySize);
+
+        loaded->threads = (ThreadInfo *)malloc(codeHeader->threadCount * sizeof(ThreadInfo));
+        for (auto i = 0; i < codeHeader->threadCount; i++)
+        {
+            loaded->threads[i].sp = loaded->threadTableEntry(i).stackOffset;
+            loaded->threads[i].timeSlice = timeSlice;
         }
-        code = buf;
-        memory = (uint8_t *)malloc(header().memorySize);
-        bzero(memory, header().memorySize);
 
-        threads = (ThreadInfo *)malloc(header().threadCount * sizeof(ThreadInfo));
-        for (auto i = 0; i < header().threadCount; i++)
+        bool valid = decode(*loaded, size, statistics);
+        fusionCounts = machine::superinstructionCounts(statistics);
+        if (!valid)
         {
-            threads[i].pc = threadTableEntry(i).codeOffset;
-            threads[i].sp = threadTableEntry(i).stackOffset;
+            Serial.println("Failed to decode the code, not starting any thread");
+            delete loaded;
+#ifdef MACHINE_PROFILE
+            clearProfile();
+#endif
+            return;
         }
+        printFusionCounts(*loaded, fusionCounts);
+        reserveSlots(*loaded);
 
-        for (uint16_t i = 0; i < header().threadCount; i++)
+        program = loaded;
+#ifdef MACHINE_PROFILE
+        clearProfile();
+#endif
+        for (uint16_t i = 0; i < codeHeader->threadCount; i++)
         {
             Serial.println(String("Initial start of thread ") + i);
             runThread(i);
@@ -1,47 +1,452 @@
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
-#include <functional>
+#include <string.h>
+#include <vector>
+#include <memory>
 #include "resourcePool.h"
+#ifdef MACHINE_PROFILE
+#include <unordered_map>
+#endif
 
 namespace machine
 {
-    typedef std::function<void()> MachineFunction;
+    class Machine;
+
+    // Gives native functions access to the running thread and the machine running it. The
+    // interpreter keeps the stack pointer in a local while running and only passes it to the
+    // called function.
+    typedef struct
+    {
+        uint8_t *stackPointer;
+        Machine *machine;
+    } Context;
+
+    typedef void (*MachineFunction)(Context &context);
 
     void setup();
     void loop();
 
-    void applyCode(uint8_t *buf, size_t size);
+    const uint16_t NO_THREAD = 0xffff;
+
+    // Number of threads which can be spawned at the same time. If a program contains template
+    // threads (threads starting with a call of basicBackgroundThread), as many stack slots are
+    // reserved when loading it, sized for the largest stack of its templates.
+    extern uint16_t spawnSlots;
+
+    // time in milliseconds a thread may run before it is yielded to let other threads run.
+    // The time is only checked after calls and backward jumps. This is the initial time
+    // slice of each thread when a program is loaded, Machine::setTimeSlice() changes it per thread.
+    extern unsigned long timeSlice;
+
+    // Whether applyCode() fuses instruction sequences into superinstructions and binds calls
+    // to operations. If disabled, each bytecode instruction is executed on its own, which
+    // serves as reference when checking the optimizations.
+    extern bool optimizeCode;
 
-    extern uint16_t currentThreadNr;
-    void suspendCurrentThread();
-    void runThread(uint16_t threadNr);
+    typedef struct
+    {
+        const char *name;
+        uint16_t count;
+    } FusionCount;
+
+#ifdef MACHINE_PROFILE
+    // Execution profile, only collected if compiled with MACHINE_PROFILE defined. It is
+    // updated while threads run, thus only the task running the machine may read it.
+    // Cycles are CPU cycles and include the time spent in called functions.
+    typedef struct __attribute__((packed))
+    {
+        uint32_t calls;
+        uint64_t cycles;
+    } FunctionProfile;
+
+    typedef struct __attribute__((packed))
+    {
+        uint32_t runs;
+        // number of times the thread was yielded because its time slice expired
+        uint32_t timeSliceOverruns;
+        uint64_t cycles;
+    } ThreadProfile;
+#endif
 
-    uint8_t popUint8();
-    uint16_t popUint16();
-    uint32_t popUint32();
+    class Program;
+    struct ThreadInfo;
+
+    struct StateBase
+    {
+        virtual ~StateBase() {}
+    };
 
     template <typename T>
-    resourcePool::ResourceHandle<T> *popResourceHandle()
+    struct StateHolder : StateBase
     {
-        return reinterpret_cast<resourcePool::ResourceHandle<T> *>(machine::popUint32());
-    }
+        T value;
+    };
+
+    // index of the next kind of state kept by the machines
+    size_t nextStateIndex();
+
+    // A virtual machine running one program at a time. Machines share nothing but the
+    // registered functions and the settings above, which are only changed while no machine
+    // runs. Thus machines may run in parallel, each on its own task.
+    class Machine
+    {
+    public:
+        Machine();
+        ~Machine();
+
+        Machine(const Machine &) = delete;
+        Machine &operator=(const Machine &) = delete;
+
+        // Replace the program by the one in buf, which the machine takes ownership of, and
+        // run each of its threads once. The caller resets the modules before.
+        void applyCode(uint8_t *buf, size_t size);
+
+        uint16_t currentThreadNr;
+        void suspendCurrentThread();
+        void runThread(uint16_t threadNr);
+
+        // number of thread numbers of the loaded program, including the slots for spawned threads,
+        // 0 if none is loaded
+        uint16_t threadCount() const;
+
+        // Start a new thread running the code of a template thread, using a free stack slot. Returns
+        // the number of the new thread, NO_THREAD if there is no free slot or the thread is no
+        // template. The new thread is not run, this is up to the caller. It gets the time slice of
+        // the current thread, which spawns it.
+        uint16_t spawnThread(uint16_t templateThreadNr);
+
+        // whether a thread number belongs to a spawned thread
+        bool isSpawned(uint16_t threadNr) const;
+
+        // Suspend the current thread for good. The stack slot of a spawned thread is reused.
+        void endCurrentThread();
+
+        void setTimeSlice(uint16_t threadNr, unsigned long threadTimeSlice);
+
+        uint8_t *variable(uint16_t offset);
+        uint8_t *constantPool(uint16_t offset);
+
+        // number of superinstructions of each kind created when applying the last program, and
+        // of the calls bound to an operation, named "specializedCalls"
+        const std::vector<FusionCount> &superinstructionCounts() const;
+
+#ifdef MACHINE_PROFILE
+        // profile of a function, NULL if the function number is out of range
+        const FunctionProfile *functionProfile(uint16_t functionNr) const;
+        // profile of each thread of the current program
+        const std::vector<ThreadProfile> &threadProfiles() const;
+        // number of samples by bytecode offset. Running threads are sampled about once per
+        // millisecond, whenever the time slice is checked, at the offset of the call or backward
+        // jump which triggered the check.
+        const std::unordered_map<uint16_t, uint32_t> &samples() const;
+        // number of instructions executed, a superinstruction counts as one
+        uint64_t executedInstructions() const;
+        // cleared when applying new code
+        void clearProfile();
+#endif
+
+        // the resources created by the program, cleared by the modules when they are reset
+        resourcePool::Pool resources;
+
+        // The state a module keeps for this machine, created on first use and destroyed with
+        // the machine. Each module keeps its state in a type of its own.
+        template <typename T>
+        T &state()
+        {
+            static const size_t index = nextStateIndex();
+            if (index >= states.size())
+                states.resize(index + 1);
+            if (!states[index])
+                states[index].reset(new StateHolder<T>());
+            return static_cast<StateHolder<T> *>(states[index].get())->value;
+        }
+
+    private:
+        // the loaded program, NULL if none is loaded
+        Program *program;
+        bool threadYielded;
+        std::vector<FusionCount> fusionCounts;
+        // destroyed before the resources, which the states may still reference
+        std::vector<std::unique_ptr<StateBase>> states;
+#ifdef MACHINE_PROFILE
+        std::vector<FunctionProfile> functionProfiles;
+        std::vector<ThreadProfile> threadProfileEntries;
+        std::unordered_map<uint16_t, uint32_t> sampleCounts;
+        uint64_t instructionCount;
+#endif
+
+        friend void interpret(Machine *machine, ThreadInfo *thread);
+    };
+
+    // Representation of a value on the stack
+    template <typename T>
+    struct StackValue
+    {
+        static const size_t size = sizeof(T);
+
+        static T read(const uint8_t *ptr)
+        {
+            T value;
+            memcpy(&value, ptr, sizeof(T));
+            return value;
+        }
+
+        static void write(uint8_t *ptr, T value)
+        {
+            memcpy(ptr, &value, sizeof(T));
+        }
+    };
+
+    template <>
+    struct StackValue<bool>
+    {
+        static const size_t size = 1;
+
+        static bool read(const uint8_t *ptr)
+        {
+            return *ptr != 0;
+        }
+
+        static void write(uint8_t *ptr, bool value)
+        {
+            *ptr = value ? 1 : 0;
+        }
+    };
+
+    // pointers (resource handles) are stored as 32 bit values, host builds have to keep the
+    // resources below 4 GB
+    template <typename T>
+    struct StackValue<T *>
+    {
+        static const size_t size = 4;
+
+        static T *read(const uint8_t *ptr)
+        {
+            return reinterpret_cast<T *>(static_cast<uintptr_t>(StackValue<uint32_t>::read(ptr)));
+        }
 
-    float popFloat();
-    void pushUint8(uint8_t value);
-    void pushUint16(uint16_t value);
-    void pushUint32(uint32_t value);
+        static void write(uint8_t *ptr, T *value)
+        {
+            StackValue<uint32_t>::write(ptr, static_cast<uint32_t>(reinterpret_cast<uintptr_t>(value)));
+        }
+    };
 
     template <typename T>
-    void pushResourceHandle(resourcePool::ResourceHandle<T> *handle)
+    inline T pop(Context &context)
+    {
+        context.stackPointer -= StackValue<T>::size;
+        return StackValue<T>::read(context.stackPointer);
+    }
+
+    template <typename T>
+    inline void push(Context &context, T value)
+    {
+        StackValue<T>::write(context.stackPointer, value);
+        context.stackPointer += StackValue<T>::size;
+    }
+
+    /// @brief Register a function. The sizes of the arguments it pops and the result it pushes
+    /// are used to verify the stack usage of a program when it is loaded.
+    void registerFunction(uint16_t functionNr, MachineFunction function, size_t argumentSize, size_t resultSize);
+
+    void registerOperation(uint16_t functionNr, uint8_t operation, MachineFunction function);
+    MachineFunction operation(uint16_t functionNr, uint8_t operation);
+    void invalidOperation(Machine &machine, uint16_t functionNr, uint8_t operation);
+
+    namespace binding
+    {
+        template <size_t... Is>
+        struct Indices
+        {
+        };
+
+        template <size_t N, size_t... Is>
+        struct MakeIndices : MakeIndices<N - 1, N - 1, Is...>
+        {
+        };
+
+        template <size_t... Is>
+        struct MakeIndices<0, Is...>
+        {
+            typedef Indices<Is...> type;
+        };
+
+        // stack size of all arguments
+        template <typename... Args>
+        struct StackSize
+        {
+            static const size_t value = 0;
+        };
+
+        template <typename T, typename... Rest>
+        struct StackSize<T, Rest...>
+        {
+            static const size_t value = StackValue<T>::size + StackSize<Rest...>::value;
+        };
+
+        // stack size of a result
+        template <typename R>
+        struct ResultSize
+        {
+            static const size_t value = StackValue<R>::size;
+        };
+
+        template <>
+        struct ResultSize<void>
+        {
+            static const size_t value = 0;
+        };
+
+        // stack offset of argument I, relative to the first argument
+        template <size_t I, typename... Args>
+        struct ArgumentOffset;
+
+        template <typename T, typename... Rest>
+        struct ArgumentOffset<0, T, Rest...>
+        {
+            static const size_t value = 0;
+        };
+
+        template <size_t I, typename T, typename... Rest>
+        struct ArgumentOffset<I, T, Rest...>
+        {
+            static const size_t value = StackValue<T>::size + ArgumentOffset<I - 1, Rest...>::value;
+        };
+
+        template <typename R>
+        struct Invoker
+        {
+            template <typename... Args, size_t... Is>
+            static void invoke(Context &context, R (*function)(Args...), Indices<Is...>)
+            {
+                context.stackPointer -= StackSize<Args...>::value;
+                const uint8_t *arguments = context.stackPointer;
+                // unused by functions without arguments
+                (void)arguments;
+                push<R>(context, function(StackValue<Args>::read(arguments + ArgumentOffset<Is, Args...>::value)...));
+            }
+
+            template <typename... Args, size_t... Is>
+            static void invoke(Context &context, R (*function)(Machine &, Args...), Indices<Is...>)
+            {
+                context.stackPointer -= StackSize<Args...>::value;
+                const uint8_t *arguments = context.stackPointer;
+                // unused by functions without arguments
+                (void)arguments;
+                push<R>(context, function(*context.machine, StackValue<Args>::read(arguments + ArgumentOffset<Is, Args...>::value)...));
+            }
+        };
+
+        template <>
+        struct Invoker<void>
+        {
+            template <typename... Args, size_t... Is>
+            static void invoke(Context &context, void (*function)(Args...), Indices<Is...>)
+            {
+                context.stackPointer -= StackSize<Args...>::value;
+                const uint8_t *arguments = context.stackPointer;
+                // unused by functions without arguments
+                (void)arguments;
+                function(StackValue<Args>::read(arguments + ArgumentOffset<Is, Args...>::value)...);
+            }
+
+            template <typename... Args, size_t... Is>
+            static void invoke(Context &context, void (*function)(Machine &, Args...), Indices<Is...>)
+            {
+                context.stackPointer -= StackSize<Args...>::value;
+                const uint8_t *arguments = context.stackPointer;
+                // unused by functions without arguments
+                (void)arguments;
+                function(*context.machine, StackValue<Args>::read(arguments + ArgumentOffset<Is, Args...>::value)...);
+            }
+        };
+
+        const int NO_OPERATION = -1;
+
+        // Holds the function registered under a function number (and operation) and
+        // translates between the stack and the function arguments
+        template <uint16_t functionNr, int operation, typename R, typename... Args>
+        struct Binding
+        {
+            static R (*function)(Args...);
+
+            static void invoke(Context &context)
+            {
+                Invoker<R>::invoke(context, function, typename MakeIndices<sizeof...(Args)>::type());
+            }
+        };
+
+        template <uint16_t functionNr, int operation, typename R, typename... Args>
+        R (*Binding<functionNr, operation, R, Args...>::function)(Args...) = NULL;
+
+        // the same for functions taking the machine running the thread as first parameter,
+        // which is not passed on the stack
+        template <uint16_t functionNr, int operation, typename R, typename... Args>
+        struct MachineBinding
+        {
+            static R (*function)(Machine &, Args...);
+
+            static void invoke(Context &context)
+            {
+                Invoker<R>::invoke(context, function, typename MakeIndices<sizeof...(Args)>::type());
+            }
+        };
+
+        template <uint16_t functionNr, int operation, typename R, typename... Args>
+        R (*MachineBinding<functionNr, operation, R, Args...>::function)(Machine &, Args...) = NULL;
+
+        // pops the operation and invokes its handler
+        template <uint16_t functionNr>
+        void dispatchOperation(Context &context)
+        {
+            auto op = pop<uint8_t>(context);
+            auto handler = machine::operation(functionNr, op);
+            if (handler == NULL)
+                invalidOperation(*context.machine, functionNr, op);
+            else
+                handler(context);
+        }
+    }
+
+    /// @brief Register a function with typed arguments. The arguments are popped from the stack
+    /// (the last argument is on the top of the stack) and the result, if any, is pushed.
+    template <uint16_t functionNr, typename R, typename... Args>
+    void registerFunction(R (*function)(Args...))
     {
-        pushUint32(reinterpret_cast<uint32_t>(handle));
+        binding::Binding<functionNr, binding::NO_OPERATION, R, Args...>::function = function;
+        registerFunction(functionNr, &binding::Binding<functionNr, binding::NO_OPERATION, R, Args...>::invoke,
+                         binding::StackSize<Args...>::value, binding::ResultSize<R>::value);
     }
 
-    void pushFloat(float value);
-    uint8_t *variable(uint16_t offset);
-    uint8_t *constantPool(uint16_t offset);
+    /// @brief Register a function with typed arguments which also gets the machine running the
+    /// calling thread, to reach its variables, resources and the state of the modules.
+    template <uint16_t functionNr, typename R, typename... Args>
+    void registerFunction(R (*function)(Machine &, Args...))
+    {
+        binding::MachineBinding<functionNr, binding::NO_OPERATION, R, Args...>::function = function;
+        registerFunction(functionNr, &binding::MachineBinding<functionNr, binding::NO_OPERATION, R, Args...>::invoke,
+                         binding::StackSize<Args...>::value, binding::ResultSize<R>::value);
+    }
 
-    void registerFunction(uint16_t functionNr, MachineFunction function);
+    /// @brief Register an operation of a function which selects the operation by its last
+    /// argument, a uint8. The function itself is registered as well. If the compiler pushes
+    /// the operation as a literal, the call is bound directly to the operation when loading the code.
+    template <uint16_t functionNr, uint8_t operation, typename R, typename... Args>
+    void registerOperation(R (*function)(Args...))
+    {
+        binding::Binding<functionNr, operation, R, Args...>::function = function;
+        registerOperation(functionNr, operation, &binding::Binding<functionNr, operation, R, Args...>::invoke);
+        registerFunction(functionNr, &binding::dispatchOperation<functionNr>,
+                         binding::StackSize<Args...>::value + 1, binding::ResultSize<R>::value);
+    }
 
-}
\ No newline at end of file
+    template <uint16_t functionNr, uint8_t operation, typename R, typename... Args>
+    void registerOperation(R (*function)(Machine &, Args...))
+    {
+        binding::MachineBinding<functionNr, operation, R, Args...>::function = function;
+        registerOperation(functionNr, operation, &binding::MachineBinding<functionNr, operation, R, Args...>::invoke);
+        registerFunction(functionNr, &binding::dispatchOperation<functionNr>,
+                         binding::StackSize<Args...>::value + 1, binding::ResultSize<R>::value);
+    }
+}
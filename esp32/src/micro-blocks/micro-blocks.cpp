@@ -3,8 +3,15 @@
 #include "main.h"
 #include "machine.h"
 #include "modules/modules.h"
-#include "resourcePool.h"
+#include "latency.h"
 #include "ArduinoNvs.h"
+#include "websocket.h"
+#include "systemStatus.h"
+#include <algorithm>
+#include <limits.h>
+#ifdef MACHINE_PROFILE
+#include <vector>
+#endif
 
 namespace microBlocks
 {
@@ -14,6 +21,71 @@ namespace microBlocks
     volatile bool codeChanged = true;
     time_t startTime = 0;
     bool rebootLockCleared = false;
+    // the statistics shown by /api/systemStatus are copied once per second
+    unsigned long statusLastUpdated = 0;
+
+    // the task running loop(), once it waited for the first time
+    TaskHandle_t task = NULL;
+
+    // The machine running the program of the client. A single one, as the other core
+    // runs the network and the client addresses a single program.
+    machine::Machine vm;
+
+#ifdef MACHINE_PROFILE
+    time_t profileLastSent = 0;
+
+    template <typename T>
+    void pushValue(std::vector<uint8_t> &data, const T &value)
+    {
+        const uint8_t *ptr = (const uint8_t *)&value;
+        data.insert(data.end(), ptr, ptr + sizeof(T));
+    }
+
+    template <typename T>
+    bool readValue(const std::vector<uint8_t> &data, size_t &position, T &value)
+    {
+        if (position + sizeof(T) > data.size())
+            return false;
+        memcpy(&value, data.data() + position, sizeof(T));
+        position += sizeof(T);
+        return true;
+    }
+
+    // Sent by the VM task, which owns the profile: thread count, the thread profiles, the
+    // number of called functions and for each called function its number followed by its
+    // profile, the number of sampled offsets and for each the offset and the sample count
+    void sendProfile()
+    {
+        std::vector<uint8_t> data;
+        auto &threadProfiles = vm.threadProfiles();
+        pushValue<uint16_t>(data, threadProfiles.size());
+        for (auto &profile : threadProfiles)
+            pushValue(data, profile);
+
+        size_t countPosition = data.size();
+        uint16_t count = 0;
+        pushValue(data, count);
+        for (uint16_t functionNr = 0; vm.functionProfile(functionNr) != NULL; functionNr++)
+        {
+            auto profile = vm.functionProfile(functionNr);
+            if (profile->calls == 0)
+                continue;
+            pushValue(data, functionNr);
+            pushValue(data, *profile);
+            count++;
+        }
+        memcpy(data.data() + countPosition, &count, sizeof(count));
+
+        pushValue<uint16_t>(data, vm.samples().size());
+        for (auto &entry : vm.samples())
+        {
+            pushValue(data, entry.first);
+            pushValue(data, entry.second);
+        }
+
+        websocket::send(websocket::MessageType::PROFILE, data.size(), data.data());
+    }
+#endif
 
     void setup()
     {
@@ -64,17 +136,123 @@ namespace microBlocks
                     main::dataFS.rename("/code-tmp.mkb", "/code.mkb");
                     request->send(200);
                     codeChanged = true;
+                    wake();
+                }
+            });
+
+#ifdef MACHINE_PROFILE
+        // The profile belongs to the VM task, this handler runs on the network core. It
+        // answers with the snapshot the VM task sent last, thus at most a second old.
+        webServer::server.on(
+            "/api/profile", HTTP_GET,
+            [](AsyncWebServerRequest *request)
+            {
+                std::vector<uint8_t> data;
+                if (!websocket::lastMessage(websocket::MessageType::PROFILE, data))
+                {
+                    request->send(503, "text/plain", "No profile yet");
+                    return;
+                }
+
+                AsyncJsonResponse *response = new AsyncJsonResponse();
+                JsonVariant &root = response->getRoot();
+                size_t position = 0;
+                uint16_t count = 0;
+
+                JsonArray threads = root.createNestedArray("threads");
+                machine::ThreadProfile threadProfile;
+                readValue(data, position, count);
+                for (uint16_t i = 0; i < count && readValue(data, position, threadProfile); i++)
+                {
+                    JsonObject thread = threads.createNestedObject();
+                    thread["runs"] = threadProfile.runs;
+                    thread["cycles"] = threadProfile.cycles;
+                    thread["timeSliceOverruns"] = threadProfile.timeSliceOverruns;
+                }
+
+                JsonArray functions = root.createNestedArray("functions");
+                uint16_t functionNr;
+                machine::FunctionProfile functionProfile;
+                count = 0;
+                readValue(data, position, count);
+                for (uint16_t i = 0; i < count && readValue(data, position, functionNr) && readValue(data, position, functionProfile); i++)
+                {
+                    JsonObject function = functions.createNestedObject();
+                    function["function"] = functionNr;
+                    function["calls"] = functionProfile.calls;
+                    function["cycles"] = functionProfile.cycles;
                 }
+
+                JsonArray samples = root.createNestedArray("samples");
+                uint16_t offset;
+                uint32_t sampleCount;
+                count = 0;
+                readValue(data, position, count);
+                for (uint16_t i = 0; i < count && readValue(data, position, offset) && readValue(data, position, sampleCount); i++)
+                {
+                    JsonObject sample = samples.createNestedObject();
+                    sample["offset"] = offset;
+                    sample["count"] = sampleCount;
+                }
+                response->setLength();
+                request->send(response);
             });
+#endif
 
         machine::setup();
-        modules::setup();
+        modules::setup(vm);
 
         codeChanged = NVS.getInt("rebootLock") == 0;
         NVS.setInt("rebootLock", 1, true);
         startTime = millis();
     }
 
+    void wake()
+    {
+        if (task != NULL)
+            xTaskNotifyGive(task);
+    }
+
+    void IRAM_ATTR wakeFromIsr()
+    {
+        if (task == NULL)
+            return;
+        BaseType_t higherPriorityTaskWoken = pdFALSE;
+        vTaskNotifyGiveFromISR(task, &higherPriorityTaskWoken);
+        if (higherPriorityTaskWoken)
+            portYIELD_FROM_ISR();
+    }
+
+    // time in microseconds until the task has to do something at the latest
+    unsigned long remainingTime(unsigned long lastTime, unsigned long interval)
+    {
+        unsigned long elapsed = millis() - lastTime;
+        return elapsed > interval ? 0 : (interval - elapsed + 1) * 1000;
+    }
+
+    void waitForEvent()
+    {
+        task = xTaskGetCurrentTaskHandle();
+
+        unsigned long idle = modules::idleTime(vm);
+        if (!rebootLockCleared)
+            idle = std::min(idle, remainingTime(startTime, 1000));
+        idle = std::min(idle, remainingTime(statusLastUpdated, 1000));
+#ifdef MACHINE_PROFILE
+        idle = std::min(idle, remainingTime(profileLastSent, 1000));
+#endif
+
+        if (idle == 0)
+            return;
+        if (idle < portTICK_PERIOD_MS * 1000)
+        {
+            // shorter than a tick, thus shorter than any wait for a notification
+            delayMicroseconds(idle);
+            return;
+        }
+        ulTaskNotifyTake(pdTRUE, idle == ULONG_MAX ? portMAX_DELAY : idle / 1000 / portTICK_PERIOD_MS);
+    }
+
     void loop()
     {
         if (!rebootLockCleared && millis() - startTime > 1000)
@@ -99,12 +277,28 @@ namespace microBlocks
             file.read(buf, size);
             file.close();
 
-            modules::reset();
-            resourcePool::clearResources();
+            modules::reset(vm);
+            vm.resources.clear();
+            latency::clear(vm);
 
-            machine::applyCode(buf, size);
+            vm.applyCode(buf, size);
         }
-        modules::loop();
+        websocket::dispatchReceived();
+        modules::loop(vm);
         machine::loop();
+
+        if (millis() - statusLastUpdated > 1000)
+        {
+            statusLastUpdated = millis();
+            systemStatus::update(vm);
+        }
+
+#ifdef MACHINE_PROFILE
+        if (millis() - profileLastSent > 1000)
+        {
+            profileLastSent = millis();
+            sendProfile();
+        }
+#endif
     }
 }
\ No newline at end of file
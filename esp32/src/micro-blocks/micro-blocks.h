@@ -1,8 +1,19 @@
 #pragma once
+#include <Arduino.h>
 
 namespace microBlocks
 {
 
     void setup();
     void loop();
+
+    // Block the calling task until loop() has to run again, either as a module reached its
+    // next deadline or as wake() was called
+    void waitForEvent();
+
+    // wake up the task waiting in waitForEvent(), from any task
+    void wake();
+
+    // wake up the task waiting in waitForEvent(), from an interrupt service routine
+    void IRAM_ATTR wakeFromIsr();
 }
\ No newline at end of file
@@ -1,131 +1,586 @@
 #include "basic.h"
 #include "../machine.h"
 #include <Arduino.h>
-#include <deque>
+#include <esp_timer.h>
+#include <algorithm>
 #include <vector>
-#include <set>
 #include <stdint.h>
+#include <limits.h>
 #include "../../websocket.h"
+#include "../latency.h"
+#include "../threadSet.h"
+#include "../ringQueue.h"
+#include "modules.h"
 
 namespace basicModule
 {
-    std::deque<uint16_t> yieldedThreads;
-
-    std::set<uint16_t> readyCallbacks;
-    std::set<uint16_t> triggeredCallbacks;
+    // Thread triggered at a fixed period. The deadlines are absolute, thus the period
+    // does not drift by the time it takes to run the thread.
+    typedef struct
+    {
+        uint16_t threadNr;
+        int64_t period;
+        // esp_timer_get_time() when the next period starts
+        int64_t deadline;
+    } PeriodicEntry;
 
-    void triggerCallback(uint16_t threadNr)
+    typedef struct
     {
-        triggeredCallbacks.insert(threadNr);
-    }
+        uint16_t threadNr;
+        // the latency is not recorded for yielded threads
+        bool recordLatency;
+        latency::Source source;
+        // micros() when the thread became runnable
+        unsigned long since;
+    } RunnableEntry;
 
     typedef struct
     {
-        unsigned long startTime;
-        unsigned long delay;
+        // esp_timer_get_time() when the delay expires
+        int64_t deadline;
         uint16_t threadNr;
     } DelayEntry;
 
-    std::vector<DelayEntry> delayEntries;
+    const uint8_t PRIORITY_UNSET = 0xff;
+
+    // the scheduler of a machine
+    struct State
+    {
+        // each thread is queued at most once until the next loop, thus the queue never grows
+        // beyond the number of threads
+        RingQueue<uint16_t> yieldedThreads;
+
+        // threads waiting for a callback and threads with pending callback events
+        ThreadSet readyCallbacks;
+        ThreadSet triggeredCallbacks;
+
+        // indexed by thread number, the time (micros()) the thread became ready and its pending
+        // callback events, the payload being the source of the event. The time of periodic
+        // events is their deadline.
+        std::vector<unsigned long> readyTimes;
+        std::vector<EventQueue<latency::Source>> callbackEvents;
+
+        // indexed by thread number, the argument passed to spawned threads by basicRunInBackground
+        std::vector<float> backgroundArguments;
+
+        // indexed by thread number, set by basicSetEventQueue
+        std::vector<EventQueueConfig> eventQueueConfigs;
+
+        // indexed by thread number, the time (micros()) of the event the thread was last resumed for
+        std::vector<unsigned long> eventTimes;
+
+        uint32_t droppedEventCounts[(int)latency::Source::COUNT];
+
+        std::vector<PeriodicEntry> periodicEntries;
+        PeriodicStatistics statistics;
+
+        DispatchStatistics dispatch;
+
+        // micros() when the current loop started and whether it used up the budget
+        unsigned long loopStart;
+        bool budgetExhausted;
+
+        // indexed by thread number, PRIORITY_UNSET if the priority was neither set nor inferred
+        std::vector<uint8_t> priorities;
+
+        // runnable threads of each priority, in the order they became runnable
+        RingQueue<RunnableEntry> runQueues[(int)Priority::COUNT];
+
+        // min-heap on the deadline, the delay expiring next is at the front
+        std::vector<DelayEntry> delayEntries;
+    };
+
+    State &stateOf(machine::Machine &machine)
+    {
+        return machine.state<State>();
+    }
+
+    template <typename T>
+    void store(std::vector<T> &values, uint16_t threadNr, const T &value)
+    {
+        if (threadNr >= values.size())
+            values.resize(threadNr + 1);
+        values[threadNr] = value;
+    }
+
+    const EventQueueConfig &eventQueueConfig(machine::Machine &machine, uint16_t threadNr)
+    {
+        auto &eventQueueConfigs = stateOf(machine).eventQueueConfigs;
+        if (threadNr >= eventQueueConfigs.size())
+            return DEFAULT_EVENT_QUEUE_CONFIG;
+        return eventQueueConfigs[threadNr];
+    }
+
+    void setEventTime(machine::Machine &machine, uint16_t threadNr, unsigned long time)
+    {
+        store(stateOf(machine).eventTimes, threadNr, time);
+    }
+
+    void countDroppedEvent(machine::Machine &machine, latency::Source source)
+    {
+        stateOf(machine).droppedEventCounts[(int)source]++;
+    }
+
+    uint32_t droppedEvents(machine::Machine &machine, latency::Source source)
+    {
+        return stateOf(machine).droppedEventCounts[(int)source];
+    }
+
+    EventQueue<latency::Source> &callbackQueue(State &state, uint16_t threadNr)
+    {
+        if (threadNr >= state.callbackEvents.size())
+            state.callbackEvents.resize(threadNr + 1);
+        return state.callbackEvents[threadNr];
+    }
+
+    void triggerCallback(machine::Machine &machine, uint16_t threadNr, unsigned long time, latency::Source source)
+    {
+        // the thread number might be sent by a client still showing a previous program
+        if (threadNr >= machine.threadCount())
+            return;
+        auto &state = stateOf(machine);
+        if (!callbackQueue(state, threadNr).push(source, time))
+            countDroppedEvent(machine, source);
+        state.triggeredCallbacks.insert(threadNr);
+    }
+
+    void triggerCallback(machine::Machine &machine, uint16_t threadNr)
+    {
+        triggerCallback(machine, threadNr, micros(), latency::Source::CALLBACK);
+    }
+
+    const PeriodicStatistics &periodicStatistics(machine::Machine &machine)
+    {
+        return stateOf(machine).statistics;
+    }
+
+    void triggerPeriodicThreads(machine::Machine &machine)
+    {
+        auto &state = stateOf(machine);
+        auto &statistics = state.statistics;
+        auto now = esp_timer_get_time();
+        for (auto &entry : state.periodicEntries)
+        {
+            if (entry.deadline > now)
+                continue;
+
+            if (state.triggeredCallbacks.contains(entry.threadNr))
+            {
+                // the previous period did not even start yet
+                statistics.missedPeriods++;
+            }
+            else
+            {
+                if (!state.readyCallbacks.contains(entry.threadNr))
+                {
+                    // the thread is still running the previous period
+                    statistics.overruns++;
+                }
+                triggerCallback(machine, entry.threadNr, entry.deadline, latency::Source::PERIODIC);
+            }
+
+            entry.deadline += entry.period;
+            if (entry.deadline <= now)
+            {
+                // skip the periods which passed already instead of running them in a burst
+                auto missed = (now - entry.deadline) / entry.period + 1;
+                statistics.missedPeriods += missed;
+                entry.deadline += missed * entry.period;
+            }
+        }
+    }
+
+    unsigned long dispatchBudget = 10000;
+
+    const DispatchStatistics &dispatchStatistics(machine::Machine &machine)
+    {
+        return stateOf(machine).dispatch;
+    }
+
+    bool withinBudget(State &state)
+    {
+        if (micros() - state.loopStart >= dispatchBudget)
+            state.budgetExhausted = true;
+        return !state.budgetExhausted;
+    }
+
+    unsigned long priorityTimeSlices[(int)Priority::COUNT] = {10, 50, 50};
+    unsigned long starvationTime = 100000;
 
-    void yieldCurrentThread()
+    Priority priority(const State &state, uint16_t threadNr)
     {
-        yieldedThreads.push_back(machine::currentThreadNr);
-        machine::suspendCurrentThread();
+        auto &priorities = state.priorities;
+        if (threadNr >= priorities.size() || priorities[threadNr] == PRIORITY_UNSET)
+            return Priority::NORMAL;
+        return (Priority)priorities[threadNr];
+    }
+
+    void setPriority(machine::Machine &machine, uint16_t threadNr, Priority priority)
+    {
+        auto &priorities = stateOf(machine).priorities;
+        if (threadNr >= priorities.size())
+            priorities.resize(threadNr + 1, PRIORITY_UNSET);
+        priorities[threadNr] = (uint8_t)priority;
+        machine.setTimeSlice(threadNr, priorityTimeSlices[(int)priority]);
+    }
+
+    void resetThread(machine::Machine &machine, uint16_t threadNr)
+    {
+        auto &state = stateOf(machine);
+        auto &priorities = state.priorities;
+        auto &eventQueueConfigs = state.eventQueueConfigs;
+        auto &eventTimes = state.eventTimes;
+        auto &readyTimes = state.readyTimes;
+        auto &callbackEvents = state.callbackEvents;
+        auto &backgroundArguments = state.backgroundArguments;
+        auto &periodicEntries = state.periodicEntries;
+        if (threadNr < priorities.size())
+            priorities[threadNr] = PRIORITY_UNSET;
+        if (threadNr < eventQueueConfigs.size())
+            eventQueueConfigs[threadNr] = DEFAULT_EVENT_QUEUE_CONFIG;
+        if (threadNr < eventTimes.size())
+            eventTimes[threadNr] = 0;
+        if (threadNr < readyTimes.size())
+            readyTimes[threadNr] = 0;
+        if (threadNr < callbackEvents.size())
+            callbackEvents[threadNr] = EventQueue<latency::Source>();
+        if (threadNr < backgroundArguments.size())
+            backgroundArguments[threadNr] = 0;
+        state.readyCallbacks.erase(threadNr);
+        state.triggeredCallbacks.erase(threadNr);
+        periodicEntries.erase(std::remove_if(periodicEntries.begin(), periodicEntries.end(),
+                                             [threadNr](const PeriodicEntry &entry)
+                                             { return entry.threadNr == threadNr; }),
+                              periodicEntries.end());
+    }
+
+    void markEventHandler(machine::Machine &machine, uint16_t threadNr)
+    {
+        auto &priorities = stateOf(machine).priorities;
+        if (threadNr >= priorities.size() || priorities[threadNr] == PRIORITY_UNSET)
+            setPriority(machine, threadNr, Priority::INTERACTIVE);
+    }
+
+    void enqueue(State &state, uint16_t threadNr, bool recordLatency, latency::Source source, unsigned long since)
+    {
+        RunnableEntry entry;
+        entry.threadNr = threadNr;
+        entry.recordLatency = recordLatency;
+        entry.source = source;
+        entry.since = since;
+        state.runQueues[(int)priority(state, threadNr)].push_back(entry);
+    }
+
+    void makeRunnable(machine::Machine &machine, uint16_t threadNr, latency::Source source, unsigned long since)
+    {
+        enqueue(stateOf(machine), threadNr, true, source, since);
+    }
+
+    // Pick the next thread to run: the thread waiting longest among the ones waiting for
+    // longer than the starvation time, else the first thread of the highest priority.
+    bool nextRunnable(State &state, unsigned long now, RunnableEntry &result)
+    {
+        auto &runQueues = state.runQueues;
+        int selected = -1;
+        for (int level = 0; level < (int)Priority::COUNT; level++)
+        {
+            auto &queue = runQueues[level];
+            if (queue.empty())
+                continue;
+            if (now - queue.front().since > starvationTime && (selected < 0 || now - queue.front().since > now - runQueues[selected].front().since))
+                selected = level;
+        }
+        for (int level = (int)Priority::COUNT - 1; selected < 0 && level >= 0; level--)
+        {
+            if (!runQueues[level].empty())
+                selected = level;
+        }
+        if (selected < 0)
+            return false;
+
+        result = runQueues[selected].front();
+        runQueues[selected].pop_front();
+        return true;
+    }
+
+    bool hasRunnable(const State &state)
+    {
+        for (auto &queue : state.runQueues)
+        {
+            if (!queue.empty())
+                return true;
+        }
+        return false;
+    }
+
+    void resume(machine::Machine &machine, const RunnableEntry &entry)
+    {
+        if (entry.recordLatency)
+            latency::record(machine, entry.source, micros() - entry.since);
+        stateOf(machine).dispatch.resumptions++;
+        machine.runThread(entry.threadNr);
+    }
+
+    bool expiresLater(const DelayEntry &a, const DelayEntry &b)
+    {
+        return a.deadline > b.deadline;
+    }
+
+    void yieldCurrentThread(machine::Machine &machine)
+    {
+        auto &yieldedThreads = stateOf(machine).yieldedThreads;
+        yieldedThreads.reserve(machine.threadCount());
+        yieldedThreads.push_back(machine.currentThreadNr);
+        machine.suspendCurrentThread();
     }
 
     void setup()
     {
         // yield function
-        machine::registerFunction(0, yieldCurrentThread);
+        machine::registerFunction<0>(yieldCurrentThread);
 
         // end thread
-        machine::registerFunction(
-            11,
-            []()
+        machine::registerFunction<11>(
+            +[](machine::Machine &machine)
             {
-                machine::suspendCurrentThread();
+                machine.endCurrentThread();
             });
 
         // basicCallbackReady
-        machine::registerFunction(
-            31,
-            []()
+        machine::registerFunction<31>(
+            +[](machine::Machine &machine)
             {
-                readyCallbacks.insert(machine::currentThreadNr);
-                machine::suspendCurrentThread();
+                auto &state = stateOf(machine);
+                auto threadNr = machine.currentThreadNr;
+                store(state.readyTimes, threadNr, micros());
+                callbackQueue(state, threadNr).configure(eventQueueConfig(machine, threadNr));
+                state.readyCallbacks.insert(threadNr);
+                markEventHandler(machine, threadNr);
+                machine.suspendCurrentThread();
             });
 
         // basicDelay
-        machine::registerFunction(
-            9,
-            []()
+        machine::registerFunction<9>(
+            +[](machine::Machine &machine, float delay)
             {
+                auto &delayEntries = stateOf(machine).delayEntries;
                 DelayEntry entry;
-                entry.threadNr = machine::currentThreadNr;
-                entry.delay = machine::popFloat();
-                entry.startTime = millis();
+                entry.threadNr = machine.currentThreadNr;
+                entry.deadline = esp_timer_get_time() + (delay > 0 ? (int64_t)(delay * 1000) : 0);
 
                 delayEntries.push_back(entry);
+                std::push_heap(delayEntries.begin(), delayEntries.end(), expiresLater);
 
-                machine::suspendCurrentThread();
+                machine.suspendCurrentThread();
             });
 
         // pop32
-        machine::registerFunction(
-            12,
-            []()
+        machine::registerFunction<12>(+[](uint32_t) {});
+
+        // basicSetPriority
+        machine::registerFunction<53>(
+            +[](machine::Machine &machine, uint8_t priority)
+            {
+                if (priority < (uint8_t)Priority::COUNT)
+                    setPriority(machine, machine.currentThreadNr, (Priority)priority);
+            });
+
+        // basicSetEventQueue
+        machine::registerFunction<54>(
+            +[](machine::Machine &machine, uint8_t policy, uint8_t depth)
+            {
+                if (policy < (uint8_t)EventPolicy::COUNT)
+                {
+                    EventQueueConfig config;
+                    config.policy = (EventPolicy)policy;
+                    config.depth = depth;
+                    store(stateOf(machine).eventQueueConfigs, machine.currentThreadNr, config);
+                }
+            });
+
+        // basicEventAge
+        machine::registerFunction<55>(
+            +[](machine::Machine &machine) -> float
+            {
+                auto &eventTimes = stateOf(machine).eventTimes;
+                auto threadNr = machine.currentThreadNr;
+                if (threadNr >= eventTimes.size())
+                    return 0;
+                return (micros() - eventTimes[threadNr]) / 1000.f;
+            });
+
+        // basicBackgroundThread, called first by template threads. The thread of the program
+        // itself stops here, the threads spawned from it continue.
+        machine::registerFunction<57>(
+            +[](machine::Machine &machine)
+            {
+                if (!machine.isSpawned(machine.currentThreadNr))
+                    machine.suspendCurrentThread();
+            });
+
+        // basicRunInBackground
+        machine::registerFunction<58>(
+            +[](machine::Machine &machine, uint16_t templateThreadNr, float argument)
+            {
+                auto threadNr = machine.spawnThread(templateThreadNr);
+                if (threadNr == machine::NO_THREAD)
+                {
+                    Serial.println(String("Thread ") + machine.currentThreadNr + ": no free slot to run thread " + templateThreadNr + " in background");
+                    return;
+                }
+                // the previous thread in the slot might have set its priority, subscribed to
+                // events or run periodically
+                modules::resetThread(machine, threadNr);
+                auto &state = stateOf(machine);
+                auto &priorities = state.priorities;
+                store(state.backgroundArguments, threadNr, argument);
+                // the new thread runs with the priority of the spawning one, like its time slice
+                auto spawner = machine.currentThreadNr;
+                if (spawner < priorities.size() && priorities[spawner] != PRIORITY_UNSET)
+                {
+                    if (threadNr >= priorities.size())
+                        priorities.resize(threadNr + 1, PRIORITY_UNSET);
+                    priorities[threadNr] = priorities[spawner];
+                }
+                enqueue(state, threadNr, false, latency::Source::COUNT, micros());
+            });
+
+        // basicBackgroundArgument
+        machine::registerFunction<59>(
+            +[](machine::Machine &machine) -> float
+            {
+                auto &backgroundArguments = stateOf(machine).backgroundArguments;
+                auto threadNr = machine.currentThreadNr;
+                return threadNr < backgroundArguments.size() ? backgroundArguments[threadNr] : 0;
+            });
+
+        // basicSetupPeriodic
+        machine::registerFunction<52>(
+            +[](machine::Machine &machine, float period)
             {
-                machine::popUint32();
+                PeriodicEntry entry;
+                entry.threadNr = machine.currentThreadNr;
+                // at least a millisecond, shorter periods would keep the scheduler busy
+                entry.period = period < 1 ? 1000 : (int64_t)(period * 1000);
+                entry.deadline = esp_timer_get_time() + entry.period;
+                stateOf(machine).periodicEntries.push_back(entry);
             });
+    }
 
+    void receiveMessages(machine::Machine &machine)
+    {
         websocket::handle<uint16_t>(
             websocket::MessageType::BASIC_TRIGGER_CALLBACK,
-            [](uint16_t &message)
+            [&machine](uint16_t &message)
             {
-                triggeredCallbacks.insert(message);
+                triggerCallback(machine, message);
             });
     }
 
-    void reset()
+    void reset(machine::Machine &machine)
     {
-        yieldedThreads.clear();
-        delayEntries.clear();
+        auto &state = stateOf(machine);
+        state.yieldedThreads.clear();
+        state.delayEntries.clear();
+        state.readyCallbacks.clear();
+        state.triggeredCallbacks.clear();
+        state.periodicEntries.clear();
+        state.priorities.clear();
+        state.callbackEvents.clear();
+        state.eventQueueConfigs.clear();
+        state.eventTimes.clear();
+        state.backgroundArguments.clear();
+        for (auto &count : state.droppedEventCounts)
+            count = 0;
+        for (auto &queue : state.runQueues)
+            queue.clear();
+        state.statistics = PeriodicStatistics();
+        state.dispatch = DispatchStatistics();
     }
 
-    void loop()
+    unsigned long idleTime(machine::Machine &machine)
     {
-        for (auto entry = delayEntries.begin(); entry != delayEntries.end();)
+        auto &state = stateOf(machine);
+        if (state.budgetExhausted || !state.yieldedThreads.empty() || hasRunnable(state) || ThreadSet::firstCommon(state.triggeredCallbacks, state.readyCallbacks) != ThreadSet::NONE)
+            return 0;
+
+        int64_t next = INT64_MAX;
+        if (!state.delayEntries.empty())
+            next = state.delayEntries.front().deadline;
+        for (auto &entry : state.periodicEntries)
+            next = std::min(next, entry.deadline);
+        if (next == INT64_MAX)
+            return ULONG_MAX;
+
+        auto now = esp_timer_get_time();
+        if (next <= now)
+            return 0;
+        // next is in the future, compared unsigned as ULONG_MAX does not fit into int64_t
+        // where unsigned long has 64 bits
+        return (unsigned long)std::min<uint64_t>(next - now, ULONG_MAX);
+    }
+
+    void loop(machine::Machine &machine)
+    {
+        auto &state = stateOf(machine);
+        auto &delayEntries = state.delayEntries;
+        auto &dispatch = state.dispatch;
+        state.loopStart = micros();
+        state.budgetExhausted = false;
+
+        // Queue all runnable threads first, then run them by priority. Running a thread
+        // might make further threads runnable, they are queued by the next loop.
+        auto now = esp_timer_get_time();
+        while (!delayEntries.empty() && delayEntries.front().deadline <= now)
         {
-            if (millis() - entry->startTime >= entry->delay)
-            {
-                auto threadNr = entry->threadNr;
-                delayEntries.erase(entry);
-                machine::runThread(threadNr);
-                break; // break here, as running the thread might modify the delayEntries vector
-            }
-            else
-            {
-                entry++;
-            }
+            std::pop_heap(delayEntries.begin(), delayEntries.end(), expiresLater);
+            auto &entry = delayEntries.back();
+            makeRunnable(machine, entry.threadNr, latency::Source::DELAY, (unsigned long)entry.deadline);
+            delayEntries.pop_back();
         }
 
-        for (auto cb : triggeredCallbacks)
+        triggerPeriodicThreads(machine);
+
+        // the thread became runnable when both an event was pending and the thread was ready
+        for (uint16_t threadNr = ThreadSet::firstCommon(state.triggeredCallbacks, state.readyCallbacks);
+             threadNr != ThreadSet::NONE;
+             threadNr = ThreadSet::firstCommon(state.triggeredCallbacks, state.readyCallbacks, threadNr + 1))
         {
-            if (readyCallbacks.find(cb) != readyCallbacks.end())
+            auto &queue = state.callbackEvents[threadNr];
+            EventQueue<latency::Source>::Event event;
+            if (!queue.pop(event))
             {
-                triggeredCallbacks.erase(cb);
-                readyCallbacks.erase(cb);
-                machine::runThread(cb);
-                break;
+                // triggered threads always have an event queued
+                state.triggeredCallbacks.erase(threadNr);
+                continue;
             }
+            if (queue.empty())
+                state.triggeredCallbacks.erase(threadNr);
+            state.readyCallbacks.erase(threadNr);
+
+            setEventTime(machine, threadNr, event.time);
+            auto time = micros();
+            makeRunnable(machine, threadNr, event.value, time - std::min(time - event.time, time - state.readyTimes[threadNr]));
         }
 
-        if (!yieldedThreads.empty())
+        // Threads yielded before this loop are queued behind the other threads of their
+        // priority, threads yielding while this loop runs are queued by the next loop.
+        auto yieldTime = micros();
+        while (!state.yieldedThreads.empty())
         {
-            uint16_t threadNr = yieldedThreads.front();
-            yieldedThreads.pop_front();
-            machine::runThread(threadNr);
+            enqueue(state, state.yieldedThreads.front(), false, latency::Source::COUNT, yieldTime);
+            state.yieldedThreads.pop_front();
         }
+
+        RunnableEntry entry;
+        while (withinBudget(state) && nextRunnable(state, micros(), entry))
+            resume(machine, entry);
+
+        dispatch.loops++;
+        if (state.budgetExhausted)
+            dispatch.budgetExhausted++;
+        unsigned long loopTime = micros() - state.loopStart;
+        if (loopTime > dispatch.maxLoopTime)
+            dispatch.maxLoopTime = loopTime;
     }
 }
\ No newline at end of file
@@ -1,12 +1,88 @@
 #pragma once
 #include <stdint.h>
+#include "../latency.h"
+#include "../eventQueue.h"
+#include "../machine.h"
 
+// The scheduler keeps its state per machine, the settings below apply to all machines.
 namespace basicModule
 {
     void setup();
-    void loop();
-    void reset();
-    void yieldCurrentThread();
+    void loop(machine::Machine &machine);
+    void reset(machine::Machine &machine);
 
-    void triggerCallback(uint16_t threadNr);
+    // pass the callbacks triggered by the client to the given machine
+    void receiveMessages(machine::Machine &machine);
+
+    // time in microseconds until loop() has to run again, ULONG_MAX if it only has to run after an event
+    unsigned long idleTime(machine::Machine &machine);
+    void yieldCurrentThread(machine::Machine &machine);
+
+    void triggerCallback(machine::Machine &machine, uint16_t threadNr);
+
+    // Runnable threads of higher priority always run first. Threads of lower priority which
+    // waited for longer than starvationTime run nevertheless, so they still make progress.
+    enum class Priority : uint8_t
+    {
+        BACKGROUND,
+        NORMAL,
+        INTERACTIVE,
+        COUNT
+    };
+
+    // time slice in milliseconds of the threads of each priority
+    extern unsigned long priorityTimeSlices[(int)Priority::COUNT];
+
+    // time in microseconds after which a runnable thread runs regardless of its priority
+    extern unsigned long starvationTime;
+
+    void setPriority(machine::Machine &machine, uint16_t threadNr, Priority priority);
+
+    // Forget all state of a thread, before its number is taken by a new spawned thread.
+    void resetThread(machine::Machine &machine, uint16_t threadNr);
+
+    // Threads waiting for events run with interactive priority, unless their priority
+    // was set explicitly. Called by the functions waiting for an event.
+    void markEventHandler(machine::Machine &machine, uint16_t threadNr);
+
+    // Queue a thread to be run by loop() according to its priority. The thread became
+    // runnable at since (micros()), which is recorded as latency of the given source.
+    void makeRunnable(machine::Machine &machine, uint16_t threadNr, latency::Source source, unsigned long since);
+
+    // Policy and depth of the event queues of the subscriptions of a thread, set by the program
+    // using basicSetEventQueue. The modules apply it when the thread waits for its next event.
+    const EventQueueConfig &eventQueueConfig(machine::Machine &machine, uint16_t threadNr);
+
+    // Remember the time (micros()) of the event a thread is resumed for, read by basicEventAge.
+    void setEventTime(machine::Machine &machine, uint16_t threadNr, unsigned long time);
+
+    // events dropped or coalesced as the handler thread did not take them in time, by source
+    void countDroppedEvent(machine::Machine &machine, latency::Source source);
+    uint32_t droppedEvents(machine::Machine &machine, latency::Source source);
+
+    typedef struct
+    {
+        // periods starting while the thread was still running the previous period
+        uint32_t overruns;
+        // periods not run at all, as the thread or the scheduler fell behind by more than a period
+        uint32_t missedPeriods;
+    } PeriodicStatistics;
+
+    const PeriodicStatistics &periodicStatistics(machine::Machine &machine);
+
+    // Time in microseconds a single loop may spend resuming threads. Threads which are still
+    // runnable once it is used up are resumed by the next loop.
+    extern unsigned long dispatchBudget;
+
+    typedef struct
+    {
+        uint32_t loops;
+        uint32_t resumptions;
+        // loops which used up the budget before all runnable threads were resumed
+        uint32_t budgetExhausted;
+        // longest time a single loop spent resuming threads, in microseconds
+        uint32_t maxLoopTime;
+    } DispatchStatistics;
+
+    const DispatchStatistics &dispatchStatistics(machine::Machine &machine);
 }
\ No newline at end of file
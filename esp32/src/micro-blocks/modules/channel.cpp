@@ -0,0 +1,237 @@
+#include "channel.h"
+#include "basic.h"
+#include "../machine.h"
+#include "../resourcePool.h"
+#include "../latency.h"
+#include "../ringQueue.h"
+#include <Arduino.h>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+namespace channelModule
+{
+    // the values of each channel are allocated when it is set up
+    const uint16_t MAX_CAPACITY = 1024;
+
+    // Bounded ring buffer of 4 byte values (floats or resource handles) passed between threads.
+    // Receiving takes two calls: channelWaitValue suspends the thread until a value is
+    // available and reserves it, channelReceive takes it. Sending works the same way with free
+    // slots. Woken threads thus always find their value or slot, even if other threads run first.
+    class Channel
+    {
+    public:
+        Channel(machine::Machine &machine, uint16_t capacity, bool holdsHandles)
+            : values(capacity < 1 ? 1 : capacity), head(0), count(0), reservedValues(0), reservedSlots(0),
+              holdsHandles(holdsHandles), receivers(machine.threadCount()), senders(machine.threadCount()), machine(machine)
+        {
+        }
+
+        std::vector<uint32_t> values;
+        size_t head;
+        size_t count;
+        // values promised to woken receivers and free slots promised to woken senders
+        size_t reservedValues;
+        size_t reservedSlots;
+        // whether the values are resource handles, which the channel holds a reference of
+        bool holdsHandles;
+        // threads waiting for a value and for a free slot, each thread waits at most once
+        RingQueue<uint16_t> receivers;
+        RingQueue<uint16_t> senders;
+        // the machine running the threads
+        machine::Machine &machine;
+
+        size_t availableValues() const
+        {
+            return count - reservedValues;
+        }
+
+        size_t availableSlots() const
+        {
+            return values.size() - count - reservedSlots;
+        }
+
+        // wake the first waiting receiver if there is a value for it
+        void wakeReceiver()
+        {
+            if (!receivers.empty() && availableValues() > 0)
+            {
+                reservedValues++;
+                auto threadNr = receivers.front();
+                receivers.pop_front();
+                basicModule::makeRunnable(machine, threadNr, latency::Source::CHANNEL, micros());
+            }
+        }
+
+        // wake the first waiting sender if there is a free slot for it
+        void wakeSender()
+        {
+            if (!senders.empty() && availableSlots() > 0)
+            {
+                reservedSlots++;
+                auto threadNr = senders.front();
+                senders.pop_front();
+                basicModule::makeRunnable(machine, threadNr, latency::Source::CHANNEL, micros());
+            }
+        }
+    };
+
+    struct State
+    {
+        // by id assigned by the compiler, each holding a reference of its channel
+        std::unordered_map<uint16_t, resourcePool::ResourceHandle<Channel> *> channels;
+    };
+
+    std::unordered_map<uint16_t, resourcePool::ResourceHandle<Channel> *> &channelsOf(machine::Machine &machine)
+    {
+        return machine.state<State>().channels;
+    }
+
+    Channel *channel(machine::Machine &machine, uint16_t id)
+    {
+        auto &channels = channelsOf(machine);
+        auto entry = channels.find(id);
+        if (entry == channels.end())
+            return NULL;
+        return entry->second->value;
+    }
+
+    void send(machine::Machine &machine, uint16_t id, uint32_t value)
+    {
+        auto channel = channelModule::channel(machine, id);
+        if (channel == NULL)
+            return;
+        if (channel->reservedSlots > 0)
+            channel->reservedSlots--;
+        if (channel->count == channel->values.size())
+        {
+            // only possible if the slot was not reserved by channelWaitSlot
+            if (channel->holdsHandles)
+                reinterpret_cast<resourcePool::ResourceHandleBase *>(static_cast<uintptr_t>(value))->decRef();
+            return;
+        }
+        channel->values[(channel->head + channel->count) % channel->values.size()] = value;
+        channel->count++;
+        channel->wakeReceiver();
+    }
+
+    uint32_t receive(machine::Machine &machine, uint16_t id)
+    {
+        auto channel = channelModule::channel(machine, id);
+        if (channel == NULL || channel->count == 0)
+            return 0;
+        if (channel->reservedValues > 0)
+            channel->reservedValues--;
+        uint32_t value = channel->values[channel->head];
+        channel->head = (channel->head + 1) % channel->values.size();
+        channel->count--;
+        channel->wakeSender();
+        return value;
+    }
+
+    void setup()
+    {
+        // channelSetup
+        machine::registerFunction<60>(
+            +[](machine::Machine &machine, uint16_t id, float capacity, uint8_t holdsHandles)
+            {
+                auto &channels = channelsOf(machine);
+                if (channels.count(id) != 0)
+                    return;
+                // the capacity is computed by the program, converting NaN or values out of
+                // range to an integer is undefined
+                uint16_t slots;
+                if (!(capacity >= 1))
+                    slots = 1;
+                else if (capacity > MAX_CAPACITY)
+                {
+                    Serial.println(String("Thread ") + machine.currentThreadNr + ": capacity of channel " + id + " limited to " + MAX_CAPACITY);
+                    slots = MAX_CAPACITY;
+                }
+                else
+                    slots = static_cast<uint16_t>(std::floor(capacity));
+                channels[id] = resourcePool::resourceHandle(machine.resources, new Channel(machine, slots, holdsHandles != 0));
+            });
+
+        // channelWaitSlot
+        machine::registerFunction<61>(
+            +[](machine::Machine &machine, uint16_t id)
+            {
+                auto channel = channelModule::channel(machine, id);
+                if (channel == NULL)
+                    return;
+                if (channel->availableSlots() > 0)
+                    channel->reservedSlots++;
+                else
+                {
+                    channel->senders.push_back(machine.currentThreadNr);
+                    machine.suspendCurrentThread();
+                }
+            });
+
+        // channelSendNumber
+        machine::registerFunction<62>(
+            +[](machine::Machine &machine, uint16_t id, float value)
+            {
+                uint32_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+                send(machine, id, bits);
+            });
+
+        // channelWaitValue
+        machine::registerFunction<63>(
+            +[](machine::Machine &machine, uint16_t id)
+            {
+                auto channel = channelModule::channel(machine, id);
+                if (channel == NULL)
+                    return;
+                if (channel->availableValues() > 0)
+                    channel->reservedValues++;
+                else
+                {
+                    channel->receivers.push_back(machine.currentThreadNr);
+                    machine.suspendCurrentThread();
+                }
+            });
+
+        // channelReceiveNumber
+        machine::registerFunction<64>(
+            +[](machine::Machine &machine, uint16_t id) -> float
+            {
+                uint32_t bits = receive(machine, id);
+                float value;
+                memcpy(&value, &bits, sizeof(value));
+                return value;
+            });
+
+        // channelSendHandle, the reference on the stack is passed to the channel
+        machine::registerFunction<65>(
+            +[](machine::Machine &machine, uint16_t id, resourcePool::ResourceHandleBase *value)
+            {
+                send(machine, id, static_cast<uint32_t>(reinterpret_cast<uintptr_t>(value)));
+            });
+
+        // channelReceiveHandle, the reference of the channel is passed to the stack
+        machine::registerFunction<66>(
+            +[](machine::Machine &machine, uint16_t id)
+            {
+                return reinterpret_cast<resourcePool::ResourceHandleBase *>(static_cast<uintptr_t>(receive(machine, id)));
+            });
+    }
+
+    void reset(machine::Machine &machine)
+    {
+        auto &channels = channelsOf(machine);
+        for (auto &entry : channels)
+        {
+            auto channel = entry.second->value;
+            if (channel->holdsHandles)
+            {
+                for (size_t i = 0; i < channel->count; i++)
+                    reinterpret_cast<resourcePool::ResourceHandleBase *>(channel->values[(channel->head + i) % channel->values.size()])->decRef();
+            }
+            entry.second->decRef();
+        }
+        channels.clear();
+    }
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include "../machine.h"
+
+namespace channelModule
+{
+    void setup();
+    void reset(machine::Machine &machine);
+}
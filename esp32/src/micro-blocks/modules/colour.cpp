@@ -112,93 +112,59 @@ namespace colourModule
     void setup()
     {
         // colourGetChannel: 38,
-        machine::registerFunction(
-            38,
-            []()
+        machine::registerOperation<38, 0>(+[](Colour colour) -> float
+                                          { return colour.r; });
+        machine::registerOperation<38, 1>(+[](Colour colour) -> float
+                                          { return colour.g; });
+        machine::registerOperation<38, 2>(+[](Colour colour) -> float
+                                          { return colour.b; });
+        machine::registerOperation<38, 3>(
+            +[](Colour colour)
             {
-                auto channel = machine::popUint8();
-                auto b = machine::popFloat();
-                auto g = machine::popFloat();
-                auto r = machine::popFloat();
-                switch (channel)
-                {
-                case 0:
-                    machine::pushFloat(r);
-                    break;
-                case 1:
-                    machine::pushFloat(g);
-                    break;
-                case 2:
-                    machine::pushFloat(b);
-                    break;
-                case 3:
-                {
-                    float h, s, v;
-                    rgbToHsv(r, g, b, h, s, v);
-                    machine::pushFloat(h);
-                    break;
-                }
-                case 4:
-                {
-                    float h, s, v;
-                    rgbToHsv(r, g, b, h, s, v);
-                    machine::pushFloat(s);
-                    break;
-                }
-                case 5:
-                {
-                    float h, s, v;
-                    rgbToHsv(r, g, b, h, s, v);
-                    machine::pushFloat(v);
-                    break;
-                }
-                }
+                float h, s, v;
+                rgbToHsv(colour.r, colour.g, colour.b, h, s, v);
+                return h;
+            });
+        machine::registerOperation<38, 4>(
+            +[](Colour colour)
+            {
+                float h, s, v;
+                rgbToHsv(colour.r, colour.g, colour.b, h, s, v);
+                return s;
+            });
+        machine::registerOperation<38, 5>(
+            +[](Colour colour)
+            {
+                float h, s, v;
+                rgbToHsv(colour.r, colour.g, colour.b, h, s, v);
+                return v;
             });
 
         // colourSetVar
-        machine::registerFunction(
-            39,
-            []()
+        machine::registerFunction<39>(
+            +[](machine::Machine &machine, uint16_t offset, Colour colour)
             {
-                auto b = machine::popFloat();
-                auto g = machine::popFloat();
-                auto r = machine::popFloat();
-                auto offset = machine::popUint16();
-                *((float *)machine::variable(offset)) = r;
-                *((float *)machine::variable(offset + 4)) = g;
-                *((float *)machine::variable(offset + 8)) = b;
+                *((Colour *)machine.variable(offset)) = colour;
             });
 
         // colourBlend
-        machine::registerFunction(
-            40,
-            []()
+        machine::registerFunction<40>(
+            +[](Colour a, Colour b, float ratio)
             {
-                auto ratio = machine::popFloat();
-                auto b2 = machine::popFloat();
-                auto g2 = machine::popFloat();
-                auto r2 = machine::popFloat();
-                auto b = machine::popFloat();
-                auto g = machine::popFloat();
-                auto r = machine::popFloat();
-                machine::pushFloat(gamma(lerp(deGamma(r), deGamma(r2), ratio)));
-                machine::pushFloat(gamma(lerp(deGamma(g), deGamma(g2), ratio)));
-                machine::pushFloat(gamma(lerp(deGamma(b), deGamma(b2), ratio)));
+                Colour result;
+                result.r = gamma(lerp(deGamma(a.r), deGamma(b.r), ratio));
+                result.g = gamma(lerp(deGamma(a.g), deGamma(b.g), ratio));
+                result.b = gamma(lerp(deGamma(a.b), deGamma(b.b), ratio));
+                return result;
             });
 
         // colourFromHSV: 47,
-        machine::registerFunction(
-            47,
-            []()
+        machine::registerFunction<47>(
+            +[](float h, float s, float v)
             {
-                auto v = machine::popFloat();
-                auto s = machine::popFloat();
-                auto h = machine::popFloat();
-                float r, g, b;
-                hsvToRgb(h, s, v, r, g, b);
-                machine::pushFloat(r);
-                machine::pushFloat(g);
-                machine::pushFloat(b);
+                Colour result;
+                hsvToRgb(h, s, v, result.r, result.g, result.b);
+                return result;
             });
     }
 }
\ No newline at end of file
@@ -3,6 +3,14 @@
 
 namespace colourModule
 {
+    // a colour as represented on the stack, b is topmost
+    typedef struct
+    {
+        float r;
+        float g;
+        float b;
+    } Colour;
+
     void setup();
 
     inline float gamma(float input)
@@ -3,16 +3,22 @@
 
 namespace controlsModule
 {
+    typedef struct __attribute__((packed))
+    {
+        float times;
+        uint8_t done;
+    } RepeatState;
+
     void setup()
     {
-        machine::registerFunction(
-            10,
-            []()
+        // controlsRepeatExtDone
+        machine::registerFunction<10>(
+            +[](float times)
             {
-                float times = machine::popFloat();
-                times -= 1;
-                machine::pushFloat(times);
-                machine::pushUint8(times <= 0 ? 1 : 0);
+                RepeatState state;
+                state.times = times - 1;
+                state.done = state.times <= 0 ? 1 : 0;
+                return state;
             });
     }
 }
\ No newline at end of file
@@ -1,9 +1,12 @@
 #include "gui.h"
 #include "../machine.h"
+#include <Arduino.h>
 #include <vector>
 #include <memory>
 #include <stdint.h>
+#include <limits.h>
 #include "../../websocket.h"
+#include "colour.h"
 
 namespace guiModule
 {
@@ -120,15 +123,25 @@ namespace guiModule
         }
     };
 
-    std::vector<std::shared_ptr<GuiElement>> elements;
-    bool elementsModified;
-    time_t elementsLastSent;
+    // the elements shown by the program of a machine
+    struct State
+    {
+        std::vector<std::shared_ptr<GuiElement>> elements;
+        bool elementsModified = true;
+        time_t elementsLastSent = millis() - 1000;
+    };
+
+    State &stateOf(machine::Machine &machine)
+    {
+        return machine.state<State>();
+    }
 
-    void showElement(std::shared_ptr<GuiElement> newElement)
+    void showElement(machine::Machine &machine, std::shared_ptr<GuiElement> newElement)
     {
+        auto &state = stateOf(machine);
         std::vector<std::shared_ptr<GuiElement>> newElements;
 
-        for (auto &element : elements)
+        for (auto &element : state.elements)
         {
             if (!element->data().overlaps(newElement->data()))
             {
@@ -136,76 +149,73 @@ namespace guiModule
             }
         }
         newElements.push_back(newElement);
-        elements = newElements;
-        elementsModified = true;
+        state.elements = newElements;
+        state.elementsModified = true;
     }
 
     void setup()
     {
-        elementsLastSent = millis() - 1000;
-        elementsModified = true;
-
         // guiShowButton
-        machine::registerFunction(
-            30,
-            []()
+        machine::registerFunction<30>(
+            +[](machine::Machine &machine, uint8_t x, uint8_t y, uint8_t colSpan, uint8_t rowSpan,
+                uint16_t onClickThread, uint16_t onPressThread, uint16_t onReleaseThread,
+                resourcePool::ResourceHandle<String> *text)
             {
                 auto button = std::make_shared<ButtonElement>();
-                button->text = machine::popResourceHandle<String>();
-                button->data().onReleaseThread = machine::popUint16();
-                button->data().onPressThread = machine::popUint16();
-                button->data().onClickThread = machine::popUint16();
-                button->data().rowSpan = machine::popUint8();
-                button->data().colSpan = machine::popUint8();
-                button->data().y = machine::popUint8();
-                button->data().x = machine::popUint8();
-
-                showElement(button);
+                button->text = text;
+                button->data().onReleaseThread = onReleaseThread;
+                button->data().onPressThread = onPressThread;
+                button->data().onClickThread = onClickThread;
+                button->data().rowSpan = rowSpan;
+                button->data().colSpan = colSpan;
+                button->data().y = y;
+                button->data().x = x;
+
+                showElement(machine, button);
             });
 
         // guiShowText
-        machine::registerFunction(
-            33,
-            []()
+        machine::registerFunction<33>(
+            +[](machine::Machine &machine, uint8_t x, uint8_t y, uint8_t colSpan, uint8_t rowSpan, resourcePool::ResourceHandle<String> *str)
             {
                 auto text = std::make_shared<TextElement>();
-                text->text = machine::popResourceHandle<String>();
-                text->data().rowSpan = machine::popUint8();
-                text->data().colSpan = machine::popUint8();
-                text->data().y = machine::popUint8();
-                text->data().x = machine::popUint8();
+                text->text = str;
+                text->data().rowSpan = rowSpan;
+                text->data().colSpan = colSpan;
+                text->data().y = y;
+                text->data().x = x;
 
-                showElement(text);
+                showElement(machine, text);
             });
 
         // guiShowSignalLight
-        machine::registerFunction(
-            45,
-            []()
+        machine::registerFunction<45>(
+            +[](machine::Machine &machine, uint8_t x, uint8_t y, uint8_t colSpan, uint8_t rowSpan, colourModule::Colour colour)
             {
                 auto signalLight = std::make_shared<SignalLightElement>();
-                signalLight->data().b = machine::popFloat();
-                signalLight->data().g = machine::popFloat();
-                signalLight->data().r = machine::popFloat();
-                signalLight->data().rowSpan = machine::popUint8();
-                signalLight->data().colSpan = machine::popUint8();
-                signalLight->data().y = machine::popUint8();
-                signalLight->data().x = machine::popUint8();
-
-                showElement(signalLight);
+                signalLight->data().b = colour.b;
+                signalLight->data().g = colour.g;
+                signalLight->data().r = colour.r;
+                signalLight->data().rowSpan = rowSpan;
+                signalLight->data().colSpan = colSpan;
+                signalLight->data().y = y;
+                signalLight->data().x = x;
+
+                showElement(machine, signalLight);
             });
     }
 
-    void loop()
+    void loop(machine::Machine &machine)
     {
-        if (elementsModified && millis() - elementsLastSent > 100)
+        auto &state = stateOf(machine);
+        if (state.elementsModified && millis() - state.elementsLastSent > 100)
         {
-            elementsModified = false;
-            elementsLastSent = millis();
+            state.elementsModified = false;
+            state.elementsLastSent = millis();
 
             std::vector<uint8_t> data;
-            data.push_back(elements.size());
-            for (auto &element : elements)
+            data.push_back(state.elements.size());
+            for (auto &element : state.elements)
             {
                 uint8_t *ptr = (uint8_t *)(&element->data());
                 for (int i = 0; i < element->dataSize; i++)
@@ -219,8 +229,17 @@ namespace guiModule
         }
     }
 
-    void reset()
+    unsigned long idleTime(machine::Machine &machine)
+    {
+        auto &state = stateOf(machine);
+        if (!state.elementsModified)
+            return ULONG_MAX;
+        unsigned long elapsed = millis() - state.elementsLastSent;
+        return elapsed > 100 ? 0 : (101 - elapsed) * 1000;
+    }
+
+    void reset(machine::Machine &machine)
     {
-        elements.clear();
+        stateOf(machine).elements.clear();
     }
 }
\ No newline at end of file
@@ -1,8 +1,12 @@
 #pragma once
+#include "../machine.h"
 
 namespace guiModule
 {
     void setup();
-    void loop();
-    void reset();
+    void loop(machine::Machine &machine);
+    void reset(machine::Machine &machine);
+
+    // time in microseconds until loop() has to run again, ULONG_MAX if it only has to run after an event
+    unsigned long idleTime(machine::Machine &machine);
 }
\ No newline at end of file
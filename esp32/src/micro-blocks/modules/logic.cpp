@@ -7,68 +7,30 @@ namespace logicModule
     void setup()
     {
         // logicCompare
-        machine::registerFunction(
-            7,
-            []()
-            {
-                auto type = machine::popUint8();
-                auto b = machine::popFloat();
-                auto a = machine::popFloat();
-
-                switch (type)
-                {
-                case 0:
-                    machine::pushUint8(a == b);
-                    break;
-                case 1:
-                    machine::pushUint8(a != b);
-                    break;
-                case 2:
-                    machine::pushUint8(a < b);
-                    break;
-                case 3:
-                    machine::pushUint8(a <= b);
-                    break;
-                case 4:
-                    machine::pushUint8(a > b);
-                    break;
-                case 5:
-                    machine::pushUint8(a >= b);
-                    break;
-                default:
-                    Serial.println("Invalid type for logicCompare");
-                }
-            });
+        machine::registerOperation<7, 0>(+[](float a, float b) -> bool
+                                         { return a == b; });
+        machine::registerOperation<7, 1>(+[](float a, float b) -> bool
+                                         { return a != b; });
+        machine::registerOperation<7, 2>(+[](float a, float b) -> bool
+                                         { return a < b; });
+        machine::registerOperation<7, 3>(+[](float a, float b) -> bool
+                                         { return a <= b; });
+        machine::registerOperation<7, 4>(+[](float a, float b) -> bool
+                                         { return a > b; });
+        machine::registerOperation<7, 5>(+[](float a, float b) -> bool
+                                         { return a >= b; });
 
         // logicOperation
-        machine::registerFunction(
-            13,
-            []()
-            {
-                auto type = machine::popUint8();
-                auto b = machine::popUint8();
-                auto a = machine::popUint8();
-
-                switch (type)
-                {
-                case 0:
-                    machine::pushUint8(a && b);
-                    break;
-                case 1:
-                    machine::pushUint8(a || b);
-                    break;
-                default:
-                    Serial.println("Invalid type for logicOperation");
-                }
-            });
+        machine::registerOperation<13, 0>(+[](uint8_t a, uint8_t b) -> bool
+                                          { return a && b; });
+        machine::registerOperation<13, 1>(+[](uint8_t a, uint8_t b) -> bool
+                                          { return a || b; });
 
         // logicNegate
-        machine::registerFunction(
-            14,
-            []()
+        machine::registerFunction<14>(
+            +[](uint8_t a)
             {
-                auto a = machine::popUint8();
-                machine::pushUint8(a == 0);
+                return a == 0;
             });
     }
 }
\ No newline at end of file
@@ -41,210 +41,109 @@ namespace mathModule
     void setup()
     {
         // mathBinary
-        machine::registerFunction(
-            6,
-            []()
-            {
-                auto operation = machine::popUint8();
-                auto right = machine::popFloat();
-                auto left = machine::popFloat();
-
-                float result;
-                switch (operation)
-                {
-                case 0:
-                    result = left + right;
-                    break;
-                case 1:
-                    result = left - right;
-                    break;
-                case 2:
-                    result = left * right;
-                    break;
-                case 3:
-                    result = left / right;
-                    break;
-                case 4:
-                    result = pow(left, right);
-                    break;
-                case 5:
-                    result = fmod(left, right);
-                    break;
-                case 6:
-                    result = random(left, right);
-                    break;
-
-                case 7:
-                    result = atan2(left, right);
-                    break;
-
-                default:
-                    Serial.println("Invalid operation for mathArithmetic");
-                }
-
-                // Serial.println(String("mathArithmetic: ") + left + " [" + operation + "] " + right + " = " + result);
-                machine::pushFloat(result);
-            });
+        machine::registerOperation<6, 0>(+[](float left, float right) -> float
+                                         { return left + right; });
+        machine::registerOperation<6, 1>(+[](float left, float right) -> float
+                                         { return left - right; });
+        machine::registerOperation<6, 2>(+[](float left, float right) -> float
+                                         { return left * right; });
+        machine::registerOperation<6, 3>(+[](float left, float right) -> float
+                                         { return left / right; });
+        machine::registerOperation<6, 4>(+[](float left, float right) -> float
+                                         { return pow(left, right); });
+        machine::registerOperation<6, 5>(+[](float left, float right) -> float
+                                         { return fmod(left, right); });
+        machine::registerOperation<6, 6>(+[](float left, float right) -> float
+                                         { return random(left, right); });
+        machine::registerOperation<6, 7>(+[](float left, float right) -> float
+                                         { return atan2(left, right); });
 
         // mathNumberProperty
-        machine::registerFunction(
-            15,
-            []()
-            {
-                auto property = machine::popUint8();
-                auto number = machine::popFloat();
-                bool result;
-                switch (property)
-                {
-                case 0:
-                    result = ((int)number % 2) == 0;
-                    break;
-                case 1:
-                    result = ((int)number % 2) == 1;
-                    break;
-                case 2:
-                    result = isPrime((long)number);
-                    break;
-                case 3:
-                    result = ((int)number % 1) == 0;
-                    break;
-                case 4:
-                    result = number > 0;
-                    break;
-                case 5:
-                    result = number < 0;
-                    break;
-                default:
-                    Serial.println("Invalid property for mathNumberProperty");
-                }
-
-                machine::pushUint8(result);
-            });
+        machine::registerOperation<15, 0>(+[](float number) -> bool
+                                          { return ((int)number % 2) == 0; });
+        machine::registerOperation<15, 1>(+[](float number) -> bool
+                                          { return ((int)number % 2) == 1; });
+        machine::registerOperation<15, 2>(+[](float number) -> bool
+                                          { return isPrime((long)number); });
+        machine::registerOperation<15, 3>(+[](float number) -> bool
+                                          { return ((int)number % 1) == 0; });
+        machine::registerOperation<15, 4>(+[](float number) -> bool
+                                          { return number > 0; });
+        machine::registerOperation<15, 5>(+[](float number) -> bool
+                                          { return number < 0; });
 
         // unary operations
-        machine::registerFunction(
-            16,
-            []()
-            {
-                auto operation = machine::popUint8();
-                auto number = machine::popFloat();
-                float result;
-                switch (operation)
-                {
-                // trig
-                case 0:
-                    result = sin(number);
-                    break;
-                case 1:
-                    result = cos(number);
-                    break;
-                case 2:
-                    result = tan(number);
-                    break;
-                case 3:
-                    result = asin(number);
-                    break;
-                case 4:
-                    result = acos(number);
-                    break;
-                case 5:
-                    result = atan(number);
-                    break;
-
-                // round
-                case 6:
-                    result = round(number);
-                    break;
-                case 7:
-                    result = ceil(number);
-                    break;
-                case 8:
-                    result = floor(number);
-                    break;
-
-                // single
-                case 9:
-                    result = sqrt(number);
-                    break;
-                case 10:
-                    result = abs(number);
-                    break;
-                case 11:
-                    result = -number;
-                    break;
-                case 12:
-                    result = log(number);
-                    break;
-                case 13:
-                    result = log10(number);
-                    break;
-                case 14:
-                    result = exp(number);
-                    break;
-                case 15:
-                    result = pow(10, number);
-                    break;
-                default:
-                    Serial.println("Invalid operation for mathTrig");
-                }
-
-                // Serial.println(String("mathTrig: ") + operation + " " + number + " = " + result);
-                machine::pushFloat(result);
-            });
+        // trig
+        machine::registerOperation<16, 0>(+[](float number) -> float
+                                          { return sin(number); });
+        machine::registerOperation<16, 1>(+[](float number) -> float
+                                          { return cos(number); });
+        machine::registerOperation<16, 2>(+[](float number) -> float
+                                          { return tan(number); });
+        machine::registerOperation<16, 3>(+[](float number) -> float
+                                          { return asin(number); });
+        machine::registerOperation<16, 4>(+[](float number) -> float
+                                          { return acos(number); });
+        machine::registerOperation<16, 5>(+[](float number) -> float
+                                          { return atan(number); });
+        // round
+        machine::registerOperation<16, 6>(+[](float number) -> float
+                                          { return round(number); });
+        machine::registerOperation<16, 7>(+[](float number) -> float
+                                          { return ceil(number); });
+        machine::registerOperation<16, 8>(+[](float number) -> float
+                                          { return floor(number); });
+        // single
+        machine::registerOperation<16, 9>(+[](float number) -> float
+                                          { return sqrt(number); });
+        machine::registerOperation<16, 10>(+[](float number) -> float
+                                           { return abs(number); });
+        machine::registerOperation<16, 11>(+[](float number) -> float
+                                           { return -number; });
+        machine::registerOperation<16, 12>(+[](float number) -> float
+                                           { return log(number); });
+        machine::registerOperation<16, 13>(+[](float number) -> float
+                                           { return log10(number); });
+        machine::registerOperation<16, 14>(+[](float number) -> float
+                                           { return exp(number); });
+        machine::registerOperation<16, 15>(+[](float number) -> float
+                                           { return pow(10, number); });
 
         // mathRandomFloat
-        machine::registerFunction(
-            17,
-            []()
+        machine::registerFunction<17>(
+            +[]()
             {
-                machine::pushFloat(rand() / (float)RAND_MAX);
+                return rand() / (float)RAND_MAX;
             });
 
         // mathConstrain
-        machine::registerFunction(
-            18,
-            []()
+        machine::registerFunction<18>(
+            +[](float number, float low, float high)
             {
-                auto high = machine::popFloat();
-                auto low = machine::popFloat();
-                auto number = machine::popFloat();
                 if (number < low)
                     number = low;
                 if (number > high)
                     number = high;
-                machine::pushFloat(number);
+                return number;
             });
 
         // mathMapLinear
-        machine::registerFunction(
-            34,
-            []()
+        machine::registerFunction<34>(
+            +[](float value, float x1, float y1, float x2, float y2)
             {
-                auto y2 = machine::popFloat();
-                auto x2 = machine::popFloat();
-                auto y1 = machine::popFloat();
-                auto x1 = machine::popFloat();
-                auto value = machine::popFloat();
-
                 auto xDiff = x2 - x1;
                 if (xDiff == 0)
                 {
-                    machine::pushFloat(value);
-                    return;
+                    return value;
                 }
-                machine::pushFloat(y1 + (value - x1) * (y2 - y1) / xDiff);
+                return y1 + (value - x1) * (y2 - y1) / xDiff;
             });
 
         // mathMapTemperature
-        machine::registerFunction(
-            35,
-            []()
+        machine::registerFunction<35>(
+            +[](float value, float a, float b)
             {
-                auto b = machine::popFloat();
-                auto a = machine::popFloat();
-                auto value = machine::popFloat();
-
-                machine::pushFloat(1. / (a + b * log(toResistance(value))) - 273.15);
+                return (float)(1. / (a + b * log(toResistance(value))) - 273.15);
             });
     }
 
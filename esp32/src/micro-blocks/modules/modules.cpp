@@ -1,5 +1,6 @@
 #include "modules.h"
 #include <vector>
+#include <algorithm>
 #include "pin.h"
 #include <Arduino.h>
 #include "logic.h"
@@ -14,10 +15,11 @@
 #include "colour.h"
 #include "tcs34725module.h"
 #include "rgbLed.h"
+#include "channel.h"
 
 namespace modules
 {
-    void setup()
+    void setup(machine::Machine &machine)
     {
         basicModule::setup();
         pinModule::setup();
@@ -32,28 +34,50 @@ namespace modules
         colourModule::setup();
         tcs34725module::setup();
         rgbLedModule::setup();
+        channelModule::setup();
+
+        basicModule::receiveMessages(machine);
+        sensorModule::receiveMessages(machine);
     }
 
-    void loop()
+    void loop(machine::Machine &machine)
     {
-        pinModule::loop();
-        sensorModule::loop();
+        pinModule::loop(machine);
+        sensorModule::loop(machine);
         tftModule::loop();
-        textModule::loop();
-        guiModule::loop();
-        rgbLedModule::loop();
+        textModule::loop(machine);
+        guiModule::loop(machine);
+        rgbLedModule::loop(machine);
 
         // the basic module should come last, to run yielded thread with lowest priority
-        basicModule::loop();
+        basicModule::loop(machine);
+    }
+
+    unsigned long idleTime(machine::Machine &machine)
+    {
+        return std::min({basicModule::idleTime(machine),
+                         pinModule::idleTime(machine),
+                         sensorModule::idleTime(machine),
+                         textModule::idleTime(machine),
+                         guiModule::idleTime(machine)});
+    }
+
+    void reset(machine::Machine &machine)
+    {
+        basicModule::reset(machine);
+        pinModule::reset(machine);
+        sensorModule::reset(machine);
+        textModule::reset(machine);
+        guiModule::reset(machine);
+        tcs34725module::reset(machine);
+        rgbLedModule::reset(machine);
+        channelModule::reset(machine);
     }
 
-    void reset()
+    void resetThread(machine::Machine &machine, uint16_t threadNr)
     {
-        basicModule::reset();
-        pinModule::reset();
-        textModule::reset();
-        guiModule::reset();
-        tcs34725module::reset();
-        rgbLedModule::reset();
+        basicModule::resetThread(machine, threadNr);
+        pinModule::resetThread(machine, threadNr);
+        sensorModule::resetThread(machine, threadNr);
     }
 }
\ No newline at end of file
@@ -1,8 +1,19 @@
 #pragma once
 #include <functional>
+#include "../machine.h"
+
+// The modules keep their state per machine.
 namespace modules
 {
-    void setup();
-    void loop();
-    void reset();
+    // Register the functions of all modules. The messages of the client go to the given machine.
+    void setup(machine::Machine &machine);
+    void loop(machine::Machine &machine);
+    void reset(machine::Machine &machine);
+
+    // Forget the state all modules keep for a thread, as the number of an ended spawned
+    // thread is taken by a new one.
+    void resetThread(machine::Machine &machine, uint16_t threadNr);
+
+    // time in microseconds until loop() has to run again, ULONG_MAX if it only has to run after an event
+    unsigned long idleTime(machine::Machine &machine);
 }
\ No newline at end of file
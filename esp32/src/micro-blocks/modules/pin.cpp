@@ -1,9 +1,15 @@
 #include "pin.h"
 #include <deque>
+#include <algorithm>
 #include <vector>
 #include <stdint.h>
 #include "../machine.h"
+#include "../latency.h"
+#include "../eventQueue.h"
+#include "basic.h"
 #include <Arduino.h>
+#include <limits.h>
+#include "../micro-blocks.h"
 
 namespace pinModule
 {
@@ -12,36 +18,83 @@ namespace pinModule
     {
         unsigned long lastChange = 0;
         unsigned long debounce = 0;
+        // micros() when the thread started waiting
+        unsigned long readyTime = 0;
+        // detected changes, the payload being the new state of the pin
+        EventQueue<bool> events;
         uint16_t threadNr;
         uint8_t pin;
         uint8_t edge;
         bool lastState;
-        bool triggered = false;
+        // state of the pin after the change the thread was last resumed for
+        bool eventState = false;
         bool ready = false;
     } OnPinChangeEntry;
 
-    std::vector<OnPinChangeEntry> onPinChangeEntries;
+    struct State
+    {
+        std::vector<OnPinChangeEntry> onPinChangeEntries;
+    };
+
+    std::vector<OnPinChangeEntry> &entriesOf(machine::Machine &machine)
+    {
+        return machine.state<State>().onPinChangeEntries;
+    }
 
-    void reset()
+    void reset(machine::Machine &machine)
     {
+        auto &onPinChangeEntries = entriesOf(machine);
+        for (auto &entry : onPinChangeEntries)
+            detachInterrupt(entry.pin);
         onPinChangeEntries.clear();
     }
 
+    void resetThread(machine::Machine &machine, uint16_t threadNr)
+    {
+        auto &onPinChangeEntries = entriesOf(machine);
+        for (auto entry = onPinChangeEntries.begin(); entry != onPinChangeEntries.end();)
+        {
+            if (entry->threadNr != threadNr)
+            {
+                entry++;
+                continue;
+            }
+            uint8_t pin = entry->pin;
+            entry = onPinChangeEntries.erase(entry);
+            // other threads might still wait for changes of the pin
+            if (std::none_of(onPinChangeEntries.begin(), onPinChangeEntries.end(), [pin](const OnPinChangeEntry &other)
+                             { return other.pin == pin; }))
+                detachInterrupt(pin);
+        }
+    }
+
+    unsigned long idleTime(machine::Machine &machine)
+    {
+        unsigned long idle = ULONG_MAX;
+        auto now = millis();
+        for (auto &entry : entriesOf(machine))
+        {
+            if (entry.ready && !entry.events.empty())
+                return 0;
+            // the state is only read again once the debounce time passed
+            if (now - entry.lastChange <= entry.debounce)
+                idle = std::min(idle, (entry.debounce - (now - entry.lastChange) + 1) * 1000);
+        }
+        return idle;
+    }
+
     void setup()
     {
         // setup on pin change
-        machine::registerFunction(
-            1,
-            []()
+        machine::registerFunction<1>(
+            +[](machine::Machine &machine, uint8_t pin, uint8_t pull, uint8_t edge, float debounce)
             {
-                auto debounce = machine::popFloat();
-                auto edge = machine::popUint8();
-                auto pull = machine::popUint8();
                 OnPinChangeEntry entry;
-                entry.pin = machine::popUint8();
+                entry.pin = pin;
                 entry.edge = edge;
-                entry.threadNr = machine::currentThreadNr;
+                entry.threadNr = machine.currentThreadNr;
                 entry.debounce = debounce;
+                entry.events.configure(basicModule::eventQueueConfig(machine, entry.threadNr));
                 switch (pull)
                 {
                 case 0:
@@ -57,49 +110,58 @@ namespace pinModule
                 pinMode(entry.pin, INPUT + pull);
 
                 entry.lastState = digitalRead(entry.pin);
-                onPinChangeEntries.push_back(entry);
-                Serial.println(String("Thread ") + machine::currentThreadNr + ": setup on pin " + entry.pin + " change");
+                entriesOf(machine).push_back(entry);
+                // the loop only runs after events, let each edge wake it up
+                attachInterrupt(entry.pin, microBlocks::wakeFromIsr, CHANGE);
+                Serial.println(String("Thread ") + machine.currentThreadNr + ": setup on pin " + entry.pin + " change");
             });
 
         // wait for pin change
-        machine::registerFunction(
-            2,
-            []()
+        machine::registerFunction<2>(
+            +[](machine::Machine &machine)
             {
-                for (auto &entry : onPinChangeEntries)
+                for (auto &entry : entriesOf(machine))
                 {
-                    if (entry.threadNr == machine::currentThreadNr)
+                    if (entry.threadNr == machine.currentThreadNr)
                     {
                         entry.ready = true;
-                        Serial.println(String("Thread ") + machine::currentThreadNr + " waiting on pin " + entry.pin);
+                        entry.readyTime = micros();
+                        entry.events.configure(basicModule::eventQueueConfig(machine, entry.threadNr));
+                        basicModule::markEventHandler(machine, entry.threadNr);
+                        Serial.println(String("Thread ") + machine.currentThreadNr + " waiting on pin " + entry.pin);
                         break;
                     }
                 }
-                machine::suspendCurrentThread();
+                machine.suspendCurrentThread();
             });
 
-        // set pin
-        machine::registerFunction(
-            3,
-            []()
+        // pinEventState
+        machine::registerFunction<56>(
+            +[](machine::Machine &machine) -> bool
             {
-                uint8_t value = machine::popUint8();
-                uint8_t pin = machine::popUint8();
+                for (auto &entry : entriesOf(machine))
+                {
+                    if (entry.threadNr == machine.currentThreadNr)
+                        return entry.eventState;
+                }
+                return false;
+            });
 
+        // set pin
+        machine::registerFunction<3>(
+            +[](uint8_t pin, uint8_t value)
+            {
                 // Serial.println(String("Thread ") + machine::currentThreadNr + " set pin " + pin + " to value " + value);
                 pinMode(pin, OUTPUT);
                 digitalWrite(pin, value);
             });
 
         // pinReadAnalog
-        machine::registerFunction(
-            32,
-            []()
+        machine::registerFunction<32>(
+            +[](uint8_t pin)
             {
-                uint8_t pin = machine::popUint8();
-
                 pinMode(pin, ANALOG);
-                machine::pushFloat(analogRead(pin)/4095.);
+                return (float)(analogRead(pin) / 4095.);
             });
 
         analogReadResolution(12);
@@ -107,12 +169,9 @@ namespace pinModule
         analogWriteFrequency(1000);
 
         // set pin analog
-        machine::registerFunction(
-            19,
-            []()
+        machine::registerFunction<19>(
+            +[](uint8_t pin, float value)
             {
-                float value = machine::popFloat();
-                uint8_t pin = machine::popUint8();
                 pinMode(pin, OUTPUT);
                 if (value < 0)
                     value = 0;
@@ -122,28 +181,32 @@ namespace pinModule
             });
     }
 
-    void loop()
+    void loop(machine::Machine &machine)
     {
         auto now = millis();
-        for (auto &entry : onPinChangeEntries)
+        for (auto &entry : entriesOf(machine))
         {
             // only look at the state if the last state change is at least the debounce time ago
             if (now - entry.lastChange > entry.debounce)
             {
                 auto newState = digitalRead(entry.pin);
 
+                bool triggered = false;
                 switch (entry.edge)
                 {
                 case 0:
-                    entry.triggered = entry.lastState != newState;
+                    triggered = entry.lastState != newState;
                     break;
                 case 1:
-                    entry.triggered = !entry.lastState && newState;
+                    triggered = !entry.lastState && newState;
                     break;
                 case 2:
-                    entry.triggered = entry.lastState && !newState;
+                    triggered = entry.lastState && !newState;
                     break;
                 }
+                // changes are queued while the thread is still handling a previous one
+                if (triggered && !entry.events.push(newState, micros()))
+                    basicModule::countDroppedEvent(machine, latency::Source::PIN_CHANGE);
 
                 if (entry.lastState != newState)
                 {
@@ -152,13 +215,15 @@ namespace pinModule
                 }
             }
 
-            // if the entry is ready (by calling wait for pin change) and the pin has changed, run the thread
-            if (entry.ready && entry.triggered)
+            // if the entry is ready (by calling wait for pin change) and a change is pending, run the thread
+            EventQueue<bool>::Event event;
+            if (entry.ready && entry.events.pop(event))
             {
-                entry.triggered = false;
                 entry.ready = false;
-                Serial.println("Pin change");
-                machine::runThread(entry.threadNr);
+                entry.eventState = event.value;
+                basicModule::setEventTime(machine, entry.threadNr, event.time);
+                auto time = micros();
+                basicModule::makeRunnable(machine, entry.threadNr, latency::Source::PIN_CHANGE, time - std::min(time - event.time, time - entry.readyTime));
             }
         }
     }
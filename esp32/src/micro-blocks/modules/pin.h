@@ -1,7 +1,14 @@
 #pragma once
+#include "../machine.h"
+
 namespace pinModule
 {
     void setup();
-    void loop();
-    void reset();
+    void loop(machine::Machine &machine);
+    void reset(machine::Machine &machine);
+    // remove the subscriptions of a thread, before its number is taken by a new spawned thread
+    void resetThread(machine::Machine &machine, uint16_t threadNr);
+
+    // time in microseconds until loop() has to run again, ULONG_MAX if it only has to run after an event
+    unsigned long idleTime(machine::Machine &machine);
 }
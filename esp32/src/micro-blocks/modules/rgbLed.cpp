@@ -6,6 +6,7 @@
 #include <unordered_map>
 #include "colour.h"
 #include "../machine.h"
+#include <Arduino.h>
 
 namespace rgbLedModule
 {
@@ -96,8 +97,24 @@ namespace rgbLedModule
         return result;
     }
 
-    // Indices: 0 = g; 1= r; 2 = b
-    std::unordered_map<uint16_t, BusEntry *> busses;
+    struct State
+    {
+        // Indices: 0 = g; 1= r; 2 = b
+        std::unordered_map<uint16_t, BusEntry *> busses;
+
+        ~State()
+        {
+            for (auto &bus : busses)
+            {
+                delete bus.second;
+            }
+        }
+    };
+
+    std::unordered_map<uint16_t, BusEntry *> &bussesOf(machine::Machine &machine)
+    {
+        return machine.state<State>().busses;
+    }
 
     struct Bitmap
     {
@@ -118,66 +135,45 @@ namespace rgbLedModule
     void setup()
     {
         //  rgbLedSetup
-        machine::registerFunction(
-            48,
-            []()
+        machine::registerFunction<48>(
+            +[](machine::Machine &machine, uint16_t id, uint8_t pin, uint16_t width, uint16_t height)
             {
-                auto height = machine::popUint16();
-                auto width = machine::popUint16();
-                auto pin = machine::popUint8();
-                auto id = machine::popUint16();
-
                 auto entry = new BusEntry(width, height, pin);
                 entry->bus.Begin();
-                busses[id] = entry;
+                bussesOf(machine)[id] = entry;
             });
 
         // rgbLedSetColour
-        machine::registerFunction(
-            49,
-            []()
+        machine::registerFunction<49>(
+            +[](machine::Machine &machine, uint16_t id, float index, colourModule::Colour colour)
             {
-                auto b = machine::popFloat();
-                auto g = machine::popFloat();
-                auto r = machine::popFloat();
-                auto index = machine::popFloat();
-                auto id = machine::popUint16();
-
-                busses[id]->bus.SetPixelColor(index, RgbColor(colourModule::deGamma(r) * 255, colourModule::deGamma(g) * 255, colourModule::deGamma(b) * 255));
+                bussesOf(machine)[id]->bus.SetPixelColor(index, RgbColor(colourModule::deGamma(colour.r) * 255, colourModule::deGamma(colour.g) * 255, colourModule::deGamma(colour.b) * 255));
             });
 
         // rgbShow
-        machine::registerFunction(
-            50,
-            []()
+        machine::registerFunction<50>(
+            +[](machine::Machine &machine, uint16_t id)
             {
-                auto id = machine::popUint16();
-                busses[id]->bus.Show();
+                bussesOf(machine)[id]->bus.Show();
             });
 
         // rgbSetBitmap
-        machine::registerFunction(
-            51,
-            []()
+        machine::registerFunction<51>(
+            +[](machine::Machine &machine, uint16_t id, uint16_t bitmapOffset,
+                float ledXf, float ledYf, float ledWidthf, float ledHeightf,
+                float bitmapX, float bitmapY, float scale, float rotation,
+                bool transparent, colourModule::Colour colour)
             {
-                auto b = machine::popFloat();
-                auto g = machine::popFloat();
-                auto r = machine::popFloat();
-
-                auto transparent = machine::popUint8() != 0;
-                auto rotation = machine::popFloat();
-                auto scale = machine::popFloat();
-                auto bitmapY = machine::popFloat();
-                auto bitmapX = machine::popFloat();
-                auto ledHeight = (int)machine::popFloat();
-                auto ledWidth = (int)machine::popFloat();
-                auto ledY = (int)machine::popFloat();
-                auto ledX = (int)machine::popFloat();
-                auto bitmapOffset = machine::popUint16();
-                auto id = machine::popUint16();
-
-                auto entry = busses[id];
-                auto bitmap = (Bitmap *)machine::constantPool(bitmapOffset);
+                auto r = colour.r;
+                auto g = colour.g;
+                auto b = colour.b;
+                auto ledHeight = (int)ledHeightf;
+                auto ledWidth = (int)ledWidthf;
+                auto ledY = (int)ledYf;
+                auto ledX = (int)ledXf;
+
+                auto entry = bussesOf(machine)[id];
+                auto bitmap = (Bitmap *)machine.constantPool(bitmapOffset);
 
                 // auto color = RgbColor(colourModule::deGamma(r) * 255, colourModule::deGamma(g) * 255, colourModule::deGamma(b) * 255);
 
@@ -224,10 +220,11 @@ namespace rgbLedModule
                 }
             });
     }
-    void loop() {}
+    void loop(machine::Machine &) {}
 
-    void reset()
+    void reset(machine::Machine &machine)
     {
+        auto &busses = bussesOf(machine);
         for (auto &bus : busses)
         {
             delete bus.second;
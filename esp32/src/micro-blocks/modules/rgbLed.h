@@ -1,6 +1,8 @@
+#include "../machine.h"
+
 namespace rgbLedModule
 {
     void setup();
-    void loop();
-    void reset();
+    void loop(machine::Machine &machine);
+    void reset(machine::Machine &machine);
 }
\ No newline at end of file
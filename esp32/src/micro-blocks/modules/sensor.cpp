@@ -1,98 +1,166 @@
 #include "sensor.h"
 #include "websocket.h"
 #include "../machine.h"
+#include "../latency.h"
+#include "../threadSet.h"
+#include "../eventQueue.h"
+#include "basic.h"
 #include <Arduino.h>
 #include <deque>
-#include <unordered_map>
+#include <algorithm>
+#include <vector>
+#include <limits.h>
 
 namespace sensorModule
 {
-    typedef struct __packed__
+    typedef struct __attribute__((packed))
     {
         float x;
         float y;
         float z;
     } GravitySensorValue;
 
-    GravitySensorValue lastGravitySensorValue{.x = 0, .y = 0, .z = 0};
+    // the subscriptions of the threads of a machine
+    struct State
+    {
+        GravitySensorValue lastGravitySensorValue{.x = 0, .y = 0, .z = 0};
+
+        // threads set up to wait for gravity sensor changes, the threads with pending changes and the waiting threads
+        ThreadSet gravitySensorThreads;
+        ThreadSet triggeredThreads;
+        ThreadSet waitingThreads;
 
-    typedef struct
+        // indexed by thread number, micros() when the thread started waiting, the pending changes
+        // and the value of the change the thread was last resumed for
+        std::vector<unsigned long> waitTimes;
+        std::vector<EventQueue<GravitySensorValue>> events;
+        std::vector<GravitySensorValue> eventValues;
+    };
+
+    State &stateOf(machine::Machine &machine)
     {
-        bool triggered = false;
-        bool waiting = false;
-    } OnGravitySensorChangeEntry;
+        return machine.state<State>();
+    }
 
-    std::unordered_map<uint16_t, OnGravitySensorChangeEntry> onGravitySensorChangeEntries;
+    // the value of the change handled by the current thread, the last value for all other threads
+    const GravitySensorValue &gravitySensorValue(machine::Machine &machine)
+    {
+        auto &state = stateOf(machine);
+        if (state.gravitySensorThreads.contains(machine.currentThreadNr))
+            return state.eventValues[machine.currentThreadNr];
+        return state.lastGravitySensorValue;
+    }
 
-    void setup()
+    unsigned long idleTime(machine::Machine &machine)
+    {
+        auto &state = stateOf(machine);
+        return ThreadSet::firstCommon(state.triggeredThreads, state.waitingThreads) != ThreadSet::NONE ? 0 : ULONG_MAX;
+    }
+
+    void reset(machine::Machine &machine)
+    {
+        auto &state = stateOf(machine);
+        state.gravitySensorThreads.clear();
+        state.triggeredThreads.clear();
+        state.waitingThreads.clear();
+    }
+
+    void resetThread(machine::Machine &machine, uint16_t threadNr)
+    {
+        auto &state = stateOf(machine);
+        state.gravitySensorThreads.erase(threadNr);
+        state.triggeredThreads.erase(threadNr);
+        state.waitingThreads.erase(threadNr);
+    }
+
+    void receiveMessages(machine::Machine &machine)
     {
         websocket::handle<GravitySensorValue>(
             websocket::MessageType::GRAVITY_SENSOR_VALUE,
-            [](GravitySensorValue &message)
+            [&machine](GravitySensorValue &message)
             {
-                lastGravitySensorValue = message;
+                auto &state = stateOf(machine);
+                state.lastGravitySensorValue = message;
 
-                for (auto &entry : onGravitySensorChangeEntries)
+                for (auto threadNr = state.gravitySensorThreads.first(); threadNr != ThreadSet::NONE; threadNr = state.gravitySensorThreads.first(threadNr + 1))
                 {
-                    entry.second.triggered = true;
+                    if (!state.events[threadNr].push(message, micros()))
+                        basicModule::countDroppedEvent(machine, latency::Source::GRAVITY_SENSOR);
+                    state.triggeredThreads.insert(threadNr);
                 }
             });
+    }
 
+    void setup()
+    {
         // sensorGetGravityValue
-        machine::registerFunction(
-            20,
-            []()
-            {
-                auto axis = machine::popUint8();
-                float result;
-                switch (axis)
-                {
-                case 0:
-                    result = lastGravitySensorValue.x;
-                    break;
-                case 1:
-                    result = lastGravitySensorValue.y;
-                    break;
-                case 2:
-                    result = lastGravitySensorValue.z;
-                    break;
-                default:
-                    Serial.println("Invalid axis for getGravitySensorValue");
-                }
-                // Serial.println(String("get gravity axis ") + axis + " is " + result);
-                machine::pushFloat(result);
-            });
+        machine::registerOperation<20, 0>(+[](machine::Machine &machine) -> float
+                                          { return gravitySensorValue(machine).x; });
+        machine::registerOperation<20, 1>(+[](machine::Machine &machine) -> float
+                                          { return gravitySensorValue(machine).y; });
+        machine::registerOperation<20, 2>(+[](machine::Machine &machine) -> float
+                                          { return gravitySensorValue(machine).z; });
 
         // setup on gravity sensor change
-        machine::registerFunction(
-            21,
-            []()
+        machine::registerFunction<21>(
+            +[](machine::Machine &machine)
             {
-                OnGravitySensorChangeEntry entry;
-                onGravitySensorChangeEntries[machine::currentThreadNr] = entry;
+                auto &state = stateOf(machine);
+                auto threadNr = machine.currentThreadNr;
+                if (threadNr >= state.waitTimes.size())
+                {
+                    state.waitTimes.resize(threadNr + 1);
+                    state.events.resize(threadNr + 1);
+                    state.eventValues.resize(threadNr + 1);
+                }
+                state.events[threadNr].configure(basicModule::eventQueueConfig(machine, threadNr));
+                state.events[threadNr].clear();
+                state.eventValues[threadNr] = state.lastGravitySensorValue;
+                state.gravitySensorThreads.insert(threadNr);
+                state.triggeredThreads.erase(threadNr);
+                state.waitingThreads.erase(threadNr);
             });
 
         // wait for gravity sensor change
-        machine::registerFunction(
-            22,
-            []()
+        machine::registerFunction<22>(
+            +[](machine::Machine &machine)
             {
-                onGravitySensorChangeEntries[machine::currentThreadNr].waiting = true;
-                machine::suspendCurrentThread();
+                auto &state = stateOf(machine);
+                auto threadNr = machine.currentThreadNr;
+                if (state.gravitySensorThreads.contains(threadNr))
+                {
+                    state.waitingThreads.insert(threadNr);
+                    state.waitTimes[threadNr] = micros();
+                    state.events[threadNr].configure(basicModule::eventQueueConfig(machine, threadNr));
+                    basicModule::markEventHandler(machine, threadNr);
+                }
+                machine.suspendCurrentThread();
             });
     }
 
-    void loop()
+    void loop(machine::Machine &machine)
     {
-        for (auto &entry : onGravitySensorChangeEntries)
+        auto &state = stateOf(machine);
+        for (auto threadNr = ThreadSet::firstCommon(state.triggeredThreads, state.waitingThreads);
+             threadNr != ThreadSet::NONE;
+             threadNr = ThreadSet::firstCommon(state.triggeredThreads, state.waitingThreads, threadNr + 1))
         {
-            if (entry.second.triggered && entry.second.waiting)
+            auto &queue = state.events[threadNr];
+            EventQueue<GravitySensorValue>::Event event;
+            if (!queue.pop(event))
             {
-                entry.second.triggered = false;
-                entry.second.waiting = false;
-                machine::runThread(entry.first);
-                break;
+                // triggered threads always have an event queued
+                state.triggeredThreads.erase(threadNr);
+                continue;
             }
+            if (queue.empty())
+                state.triggeredThreads.erase(threadNr);
+            state.waitingThreads.erase(threadNr);
+
+            state.eventValues[threadNr] = event.value;
+            basicModule::setEventTime(machine, threadNr, event.time);
+            auto time = micros();
+            basicModule::makeRunnable(machine, threadNr, latency::Source::GRAVITY_SENSOR, time - std::min(time - event.time, time - state.waitTimes[threadNr]));
         }
     }
 }
\ No newline at end of file
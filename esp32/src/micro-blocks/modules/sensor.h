@@ -1,7 +1,17 @@
 #pragma once
+#include "../machine.h"
 
 namespace sensorModule
 {
     void setup();
-    void loop();
+    void loop(machine::Machine &machine);
+    void reset(machine::Machine &machine);
+    // remove the subscription of a thread, before its number is taken by a new spawned thread
+    void resetThread(machine::Machine &machine, uint16_t threadNr);
+
+    // pass the gravity sensor values sent by the client to the given machine
+    void receiveMessages(machine::Machine &machine);
+
+    // time in microseconds until loop() has to run again, ULONG_MAX if it only has to run after an event
+    unsigned long idleTime(machine::Machine &machine);
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "tcs34725module.h"
 #include "Adafruit_TCS34725.h"
 #include "../machine.h"
+#include <Arduino.h>
 #include <unordered_map>
 #include <stack>
 #include "colour.h"
@@ -12,20 +13,27 @@ namespace tcs34725module
         Adafruit_TCS34725 *tcs;
         TwoWire *wire;
     };
-    std::unordered_map<uint16_t, SensorEntry> sensors;
+
+    // the sensors set up by the program of a machine, by id
+    struct State
+    {
+        std::unordered_map<uint16_t, SensorEntry> sensors;
+    };
+
+    std::unordered_map<uint16_t, SensorEntry> &sensorsOf(machine::Machine &machine)
+    {
+        return machine.state<State>().sensors;
+    }
+
+    // drivers of previous programs, reused by all machines
     std::stack<SensorEntry> pool;
 
     void setup()
     {
         // tcs34725Setup
-        machine::registerFunction(
-            41,
-            []()
+        machine::registerFunction<41>(
+            +[](machine::Machine &machine, uint16_t id, uint8_t scl, uint8_t sda)
             {
-                auto sda = machine::popUint8();
-                auto scl = machine::popUint8();
-                auto id = machine::popUint16();
-
                 SensorEntry entry;
                 if (pool.empty())
                 {
@@ -38,7 +46,7 @@ namespace tcs34725module
                     pool.pop();
                 }
 
-                sensors[id] = entry;
+                sensorsOf(machine)[id] = entry;
                 if (!entry.wire->begin(sda, scl))
                 {
                     Serial.println("Wire begin failed");
@@ -51,64 +59,58 @@ namespace tcs34725module
             });
 
         // tcs34725GetRGB
-        machine::registerFunction(
-            42,
-            []()
+        machine::registerFunction<42>(
+            +[](machine::Machine &machine, uint16_t id, uint8_t raw)
             {
-                auto raw = machine::popUint8();
-                auto id = machine::popUint16();
-                auto tcs = sensors[id].tcs;
+                auto tcs = sensorsOf(machine)[id].tcs;
                 uint16_t r, g, b, c;
                 tcs->getRawData(&r, &g, &b, &c);
+                colourModule::Colour result;
                 if (raw == 1)
                 {
-                    machine::pushFloat(r);
-                    machine::pushFloat(g);
-                    machine::pushFloat(b);
+                    result.r = r;
+                    result.g = g;
+                    result.b = b;
                 }
                 else if (c == 0)
                 {
-                    machine::pushFloat(0);
-                    machine::pushFloat(0);
-                    machine::pushFloat(0);
+                    result.r = 0;
+                    result.g = 0;
+                    result.b = 0;
                 }
                 else
                 {
                     float cf = c;
-                    machine::pushFloat(colourModule::gamma(r / cf));
-                    machine::pushFloat(colourModule::gamma(g / cf));
-                    machine::pushFloat(colourModule::gamma(b / cf));
+                    result.r = colourModule::gamma(r / cf);
+                    result.g = colourModule::gamma(g / cf);
+                    result.b = colourModule::gamma(b / cf);
                 }
+                return result;
             });
 
         // tcs34725GetClear
-        machine::registerFunction(
-            43,
-            []()
+        machine::registerFunction<43>(
+            +[](machine::Machine &machine, uint16_t id)
             {
-                auto id = machine::popUint16();
-                auto tcs = sensors[id].tcs;
+                auto tcs = sensorsOf(machine)[id].tcs;
                 uint16_t r, g, b, c;
                 tcs->getRawData(&r, &g, &b, &c);
-                machine::pushFloat(c);
+                return (float)c;
             });
 
         // tcs34725SetParams
-        machine::registerFunction(
-            44,
-            []()
+        machine::registerFunction<44>(
+            +[](machine::Machine &machine, uint16_t id, uint8_t gain, uint8_t integrationTime)
             {
-                auto integrationTime = machine::popUint8();
-                auto gain = machine::popUint8();
-                auto id = machine::popUint16();
-                auto tcs = sensors[id].tcs;
+                auto tcs = sensorsOf(machine)[id].tcs;
                 tcs->setGain((tcs34725Gain_t)gain);
                 tcs->setIntegrationTime(integrationTime);
             });
     }
 
-    void reset()
+    void reset(machine::Machine &machine)
     {
+        auto &sensors = sensorsOf(machine);
         for (auto tcs : sensors)
         {
             pool.push(tcs.second);
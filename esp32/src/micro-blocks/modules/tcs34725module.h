@@ -1,5 +1,7 @@
+#include "../machine.h"
+
 namespace tcs34725module
 {
     void setup();
-    void reset();
+    void reset(machine::Machine &machine);
 }
\ No newline at end of file
@@ -1,8 +1,10 @@
 #include "text.h"
 #include "Arduino.h"
 #include <set>
+#include <limits.h>
 #include "../machine.h"
 #include "../resourcePool.h"
+#include "colour.h"
 #include "../../websocket.h"
 
 using namespace resourcePool;
@@ -37,98 +39,105 @@ namespace textModule
 
     } LogSnapshot;
 
-    websocket::MessageWrapper<LogSnapshot> logSnapshot(websocket::MessageType::LOG_SNAPSHOT);
-    bool logChanged;
-    time_t lastLogSend;
+    // the log of a machine, sent to the client
+    struct State
+    {
+        websocket::MessageWrapper<LogSnapshot> logSnapshot;
+        bool logChanged;
+        time_t lastLogSend;
 
-    void setup()
+        State() : logSnapshot(websocket::MessageType::LOG_SNAPSHOT)
+        {
+            clear();
+        }
+
+        void clear()
+        {
+            logSnapshot.message.clear();
+            logChanged = true;
+            lastLogSend = millis() - 1000;
+        }
+    };
+
+    State &stateOf(machine::Machine &machine)
     {
-        logSnapshot.message.clear();
-        logChanged = true;
-        lastLogSend = millis() - 1000;
+        return machine.state<State>();
+    }
 
+    void setup()
+    {
         // textLoad
-        machine::registerFunction(
-            23,
-            []()
+        machine::registerFunction<23>(
+            +[](machine::Machine &machine, uint16_t offset)
             {
-                auto offset = machine::popUint16();
-                auto str = resourceHandle(new String(reinterpret_cast<const char *>(machine::constantPool(offset))));
-                machine::pushResourceHandle(str);
+                return resourceHandle(machine.resources, new String(reinterpret_cast<const char *>(machine.constantPool(offset))));
             });
 
         // textNumToString
-        machine::registerFunction(
-            24,
-            []()
+        machine::registerFunction<24>(
+            +[](machine::Machine &machine, float value)
             {
-                auto value = machine::popFloat();
-                auto str = resourceHandle(new String(value));
-                machine::pushResourceHandle(str);
+                return resourceHandle(machine.resources, new String(value));
             });
 
         // textPrintString
-        machine::registerFunction(
-            25,
-            []()
+        machine::registerFunction<25>(
+            +[](machine::Machine &machine, ResourceHandle<String> *str)
             {
-                auto str = machine::popResourceHandle<String>();
+                auto &state = stateOf(machine);
                 // Serial.println(**str);
-                logSnapshot.message.addLine(**str);
-                logChanged = true;
+                state.logSnapshot.message.addLine(**str);
+                state.logChanged = true;
                 str->decRef();
             });
 
         // textBoolToString
-        machine::registerFunction(
-            26,
-            []()
+        machine::registerFunction<26>(
+            +[](machine::Machine &machine, uint8_t value)
             {
-                auto value = machine::popUint8();
-                auto str = resourceHandle(new String(value == 0 ? "false" : "true"));
-                machine::pushResourceHandle(str);
+                return resourceHandle(machine.resources, new String(value == 0 ? "false" : "true"));
             });
 
         // textJoinString
-        machine::registerFunction(
-            27,
-            []()
+        machine::registerFunction<27>(
+            +[](machine::Machine &machine, ResourceHandle<String> *str1, ResourceHandle<String> *str2)
             {
-                auto str2 = machine::popResourceHandle<String>();
-                auto str1 = machine::popResourceHandle<String>();
-                auto str = resourceHandle(new String(**str1 + **str2));
-                machine::pushResourceHandle(str);
+                auto str = resourceHandle(machine.resources, new String(**str1 + **str2));
                 str1->decRef();
                 str2->decRef();
+                return str;
             });
 
         // textColourToString
-        machine::registerFunction(
-            46,
-            []()
+        machine::registerFunction<46>(
+            +[](machine::Machine &machine, colourModule::Colour colour)
             {
-                auto b = machine::popFloat();
-                auto g = machine::popFloat();
-                auto r = machine::popFloat();
-                auto str = resourceHandle(new String(String(r) + "," + g + "," + b));
-                machine::pushResourceHandle(str);
+                return resourceHandle(machine.resources, new String(String(colour.r) + "," + colour.g + "," + colour.b));
             });
     }
 
-    void loop()
+    void loop(machine::Machine &machine)
     {
-        if (logChanged && millis() - lastLogSend > 300)
+        auto &state = stateOf(machine);
+        if (state.logChanged && millis() - state.lastLogSend > 300)
         {
-            logChanged = false;
-            websocket::send(logSnapshot);
-            lastLogSend = millis();
+            state.logChanged = false;
+            websocket::send(state.logSnapshot);
+            state.lastLogSend = millis();
         }
     }
 
-    void reset()
+    unsigned long idleTime(machine::Machine &machine)
+    {
+        auto &state = stateOf(machine);
+        if (!state.logChanged)
+            return ULONG_MAX;
+        unsigned long elapsed = millis() - state.lastLogSend;
+        return elapsed > 300 ? 0 : (301 - elapsed) * 1000;
+    }
+
+    void reset(machine::Machine &machine)
     {
-        logSnapshot.message.clear();
-        logChanged = true;
-        lastLogSend = millis() - 1000;
+        stateOf(machine).clear();
     }
 }
\ No newline at end of file
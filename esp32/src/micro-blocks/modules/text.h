@@ -1,6 +1,11 @@
+#include "../machine.h"
+
 namespace textModule
 {
     void setup();
-    void loop();
-    void reset();
+    void loop(machine::Machine &machine);
+    void reset(machine::Machine &machine);
+
+    // time in microseconds until loop() has to run again, ULONG_MAX if it only has to run after an event
+    unsigned long idleTime(machine::Machine &machine);
 }
\ No newline at end of file
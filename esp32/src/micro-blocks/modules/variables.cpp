@@ -8,65 +8,51 @@ namespace variablesModule
     void setup()
     {
         // setVar32
-        machine::registerFunction(
-            4,
-            []()
+        machine::registerFunction<4>(
+            +[](machine::Machine &machine, uint16_t offset, uint32_t value)
             {
-                auto value = machine::popUint32();
-                auto offset = machine::popUint16();
-                *((uint32_t *)machine::variable(offset)) = value;
+                *((uint32_t *)machine.variable(offset)) = value;
             });
 
         // getVar32
-        machine::registerFunction(
-            5,
-            []()
+        machine::registerFunction<5>(
+            +[](machine::Machine &machine, uint16_t offset)
             {
-                auto offset = machine::popUint16();
-                machine::pushUint32(*((uint32_t *)machine::variable(offset)));
+                return *((uint32_t *)machine.variable(offset));
             });
 
         // variablesGetResourceHandle
-        machine::registerFunction(
-            28,
-            []()
+        machine::registerFunction<28>(
+            +[](machine::Machine &machine, uint16_t offset)
             {
-                auto offset = machine::popUint16();
-                auto value = *(resourcePool::ResourceHandleBase **)machine::variable(offset);
+                auto value = machine::StackValue<resourcePool::ResourceHandleBase *>::read(machine.variable(offset));
                 value->incRef();
-                machine::pushUint32(reinterpret_cast<uint32_t>(value));
+                return value;
             });
 
         // variablesSetResourceHandle
-        machine::registerFunction(
-            29,
-            []()
+        machine::registerFunction<29>(
+            +[](machine::Machine &machine, uint16_t offset, resourcePool::ResourceHandleBase *value)
             {
-                auto value = reinterpret_cast<resourcePool::ResourceHandleBase *>(machine::popUint32());
-                auto offset = machine::popUint16();
-                auto oldValue = *(resourcePool::ResourceHandleBase **)machine::variable(offset);
+                // handles are stored as 32 bit values, like on the stack
+                auto oldValue = machine::StackValue<resourcePool::ResourceHandleBase *>::read(machine.variable(offset));
                 if (oldValue != NULL)
                     oldValue->decRef();
-                *((resourcePool::ResourceHandleBase **)machine::variable(offset)) = value;
+                machine::StackValue<resourcePool::ResourceHandleBase *>::write(machine.variable(offset), value);
             });
 
         // variablesSetVar8
-        machine::registerFunction(
-            36,
-            []()
+        machine::registerFunction<36>(
+            +[](machine::Machine &machine, uint16_t offset, uint8_t value)
             {
-                auto value = machine::popUint8();
-                auto offset = machine::popUint16();
-                *((uint8_t *)machine::variable(offset)) = value;
+                *((uint8_t *)machine.variable(offset)) = value;
             });
 
         // variablesGetVar8
-        machine::registerFunction(
-            37,
-            []()
+        machine::registerFunction<37>(
+            +[](machine::Machine &machine, uint16_t offset)
             {
-                auto offset = machine::popUint16();
-                machine::pushUint8(*((uint8_t *)machine::variable(offset)));
+                return *((uint8_t *)machine.variable(offset));
             });
     }
 }
\ No newline at end of file
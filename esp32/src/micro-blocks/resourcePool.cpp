@@ -2,19 +2,23 @@
 
 namespace resourcePool
 {
-    std::set<ResourceHandleBase *> resources;
+    Pool::~Pool()
+    {
+        clear();
+    }
 
-    void removeResourceHandle(ResourceHandleBase *handle)
+    void Pool::remove(ResourceHandleBase *handle)
     {
         resources.erase(handle);
         delete handle;
     }
-    void addResourceHandle(ResourceHandleBase *handle)
+
+    void Pool::add(ResourceHandleBase *handle)
     {
         resources.insert(handle);
     }
 
-    void clearResources()
+    void Pool::clear()
     {
         for (auto resource : resources)
         {
@@ -1,20 +1,35 @@
 #pragma once
 #include <stdint.h>
 #include <set>
-#include <Arduino.h>
 
 namespace resourcePool
 {
     class ResourceHandleBase;
 
-    void removeResourceHandle(ResourceHandleBase *handle);
-    void addResourceHandle(ResourceHandleBase *handle);
-    void clearResources();
+    // The resources of one machine. A handle is removed when its last reference is dropped,
+    // the remaining ones when the pool is cleared or destroyed.
+    class Pool
+    {
+    public:
+        Pool() {}
+        ~Pool();
+
+        Pool(const Pool &) = delete;
+        Pool &operator=(const Pool &) = delete;
+
+        void add(ResourceHandleBase *handle);
+        void remove(ResourceHandleBase *handle);
+        void clear();
+
+    private:
+        std::set<ResourceHandleBase *> resources;
+    };
 
     class ResourceHandleBase
     {
     protected:
         uint16_t refCount;
+        Pool *pool;
 
     public:
         virtual ~ResourceHandleBase(){};
@@ -29,7 +44,7 @@ namespace resourcePool
             refCount--;
             if (refCount == 0)
             {
-                removeResourceHandle(this);
+                pool->remove(this);
             }
         }
     };
@@ -46,10 +61,11 @@ namespace resourcePool
             return *value;
         }
 
-        ResourceHandle(T *value)
+        ResourceHandle(Pool &pool, T *value)
         {
             this->value = value;
             this->refCount = 1;
+            this->pool = &pool;
         }
 
         ~ResourceHandle()
@@ -59,10 +75,10 @@ namespace resourcePool
     };
 
     template <typename T>
-    ResourceHandle<T> *resourceHandle(T *value)
+    ResourceHandle<T> *resourceHandle(Pool &pool, T *value)
     {
-        auto handle = new ResourceHandle<T>(value);
-        addResourceHandle(handle);
+        auto handle = new ResourceHandle<T>(pool, value);
+        pool.add(handle);
         return handle;
     }
 }
\ No newline at end of file
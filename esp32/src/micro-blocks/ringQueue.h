@@ -0,0 +1,72 @@
+#pragma once
+#include <stddef.h>
+#include <vector>
+
+// FIFO queue in a ring buffer. Unlike std::deque, it does not allocate or free memory while
+// values pass through, it only grows when it is full, thus at most a few times per program.
+template <typename T>
+class RingQueue
+{
+public:
+    RingQueue(size_t capacity = 0)
+        : values(capacity), head(0), count(0)
+    {
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    // make room for the given number of values, without allocating when they are pushed
+    void reserve(size_t capacity)
+    {
+        if (capacity > values.size())
+            grow(capacity);
+    }
+
+    void push_back(const T &value)
+    {
+        if (count == values.size())
+            grow(values.empty() ? 8 : values.size() * 2);
+        values[(head + count) % values.size()] = value;
+        count++;
+    }
+
+    T &front()
+    {
+        return values[head];
+    }
+
+    void pop_front()
+    {
+        head = (head + 1) % values.size();
+        count--;
+    }
+
+    // remove all values, keeping the memory
+    void clear()
+    {
+        head = 0;
+        count = 0;
+    }
+
+private:
+    void grow(size_t capacity)
+    {
+        std::vector<T> grown(capacity);
+        for (size_t i = 0; i < count; i++)
+            grown[i] = values[(head + i) % values.size()];
+        values.swap(grown);
+        head = 0;
+    }
+
+    std::vector<T> values;
+    size_t head;
+    size_t count;
+};
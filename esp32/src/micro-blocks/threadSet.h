@@ -0,0 +1,67 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+
+// Set of thread numbers, stored as a bitset. Memory is only allocated when a thread number
+// higher than all previous ones is inserted, thus at most a few times per program.
+class ThreadSet
+{
+public:
+    static const uint16_t NONE = 0xffff;
+
+    void insert(uint16_t threadNr)
+    {
+        size_t word = threadNr / 32;
+        if (word >= words.size())
+            words.resize(word + 1, 0);
+        words[word] |= 1u << (threadNr % 32);
+    }
+
+    void erase(uint16_t threadNr)
+    {
+        size_t word = threadNr / 32;
+        if (word < words.size())
+            words[word] &= ~(1u << (threadNr % 32));
+    }
+
+    bool contains(uint16_t threadNr) const
+    {
+        size_t word = threadNr / 32;
+        return word < words.size() && (words[word] & (1u << (threadNr % 32))) != 0;
+    }
+
+    // lowest thread number not below from, NONE if there is none
+    uint16_t first(uint16_t from = 0) const
+    {
+        return firstCommon(*this, *this, from);
+    }
+
+    // remove all threads, keeping the memory
+    void clear()
+    {
+        for (auto &word : words)
+            word = 0;
+    }
+
+    // lowest thread number not below from contained in both sets, NONE if there is none
+    static uint16_t firstCommon(const ThreadSet &a, const ThreadSet &b, uint16_t from = 0)
+    {
+        size_t wordCount = a.words.size() < b.words.size() ? a.words.size() : b.words.size();
+        size_t word = from / 32;
+        if (word >= wordCount)
+            return NONE;
+
+        // ignore the threads below from in the first word
+        uint32_t common = a.words[word] & b.words[word] & (~0u << (from % 32));
+        while (common == 0)
+        {
+            if (++word >= wordCount)
+                return NONE;
+            common = a.words[word] & b.words[word];
+        }
+        return word * 32 + __builtin_ctz(common);
+    }
+
+private:
+    std::vector<uint32_t> words;
+};
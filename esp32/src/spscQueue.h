@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+
+/// @brief Bounded lock-free queue between exactly one producer and one consumer task.
+/// Holds up to capacity values, neither side ever blocks or allocates.
+template <typename T, size_t capacity>
+class SpscQueue
+{
+public:
+    /// @brief Append a value. Returns false if the queue is full. Producer only.
+    bool push(const T &value)
+    {
+        size_t currentTail = tail.load(std::memory_order_relaxed);
+        size_t nextTail = next(currentTail);
+        if (nextTail == head.load(std::memory_order_acquire))
+            return false;
+        slots[currentTail] = value;
+        tail.store(nextTail, std::memory_order_release);
+        return true;
+    }
+
+    /// @brief Remove the oldest value. Returns false if the queue is empty. Consumer only.
+    bool pop(T &value)
+    {
+        size_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire))
+            return false;
+        value = slots[currentHead];
+        head.store(next(currentHead), std::memory_order_release);
+        return true;
+    }
+
+    /// @brief Slot to construct the next value in place, NULL if the queue is full. The
+    /// value becomes visible to the consumer with commit(). Producer only.
+    T *prepare()
+    {
+        size_t currentTail = tail.load(std::memory_order_relaxed);
+        if (next(currentTail) == head.load(std::memory_order_acquire))
+            return NULL;
+        return &slots[currentTail];
+    }
+
+    /// @brief Publish the value written to the slot returned by prepare(). Producer only.
+    void commit()
+    {
+        tail.store(next(tail.load(std::memory_order_relaxed)), std::memory_order_release);
+    }
+
+    /// @brief The oldest value in place, NULL if the queue is empty. The slot is not reused
+    /// before release() is called. Consumer only.
+    T *front()
+    {
+        size_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire))
+            return NULL;
+        return &slots[currentHead];
+    }
+
+    /// @brief Remove the value returned by front(). Consumer only.
+    void release()
+    {
+        head.store(next(head.load(std::memory_order_relaxed)), std::memory_order_release);
+    }
+
+private:
+    // one slot stays unused, to tell a full queue from an empty one
+    static const size_t SLOT_COUNT = capacity + 1;
+
+    static size_t next(size_t index)
+    {
+        return index + 1 == SLOT_COUNT ? 0 : index + 1;
+    }
+
+    T slots[SLOT_COUNT] = {};
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+};
@@ -2,8 +2,43 @@
 #include "systemStatus.h"
 #include "webServer.h"
 #include "AsyncJson.h"
+#include "micro-blocks/latency.h"
+#include "micro-blocks/modules/basic.h"
+#include "websocket.h"
+#include <mutex>
+
 namespace systemStatus
 {
+    // Statistics of the VM task, copied by update(). The request handler runs on the
+    // network core and only reads this copy.
+    typedef struct
+    {
+        latency::Histogram latencies[(int)latency::Source::COUNT];
+        uint32_t droppedEvents[(int)latency::Source::COUNT];
+        basicModule::PeriodicStatistics periodic;
+        basicModule::DispatchStatistics dispatch;
+        unsigned long dispatchBudget;
+    } VmStatus;
+
+    VmStatus vmStatus = {};
+    std::mutex vmStatusMutex;
+
+    void update(machine::Machine &machine)
+    {
+        VmStatus status;
+        for (int i = 0; i < (int)latency::Source::COUNT; i++)
+        {
+            status.latencies[i] = latency::histogram(machine, (latency::Source)i);
+            status.droppedEvents[i] = basicModule::droppedEvents(machine, (latency::Source)i);
+        }
+        status.periodic = basicModule::periodicStatistics(machine);
+        status.dispatch = basicModule::dispatchStatistics(machine);
+        status.dispatchBudget = basicModule::dispatchBudget;
+
+        std::lock_guard<std::mutex> lock(vmStatusMutex);
+        vmStatus = status;
+    }
+
     void setup()
     {
         webServer::server.on(
@@ -14,6 +49,36 @@ namespace systemStatus
                                              root["temperature"] = temperatureRead();
                                              root["hall"] = hallRead();
                                              root["freeHeap"] = esp_get_free_heap_size();
+                                             root["droppedMessages"] = websocket::droppedIncomingMessages;
+                                             VmStatus status;
+                                             {
+                                                 std::lock_guard<std::mutex> lock(vmStatusMutex);
+                                                 status = vmStatus;
+                                             }
+                                             JsonObject latencies = root.createNestedObject("latency");
+                                             for (int i = 0; i < (int)latency::Source::COUNT; i++)
+                                             {
+                                                 auto &histogram = status.latencies[i];
+                                                 JsonObject entry = latencies.createNestedObject(latency::name((latency::Source)i));
+                                                 entry["count"] = histogram.count;
+                                                 entry["max"] = histogram.max;
+                                                 entry["mean"] = histogram.count == 0 ? 0 : histogram.sum / histogram.count;
+                                                 JsonArray buckets = entry.createNestedArray("buckets");
+                                                 for (int b = 0; b < latency::BUCKET_COUNT; b++)
+                                                     buckets.add(histogram.buckets[b]);
+                                             }
+                                             JsonObject droppedEvents = root.createNestedObject("droppedEvents");
+                                             for (auto source : {latency::Source::CALLBACK, latency::Source::PIN_CHANGE, latency::Source::GRAVITY_SENSOR})
+                                                 droppedEvents[latency::name(source)] = status.droppedEvents[(int)source];
+                                             JsonObject periodic = root.createNestedObject("periodic");
+                                             periodic["overruns"] = status.periodic.overruns;
+                                             periodic["missedPeriods"] = status.periodic.missedPeriods;
+                                             JsonObject dispatch = root.createNestedObject("dispatch");
+                                             dispatch["budget"] = status.dispatchBudget;
+                                             dispatch["loops"] = status.dispatch.loops;
+                                             dispatch["resumptions"] = status.dispatch.resumptions;
+                                             dispatch["budgetExhausted"] = status.dispatch.budgetExhausted;
+                                             dispatch["maxLoopTime"] = status.dispatch.maxLoopTime;
                                              response->setLength();
                                              request->send(response); });
 
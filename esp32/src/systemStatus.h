@@ -1,6 +1,11 @@
 #pragma once
+#include "micro-blocks/machine.h"
 
 namespace systemStatus
 {
     void setup();
-}
\ No newline at end of file
+
+    // Copy the statistics of the machine and its modules for /api/systemStatus. They are updated
+    // while the program runs, thus only the task running the machine may call this.
+    void update(machine::Machine &machine);
+}
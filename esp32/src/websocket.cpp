@@ -1,6 +1,9 @@
 #include "websocket.h"
 #include "ESPAsyncWebServer.h"
 #include "webServer.h"
+#include "spscQueue.h"
+#include "micro-blocks/micro-blocks.h"
+#include <mutex>
 
 namespace websocket
 {
@@ -8,72 +11,92 @@ namespace websocket
 
     std::unordered_map<MessageType, MessageEntry> lastMessages;
 
-    void send(size_t wrappedMessageSize, uint8_t *wrappedMessageData)
+    // guards lastMessages, which is updated by the network task and read by the websocket task when a client connects
+    std::mutex lastMessagesMutex;
+
+    // Wrapped message passed between the task running the VM and the network tasks. The data
+    // is allocated by the producer and owned by the consumer once popped.
+    struct QueuedMessage
     {
-        MessageType type = *(MessageType *)wrappedMessageData;
-        auto entry = lastMessages.find(type);
-        if (entry != lastMessages.end())
-        {
-            if (!entry->second.dataManagedByClient)
-            {
-                free(entry->second.data);
-                entry->second.dataManagedByClient = true;
-                entry->second.dataSize = 0;
-            }
+        size_t size;
+        uint8_t *data;
+    };
 
-            entry->second.wrappedMessageSize = wrappedMessageSize;
-            entry->second.data = wrappedMessageData;
-        }
-        else
-        {
-            MessageEntry entry;
-            entry.dataSize = 0;
-            entry.wrappedMessageSize = wrappedMessageSize;
-            entry.data = wrappedMessageData;
-            entry.dataManagedByClient = true;
-            lastMessages.insert({type, entry});
-        }
+    SpscQueue<QueuedMessage, 16> outgoingMessages;
+
+    // Received messages are copied into preallocated slots, no memory is allocated per message.
+    // All incoming messages are small, larger ones are dropped.
+    const size_t MAX_INCOMING_MESSAGE_SIZE = 32;
+    const size_t INCOMING_QUEUE_SIZE = 64;
 
-        ws.binaryAll(wrappedMessageData, wrappedMessageSize);
+    struct IncomingMessage
+    {
+        size_t size;
+        uint8_t data[MAX_INCOMING_MESSAGE_SIZE];
+    };
+
+    SpscQueue<IncomingMessage, INCOMING_QUEUE_SIZE> incomingMessages;
+    volatile uint32_t droppedIncomingMessages = 0;
+
+    void send(size_t wrappedMessageSize, uint8_t *wrappedMessageData)
+    {
+        QueuedMessage message;
+        message.size = wrappedMessageSize;
+        message.data = (uint8_t *)malloc(wrappedMessageSize);
+        memcpy(message.data, wrappedMessageData, wrappedMessageSize);
+        if (!outgoingMessages.push(message))
+            free(message.data);
     }
 
     void send(MessageType type, size_t messageSize,
               uint8_t *messageData)
     {
-        size_t wrappedSize = sizeof(MessageType) + messageSize;
-        uint8_t *wrappedData;
-        auto entry = lastMessages.find(type);
-        if (entry != lastMessages.end())
+        QueuedMessage message;
+        message.size = sizeof(MessageType) + messageSize;
+        message.data = (uint8_t *)malloc(message.size);
+        *((MessageType *)message.data) = type;
+        memcpy(message.data + sizeof(MessageType), messageData, messageSize);
+        if (!outgoingMessages.push(message))
+            free(message.data);
+    }
+
+    // send the queued messages, remembering the last one of each type for clients connecting later
+    void sendQueued()
+    {
+        QueuedMessage message;
+        while (outgoingMessages.pop(message))
         {
-            if (entry->second.dataManagedByClient || entry->second.dataSize < wrappedSize)
+            MessageType type = *(MessageType *)message.data;
             {
-                if (!entry->second.dataManagedByClient)
+                std::lock_guard<std::mutex> lock(lastMessagesMutex);
+                auto entry = lastMessages.find(type);
+                if (entry != lastMessages.end())
                 {
                     free(entry->second.data);
+                    entry->second.wrappedMessageSize = message.size;
+                    entry->second.data = message.data;
+                }
+                else
+                {
+                    MessageEntry entry;
+                    entry.wrappedMessageSize = message.size;
+                    entry.data = message.data;
+                    lastMessages.insert({type, entry});
                 }
-                entry->second.dataSize = wrappedSize;
-                entry->second.data = (uint8_t *)malloc(wrappedSize);
-                entry->second.dataManagedByClient = false;
             }
 
-            entry->second.wrappedMessageSize = wrappedSize;
-            wrappedData = entry->second.data;
-        }
-        else
-        {
-            MessageEntry entry;
-            entry.dataSize = wrappedSize;
-            entry.wrappedMessageSize = wrappedSize;
-            entry.data = (uint8_t *)malloc(wrappedSize);
-            entry.dataManagedByClient = false;
-            lastMessages.insert({type, entry});
-            wrappedData = entry.data;
+            ws.binaryAll(message.data, message.size);
         }
+    }
 
-        *((MessageType *)wrappedData) = type;
-        memcpy(wrappedData + sizeof(MessageType), messageData, messageSize);
-
-        ws.binaryAll(wrappedData, wrappedSize);
+    bool lastMessage(MessageType type, std::vector<uint8_t> &data)
+    {
+        std::lock_guard<std::mutex> lock(lastMessagesMutex);
+        auto entry = lastMessages.find(type);
+        if (entry == lastMessages.end())
+            return false;
+        data.assign(entry->second.data + sizeof(MessageType), entry->second.data + entry->second.wrappedMessageSize);
+        return true;
     }
 
     void os_printf(const char *format, ...)
@@ -93,13 +116,42 @@ namespace websocket
 
     std::unordered_map<MessageType, std::function<void(uint8_t *data, size_t size)>> incomingMessageHandlers;
 
+    // invoked by the websocket task, the message is handled later by dispatchReceived()
     void messageReceived(uint8_t *data, size_t size)
     {
-        auto type = *(MessageType *)data;
-        auto handler = incomingMessageHandlers.find(type);
-        if (handler != incomingMessageHandlers.end())
+        if (size < sizeof(MessageType))
+            return;
+        if (size > MAX_INCOMING_MESSAGE_SIZE)
         {
-            handler->second(data + sizeof(MessageType), size - sizeof(MessageType));
+            Serial.println(String("Incoming message of ") + size + " bytes is too large, dropping it");
+            return;
+        }
+
+        IncomingMessage *message = incomingMessages.prepare();
+        if (message == NULL)
+        {
+            // counted only, printing would slow down the websocket task even further
+            droppedIncomingMessages++;
+            return;
+        }
+        message->size = size;
+        memcpy(message->data, data, size);
+        incomingMessages.commit();
+        microBlocks::wake();
+    }
+
+    void dispatchReceived()
+    {
+        IncomingMessage *message;
+        while ((message = incomingMessages.front()) != NULL)
+        {
+            auto type = *(MessageType *)message->data;
+            auto handler = incomingMessageHandlers.find(type);
+            if (handler != incomingMessageHandlers.end())
+            {
+                handler->second(message->data + sizeof(MessageType), message->size - sizeof(MessageType));
+            }
+            incomingMessages.release();
         }
     }
 
@@ -110,6 +162,7 @@ namespace websocket
             // client connected
             os_printf("ws[%s][%u] connect\n", server->url(), client->id());
 
+            std::lock_guard<std::mutex> lock(lastMessagesMutex);
             for (auto &entry : lastMessages)
             {
                 client->binary(entry.second.data, entry.second.wrappedMessageSize);
@@ -212,6 +265,7 @@ namespace websocket
 
     void loop()
     {
+        sendQueued();
         ws.cleanupClients();
     }
 }
\ No newline at end of file
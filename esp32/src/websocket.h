@@ -1,8 +1,10 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include <unordered_map>
 #include <functional>
+#include <vector>
 
 namespace websocket
 {
@@ -12,13 +14,12 @@ namespace websocket
         LOG_SNAPSHOT,
         UI_SNAPSHOT,
         BASIC_TRIGGER_CALLBACK,
+        PROFILE,
     };
 
     struct MessageEntry
     {
-        size_t dataSize;
         size_t wrappedMessageSize;
-        bool dataManagedByClient;
         uint8_t *data;
     };
 
@@ -36,14 +37,17 @@ namespace websocket
         }
     };
 
+    // Messages are sent by the network task. The send functions copy the message into the
+    // outgoing queue and return immediately, the message is dropped if the queue is full.
+
     /// @brief Send a message. The data is copied before sending
     void send(MessageType type, size_t messageSize,
               uint8_t *messageData);
 
-    /// @brief Send a message which already has a MessageType. The data is not copied.
+    /// @brief Send a message which already has a MessageType. The data is copied before sending
     void send(size_t wrappedMessageSize, uint8_t *wrappedMessageData);
 
-    /// @brief Send a message without copying the data
+    /// @brief Send a message which already has a MessageType
     template <typename T>
     void send(MessageWrapper<T> &message)
     {
@@ -60,7 +64,7 @@ namespace websocket
     template <typename T>
     void handle(MessageType type, std::function<void(T &message)> handler)
     {
-        incomingMessageHandlers.insert({type, [handler](uint8_t *data, size_t size)
+        incomingMessageHandlers.insert({type, [handler](uint8_t *data, size_t)
                                         {
                                             handler(*((T *)data));
                                         }});
@@ -71,6 +75,17 @@ namespace websocket
         incomingMessageHandlers.insert({type, handler});
     }
 
+    /// @brief Copy the data of the last message of a type which was sent, without its
+    /// MessageType. Returns false if none was sent yet. Safe to call from any task.
+    bool lastMessage(MessageType type, std::vector<uint8_t> &data);
+
+    /// @brief Number of received messages dropped because the queue of received messages was full
+    extern volatile uint32_t droppedIncomingMessages;
+
+    /// @brief Pass the messages received since the last call to their handlers. Handlers
+    /// are only invoked from here, thus from the task calling this function.
+    void dispatchReceived();
+
     void setup();
     void loop();
 }
\ No newline at end of file
@@ -1,13 +1,13 @@
 import { useEffect, useRef } from 'react';
 import Blockly, { BlocklyOptions } from 'blockly';
 import toolbox, { buttonCallbacks, toolboxCategoryCallbacks } from './toolbox';
-import compile, { setWorkspaceData, workspaceData } from './compiler/compile';
+import compile, { DebugInfo, blockAtOffset, setWorkspaceData, workspaceData } from './compiler/compile';
 import { toast } from 'react-toastify';
 import 'react-toastify/dist/ReactToastify.css';
 import { post, req } from './system/useData';
 import Sensor from './Sensor';
 import { DesktopDownloadIcon, DownloadIcon, PlayIcon, UploadIcon } from '@primer/octicons-react';
-import { useWebsocketEventHandler, useWebsocketState } from './websocket';
+import { MessageType, useWebsocketEventHandler, useWebsocketMessageHandler, useWebsocketState } from './websocket';
 import { collectBlockReferencesEventHandler } from './modules/blockReference';
 
 var options: BlocklyOptions = {
@@ -60,6 +60,35 @@ function WorkspaceUploadButton(props: { uploaded: (serializedWorkspace: string)
   </div>
 }
 
+// highlight the blocks receiving at least 10% of the samples of a profile message
+function highlightHotBlocks(workspace: Blockly.WorkspaceSvg, debugInfo: DebugInfo, message: DataView) {
+  if (debugInfo.blockRanges.length == 0)
+    return;
+  let pos = 1;
+  pos += 2 + message.getUint16(pos, true) * 16; // thread profiles
+  pos += 2 + message.getUint16(pos, true) * 14; // function number and profile
+  const sampleCount = message.getUint16(pos, true);
+  pos += 2;
+
+  const blockSamples: { [blockId: string]: number } = {};
+  let total = 0;
+  for (let i = 0; i < sampleCount; i++) {
+    const offset = message.getUint16(pos, true);
+    const count = message.getUint32(pos + 2, true);
+    pos += 6;
+    total += count;
+    const blockId = blockAtOffset(debugInfo, offset);
+    if (blockId !== undefined)
+      blockSamples[blockId] = (blockSamples[blockId] ?? 0) + count;
+  }
+
+  workspace.highlightBlock(null);
+  Object.entries(blockSamples).forEach(([blockId, count]) => {
+    if (count >= total / 10)
+      workspace.highlightBlock(blockId, true);
+  });
+}
+
 let workspaceState: { [key: string]: any } | undefined = undefined;
 let workspaceAlreadyLoadedFromDevice = false;
 
@@ -67,6 +96,13 @@ export default function Workspace() {
   const ref = useRef<HTMLDivElement>(null);
   const areaRef = useRef<HTMLDivElement>(null);
   const workspaceRef = useRef<Blockly.WorkspaceSvg | null>(null);
+  const debugInfoRef = useRef<DebugInfo>({ blockRanges: [] });
+
+  // sent by the device if compiled with MACHINE_PROFILE
+  useWebsocketMessageHandler(MessageType.PROFILE, message => {
+    if (workspaceRef.current !== null)
+      highlightHotBlocks(workspaceRef.current, debugInfoRef.current, message);
+  });
 
   const loadWorkspaceFromDevice = () => {
     if (workspaceAlreadyLoadedFromDevice) return;
@@ -174,7 +210,7 @@ export default function Workspace() {
       <button type="button" className="btn btn-secondary" onClick={saveWorkspaceToLocalStorage}>Save <DesktopDownloadIcon /></button>
       <button type="button" className="btn btn-primary" onClick={() => {
         saveWorkspaceToLocalStorage();
-        const code = compile(workspaceRef.current!);
+        const code = compile(workspaceRef.current!, debugInfoRef.current);
         if (code !== undefined) {
           // save('block.mb', new Blob([code]));
           const progress = toast("Uploading Code...");
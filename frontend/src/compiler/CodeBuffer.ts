@@ -1,5 +1,5 @@
 import { BlockCode, BlockType, VariableInfo } from "./blockCodeGenerator";
-import functionTable, { functionByNumber, functionCallers } from "./functionTable";
+import { functionByNumber, functionCallers } from "./functionTable";
 
 export interface FunctionInfos {
     [key: number]: {
@@ -14,6 +14,29 @@ export type CallArgument = { type: 'Boolean', value: boolean } | BlockCode<'Bool
     | { type: 'uint8', value: number }
     | BlockCode<'String'> | (VariableInfo & { type: 'String' });
 
+/** operations of the extended opcode page, available from code version 1. See VmSpecification.md */
+export const nativeOperations = {
+    add: { opcode: 0b00110000, stackDelta: -4 },
+    sub: { opcode: 0b00110001, stackDelta: -4 },
+    mul: { opcode: 0b00110010, stackDelta: -4 },
+    div: { opcode: 0b00110011, stackDelta: -4 },
+    eq: { opcode: 0b00110100, stackDelta: -7 },
+    neq: { opcode: 0b00110101, stackDelta: -7 },
+    lt: { opcode: 0b00110110, stackDelta: -7 },
+    lte: { opcode: 0b00110111, stackDelta: -7 },
+    gt: { opcode: 0b00111000, stackDelta: -7 },
+    gte: { opcode: 0b00111001, stackDelta: -7 },
+    and: { opcode: 0b00111010, stackDelta: -1 },
+    or: { opcode: 0b00111011, stackDelta: -1 },
+    not: { opcode: 0b00111100, stackDelta: 0 },
+    dup32: { opcode: 0b00111101, stackDelta: 4 },
+    drop32: { opcode: 0b00111110, stackDelta: -4 },
+};
+export type NativeOperation = keyof typeof nativeOperations;
+
+/** extended opcodes followed by a two byte offset of a global */
+export const loadGlobal32Opcode = 0b01110000;
+export const storeGlobal32Opcode = 0b01110001;
 
 export class CodeBuilder {
     segments: { start: number, end: number }[] = [];
@@ -41,6 +64,22 @@ export class CodeBuilder {
     }
 
 
+    /** translate ranges of the underlying buffer to ranges of the output of toBuffer() */
+    public outputRanges(ranges: BlockRange[]): BlockRange[] {
+        const result: BlockRange[] = [];
+        let pos = 0;
+        this.segments.forEach(segment => {
+            ranges.forEach(range => {
+                const start = Math.max(range.start, segment.start);
+                const end = Math.min(range.end, segment.end);
+                if (start < end)
+                    result.push({ blockId: range.blockId, start: pos + start - segment.start, end: pos + end - segment.start });
+            });
+            pos += segment.end - segment.start;
+        });
+        return result;
+    }
+
     public size(): number {
         return this.segments.map(x => x.end - x.start).reduce((a, b) => a + b, 0);
     }
@@ -145,7 +184,28 @@ export class CodeBuilder {
         return this;
     }
 
-    addCall(functionNumber: number, retType: BlockType | null, ...args: CallArgument[]) {
+    /** add a native operation, after pushing the arguments */
+    addNative(operation: NativeOperation, ...args: CallArgument[]) {
+        this.addArguments(args);
+        this.addUint8(nativeOperations[operation].opcode);
+        return this;
+    }
+
+    addLoadGlobal32(offset: number) {
+        this.addUint8(loadGlobal32Opcode);
+        this.addUint16(offset);
+        return this;
+    }
+
+    addStoreGlobal32(offset: number, value: CallArgument) {
+        this.addArguments([value]);
+        this.addUint8(storeGlobal32Opcode);
+        this.addUint16(offset);
+        return this;
+    }
+
+    /** push the arguments, returns the resulting (negative) stack delta */
+    private addArguments(args: CallArgument[]) {
         let stackDelta = 0;
         args.forEach(x => {
             switch (x.type) {
@@ -174,9 +234,9 @@ export class CodeBuilder {
                     if ('code' in x)
                         this.addSegment(x.code)
                     else if ('offset' in x) {
-                        this.addCall(functionTable.variablesGetVar32, null, { type: 'uint16', value: x.offset }) // r
-                        this.addCall(functionTable.variablesGetVar32, null, { type: 'uint16', value: x.offset + 4 }) // g
-                        this.addCall(functionTable.variablesGetVar32, null, { type: 'uint16', value: x.offset + 8 }) // b
+                        this.addLoadGlobal32(x.offset) // r
+                        this.addLoadGlobal32(x.offset + 4) // g
+                        this.addLoadGlobal32(x.offset + 8) // b
                     }
                     else if (x.value !== null) {
                         this.addPushFloat(x.value[0]);
@@ -199,6 +259,11 @@ export class CodeBuilder {
                     throw new Error("Unknown type " + (x as any).type);
             }
         });
+        return stackDelta;
+    }
+
+    addCall(functionNumber: number, retType: BlockType | null, ...args: CallArgument[]) {
+        let stackDelta = this.addArguments(args);
         this.addRawCall(functionNumber);
         switch (retType) {
             case 'Boolean': stackDelta++; break;
@@ -220,10 +285,19 @@ export class CodeBuilder {
     }
 }
 
+/** range of code generated by a block. Nested blocks have nested ranges */
+export interface BlockRange {
+    blockId: string
+    start: number
+    end: number
+}
+
 export class CodeBuffer {
     public data = new DataView(new ArrayBuffer(1 << 20)); // one megabyte should do for now, and should not hurt any device running a browser 
     public end = 0
     functionInfos: FunctionInfos = {}
+    /** ranges of the buffer written by each block */
+    blockRanges: BlockRange[] = []
 
     startSegment(action?: (code: CodeBuilder) => void) {
         const code = new CodeBuilder(this);
@@ -1,6 +1,6 @@
 import Blockly, { FieldVariable } from 'blockly';
 import functionTable, { functionByNumber, functionCallers } from './functionTable';
-import { CodeBuffer, CodeBuilder, FunctionInfos } from './CodeBuffer';
+import { BlockRange, CodeBuffer, CodeBuilder, FunctionInfos, NativeOperation, loadGlobal32Opcode, nativeOperations, storeGlobal32Opcode } from './CodeBuffer';
 import { BlockCodeGeneratorContext, BlockData, BlockType, ThreadCodeGenerator, VariableInfo, VariableInfos, blockRegistrations } from './blockCodeGenerator';
 import '../modules'
 import { loadString } from '../modules/text';
@@ -43,7 +43,9 @@ export function generateCodeForBlock<T extends BlockType>(type: T | undefined, b
         throw new Error("No code generator for block " + block.type)
     }
 
+    const start = buffer.end;
     const result = generator(block, buffer, type === undefined ? ctx : { ...ctx, expectedType: type });
+    buffer.blockRanges.push({ blockId: block.id, start, end: buffer.end });
     if (type !== undefined && result.type != type) {
         throw new Error("Expected block " + block.type + " to generate type " + type + " but got " + result.type);
     }
@@ -86,6 +88,9 @@ class StackSizeCalculator {
                 case "jump": this.process(instruction.jumpTarget, stackSize); return;
                 case "jz": pos = instruction.nextPc; stackSize--; this.process(instruction.jumpTarget, stackSize); break;
                 case "call": pos = instruction.nextPc; stackSize += this.functionInfos[instruction.functionNumber].stackDelta; break;
+                case "native": pos = instruction.nextPc; stackSize += nativeOperations[instruction.operation].stackDelta; break;
+                case "loadGlobal32": pos = instruction.nextPc; stackSize += 4; break;
+                case "storeGlobal32": pos = instruction.nextPc; stackSize -= 4; break;
             }
             if (stackSize > this.maxStackSize) {
                 this.maxStackSize = stackSize;
@@ -107,6 +112,8 @@ function decodeInstruction(code: DataView, pc: number): { nextPc: number } & (
     | { opcode: 'jump', offset: number, jumpTarget: number }
     | { opcode: 'jz', offset: number, jumpTarget: number }
     | { opcode: 'call', functionNumber: number }
+    | { opcode: 'native', operation: NativeOperation }
+    | { opcode: 'loadGlobal32' | 'storeGlobal32', offset: number }
 ) {
     function extractArgument(opcode: number, signed: boolean): number {
         let argument;
@@ -124,6 +131,17 @@ function decodeInstruction(code: DataView, pc: number): { nextPc: number } & (
     }
     const startPc = pc;
     const opcode = code.getUint8(pc++);
+    if ((opcode >> 4 & 0b11) == 0b11) {
+        // extended opcode
+        if (opcode == loadGlobal32Opcode || opcode == storeGlobal32Opcode) {
+            const offset = code.getUint16(pc, true);
+            return { nextPc: pc + 2, opcode: opcode == loadGlobal32Opcode ? 'loadGlobal32' : 'storeGlobal32', offset }
+        }
+        const operation = (Object.keys(nativeOperations) as NativeOperation[]).find(key => nativeOperations[key].opcode == opcode);
+        if (operation === undefined)
+            throw new Error("Invalid opcode " + opcode + " at pos " + startPc);
+        return { nextPc: pc, opcode: 'native', operation }
+    }
     switch (opcode >> 6 & 0b11) {
         case 0b00: {
             const count = extractArgument(opcode, false);
@@ -173,6 +191,9 @@ function disassemble(code: DataView, stackSizeCalculator: StackSizeCalculator) {
             case "jump": instr = "jump " + instruction.jumpTarget; break;
             case "jz": instr = "jz " + instruction.jumpTarget; break;
             case "call": instr = "call " + instruction.functionNumber + " (" + functionByNumber[instruction.functionNumber] + ")"; break;
+            case "native": instr = instruction.operation; break;
+            case "loadGlobal32":
+            case "storeGlobal32": instr = instruction.opcode + " " + instruction.offset; break;
             default: throw new Error("Unknown instruction " + (instruction as any).opcode + " at pos " + pos);
         }
         result.push(pos + ": " + instr + (stackSizeCalculator.stackSizes[pos] !== undefined ? " (SS:" + stackSizeCalculator.stackSizes[pos] + ")" : "")
@@ -183,7 +204,23 @@ function disassemble(code: DataView, stackSizeCalculator: StackSizeCalculator) {
     return result.join("\n");
 }
 
-export default function compile(workspace: Blockly.Workspace): ArrayBuffer | undefined {
+/** debug information about the compiled code */
+export interface DebugInfo {
+    /** code ranges generated by each block, as offsets in the output file */
+    blockRanges: BlockRange[]
+}
+
+/** find the innermost block containing the given offset in the output file */
+export function blockAtOffset(debugInfo: DebugInfo, offset: number): string | undefined {
+    let result: BlockRange | undefined;
+    debugInfo.blockRanges.forEach(range => {
+        if (range.start <= offset && offset < range.end && (result === undefined || range.end - range.start < result.end - result.start))
+            result = range;
+    });
+    return result?.blockId;
+}
+
+export default function compile(workspace: Blockly.Workspace, debugInfo?: DebugInfo): ArrayBuffer | undefined {
     try {
         const buffer = new CodeBuffer();
 
@@ -291,7 +328,7 @@ export default function compile(workspace: Blockly.Workspace): ArrayBuffer | und
         const code = buffer.startSegment();
         code.addUint8(0x4d);
         code.addUint8(0x42);
-        code.addUint8(0);
+        code.addUint8(1); // version
         code.addUint16(threads.length);
         code.addUint16(stackOffset);
 
@@ -306,6 +343,8 @@ export default function compile(workspace: Blockly.Workspace): ArrayBuffer | und
 
         threads.forEach(thread => code.addSegment(thread.code!));
 
+        if (debugInfo !== undefined)
+            debugInfo.blockRanges = code.outputRanges(buffer.blockRanges);
 
         return code.toBuffer();
     } catch (e) {
@@ -1,4 +1,4 @@
-import { CallArgument, CodeBuilder } from "./CodeBuffer";
+import { CallArgument, CodeBuilder, NativeOperation } from "./CodeBuffer";
 import { VariableInfo } from "./compile";
 
 const functionTable = {
@@ -53,6 +53,21 @@ const functionTable = {
     rgbLedSetColour: 49,
     rgbShow: 50,
     rgbSetBitmap: 51,
+    basicSetupPeriodic: 52,
+    basicSetPriority: 53,
+    basicSetEventQueue: 54,
+    basicEventAge: 55,
+    pinEventState: 56,
+    basicBackgroundThread: 57,
+    basicRunInBackground: 58,
+    basicBackgroundArgument: 59,
+    channelSetup: 60,
+    channelWaitSlot: 61,
+    channelSendNumber: 62,
+    channelWaitValue: 63,
+    channelReceiveNumber: 64,
+    channelSendHandle: 65,
+    channelReceiveHandle: 66,
 } as const
 
 const mathUnaryOperationTable = {
@@ -76,14 +91,19 @@ const mathBinaryOperationTable =
 }
 
 export const functionCallers = {
-    variablesSetVar32: (buffer: CodeBuilder, variable: VariableInfo & { type: 'Number' }, value: CallArgument & { type: 'Number' }) => buffer.addCall(functionTable.variablesSetVar32, null, { type: 'uint16', value: variable.offset }, value),
+    variablesSetVar32: (buffer: CodeBuilder, variable: VariableInfo & { type: 'Number' }, value: CallArgument & { type: 'Number' }) => buffer.addStoreGlobal32(variable.offset, value),
     colourSetVar: (buffer: CodeBuilder, variable: VariableInfo & { type: 'Colour' }, value: CallArgument & { type: 'Colour' }) => buffer.addCall(functionTable.colourSetVar, null, { type: 'uint16', value: variable.offset }, value),
     variablesSetVar8: (buffer: CodeBuilder, variable: VariableInfo & { type: 'Boolean' }, value: CallArgument & { type: 'Boolean' }) => buffer.addCall(functionTable.variablesSetVar8, null, { type: 'uint16', value: variable.offset }, value),
     variablesSetResourceHandle: (buffer: CodeBuilder, variable: VariableInfo, value: CallArgument & { type: 'String' }) => buffer.addCall(functionTable.variablesSetResourceHandle, null, { type: 'uint16', value: variable.offset }, value),
-    logicNegate: (buffer: CodeBuilder, a: CallArgument & { type: 'Boolean' }) => buffer.addCall(functionTable.logicNegate, 'Boolean', a),
-    mathBinary: (buffer: CodeBuilder, left: CallArgument & { type: 'Number' }, right: CallArgument & { type: 'Number' }, op: keyof typeof mathBinaryOperationTable) => buffer.addCall(functionTable.mathBinary, 'Number', left, right, { type: 'uint8', value: mathBinaryOperationTable[op] as number }),
-    logicCompare: (buffer: CodeBuilder, a: CallArgument & { type: 'Number' }, b: CallArgument & { type: 'Number' }, op: 'EQ' | 'NEQ' | 'LT' | 'LTE' | 'GT' | 'GTE') => buffer.addCall(functionTable.logicCompare, 'Boolean', a, b, { type: 'uint8', value: { EQ: 0, NEQ: 1, LT: 2, LTE: 3, GT: 4, GTE: 5 }[op] }),
-    variablesGetVar32: (buffer: CodeBuilder, variable: VariableInfo & { type: 'Number' }) => buffer.addCall(functionTable.variablesGetVar32, variable.type, { type: 'uint16', value: variable.offset }),
+    logicNegate: (buffer: CodeBuilder, a: CallArgument & { type: 'Boolean' }) => buffer.addNative('not', a),
+    mathBinary: (buffer: CodeBuilder, left: CallArgument & { type: 'Number' }, right: CallArgument & { type: 'Number' }, op: keyof typeof mathBinaryOperationTable) => {
+        const native = ({ ADD: 'add', MINUS: 'sub', MULTIPLY: 'mul', DIVIDE: 'div' } as { [key: string]: NativeOperation | undefined })[op];
+        if (native !== undefined)
+            return buffer.addNative(native, left, right);
+        return buffer.addCall(functionTable.mathBinary, 'Number', left, right, { type: 'uint8', value: mathBinaryOperationTable[op] as number });
+    },
+    logicCompare: (buffer: CodeBuilder, a: CallArgument & { type: 'Number' }, b: CallArgument & { type: 'Number' }, op: 'EQ' | 'NEQ' | 'LT' | 'LTE' | 'GT' | 'GTE') => buffer.addNative(({ EQ: 'eq', NEQ: 'neq', LT: 'lt', LTE: 'lte', GT: 'gt', GTE: 'gte' } as const)[op], a, b),
+    variablesGetVar32: (buffer: CodeBuilder, variable: VariableInfo & { type: 'Number' }) => buffer.addLoadGlobal32(variable.offset),
     variablesGetVar8: (buffer: CodeBuilder, variable: VariableInfo & { type: 'Boolean' }) => buffer.addCall(functionTable.variablesGetVar8, variable.type, { type: 'uint16', value: variable.offset }),
     variablesGetResourceHandle: (buffer: CodeBuilder, variable: VariableInfo & { type: 'String' }) => buffer.addCall(functionTable.variablesGetResourceHandle, variable.type, { type: 'uint16', value: variable.offset }),
     mathUnary: (buffer: CodeBuilder, num: CallArgument & { type: 'Number' },
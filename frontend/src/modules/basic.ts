@@ -18,6 +18,20 @@ addCategory({
             'type': 'basic_forever',
             'kind': 'block',
         },
+        {
+            'type': 'basic_every',
+            'kind': 'block',
+            'inputs': {
+                'PERIOD': {
+                    'shadow': {
+                        'type': 'math_number',
+                        'fields': {
+                            'NUM': 20,
+                        },
+                    }
+                },
+            }
+        },
         {
             'type': 'basic_delay',
             'kind': 'block',
@@ -32,6 +46,36 @@ addCategory({
                 },
             }
         },
+        {
+            'type': 'basic_run_in_background',
+            'kind': 'block',
+            'inputs': {
+                'ARGUMENT': {
+                    'shadow': {
+                        'type': 'math_number',
+                        'fields': {
+                            'NUM': 0,
+                        },
+                    }
+                },
+            }
+        },
+        {
+            'type': 'basic_background_argument',
+            'kind': 'block',
+        },
+        {
+            'type': 'basic_set_priority',
+            'kind': 'block',
+        },
+        {
+            'type': 'basic_event_queue',
+            'kind': 'block',
+        },
+        {
+            'type': 'basic_event_age',
+            'kind': 'block',
+        },
     ]
 });
 
@@ -83,6 +127,38 @@ registerBlock('basic_forever', {
     })
 });
 
+Blockly.Blocks['basic_every'] = {
+    init: function () {
+        this.appendDummyInput()
+            .appendField("Every");
+        this.appendValueInput("PERIOD")
+            .setCheck("Number");
+        this.appendDummyInput()
+            .appendField("ms");
+        this.appendStatementInput("BODY")
+            .setCheck(null);
+        this.setInputsInline(true);
+        this.setColour(180);
+        this.setTooltip("Runs the body at a fixed rate, independent of the time the body takes");
+        this.setHelpUrl("");
+    }
+};
+
+registerBlock('basic_every', {
+    threadExtractor: (block, addThread) => addThread((buffer, ctx) => {
+        const period = generateCodeForBlock('Number', block.getInputTargetBlock('PERIOD'), buffer, ctx);
+
+        // the thread registers once, then waits for the start of each period
+        const body = buffer.startSegment()
+            .addCall(functionTable.basicCallbackReady, null)
+            .addSegment(generateCodeForSequence(block.getInputTargetBlock('BODY'), buffer, ctx));
+        return buffer.startSegment()
+            .addCall(functionTable.basicSetupPeriodic, null, period)
+            .addSegment(body)
+            .addJump(-body.size());
+    })
+});
+
 Blockly.Blocks['basic_delay'] = {
     init: function () {
         this.appendDummyInput()
@@ -105,3 +181,123 @@ registerBlock('basic_delay', {
         return { type: null, code: buffer.startSegment().addCall(functionTable.basicDelay, null, value) };
     }
 });
+
+const priorityMap = { BACKGROUND: 0, NORMAL: 1, INTERACTIVE: 2 }
+
+registerBlock('basic_set_priority', {
+    block: {
+        init: function (this: Blockly.BlockSvg) {
+            this.appendDummyInput()
+                .appendField("Set Priority")
+                .appendField(new Blockly.FieldDropdown([['background', 'BACKGROUND'], ['normal', 'NORMAL'], ['interactive', 'INTERACTIVE']]) as Blockly.Field<string | undefined>, "PRIORITY");
+            this.setColour(180);
+            this.setTooltip("Sets the priority of the current thread. Runnable threads of higher priority run first, background threads run with a shorter time slice");
+            this.setHelpUrl("");
+            this.setPreviousStatement(true, null);
+            this.setNextStatement(true, null);
+        }
+    },
+    codeGenerator: (block, buffer, ctx) => {
+        const priority = block.getFieldValue('PRIORITY') as keyof typeof priorityMap;
+        return { type: null, code: buffer.startSegment().addCall(functionTable.basicSetPriority, null, { type: 'uint8', value: priorityMap[priority] }) };
+    }
+});
+
+const eventPolicyMap = { COALESCE: 0, QUEUE: 1, DROP_OLDEST: 2 }
+
+registerBlock('basic_event_queue', {
+    block: {
+        init: function (this: Blockly.BlockSvg) {
+            this.appendDummyInput()
+                .appendField("Queue Events")
+                .appendField(new Blockly.FieldDropdown([['coalesce', 'COALESCE'], ['queue', 'QUEUE'], ['drop oldest', 'DROP_OLDEST']]) as Blockly.Field<string | undefined>, "POLICY")
+                .appendField("Depth")
+                .appendField(new Blockly.FieldNumber(8, 1, 255, 1), "DEPTH");
+            this.setColour(180);
+            this.setTooltip("Sets how events arriving while this event handler is busy are kept: coalesced into a single event, queued up to the depth dropping further events, or queued dropping the oldest events. Place it first in the handler, it applies from the next event on");
+            this.setHelpUrl("");
+            this.setPreviousStatement(true, null);
+            this.setNextStatement(true, null);
+        }
+    },
+    codeGenerator: (block, buffer, ctx) => {
+        const policy = block.getFieldValue('POLICY') as keyof typeof eventPolicyMap;
+        return {
+            type: null, code: buffer.startSegment().addCall(functionTable.basicSetEventQueue, null,
+                { type: 'uint8', value: eventPolicyMap[policy] },
+                { type: 'uint8', value: block.getFieldValue('DEPTH') })
+        };
+    }
+});
+
+registerBlock('basic_event_age', {
+    block: {
+        init: function (this: Blockly.BlockSvg) {
+            this.appendDummyInput()
+                .appendField("Event Age ms");
+            this.setOutput(true, 'Number');
+            this.setColour(180);
+            this.setTooltip("Time since the event handled by this event handler happened");
+            this.setHelpUrl("");
+        }
+    },
+    codeGenerator: (block, buffer, ctx) => {
+        return { type: 'Number', code: buffer.startSegment().addCall(functionTable.basicEventAge, 'Number') };
+    }
+});
+
+interface RunInBackgroundData {
+    thread: number,
+}
+
+registerBlock('basic_run_in_background', {
+    block: {
+        init: function (this: Blockly.BlockSvg) {
+            this.appendValueInput("ARGUMENT")
+                .setCheck("Number")
+                .appendField("Run In Background with argument");
+            this.appendStatementInput("BODY")
+                .setCheck(null);
+            this.setColour(180);
+            this.setTooltip("Starts a new thread running the body, while the current thread continues. The body can be running several times at once, each with its own argument");
+            this.setHelpUrl("");
+            this.setPreviousStatement(true, null);
+            this.setNextStatement(true, null);
+        }
+    },
+    threadExtractor: (block, addThread, ctx) => {
+        // template of the spawned threads, the thread of the program itself stops at the first call
+        const data: RunInBackgroundData = {
+            thread: addThread((buffer, ctx) => buffer.startSegment()
+                .addCall(functionTable.basicBackgroundThread, null)
+                .addSegment(generateCodeForSequence(block.getInputTargetBlock('BODY'), buffer, ctx))
+                .addCall(functionTable.basicEndThread, null))
+        };
+        ctx.blockData.set(block, data);
+    },
+    codeGenerator: (block, buffer, ctx) => {
+        const data = ctx.blockData.get(block) as RunInBackgroundData;
+        const argument = generateCodeForBlock('Number', block.getInputTargetBlock('ARGUMENT'), buffer, ctx);
+        return {
+            type: null, code: buffer.startSegment().addCall(functionTable.basicRunInBackground, null,
+                { type: 'uint16', value: data.thread },
+                argument)
+        };
+    }
+});
+
+registerBlock('basic_background_argument', {
+    block: {
+        init: function (this: Blockly.BlockSvg) {
+            this.appendDummyInput()
+                .appendField("Background Argument");
+            this.setOutput(true, 'Number');
+            this.setColour(180);
+            this.setTooltip("Within a body run in background, the argument it was started with");
+            this.setHelpUrl("");
+        }
+    },
+    codeGenerator: (block, buffer, ctx) => {
+        return { type: 'Number', code: buffer.startSegment().addCall(functionTable.basicBackgroundArgument, 'Number') };
+    }
+});
@@ -0,0 +1,144 @@
+import { generateCodeForBlock, registerBlock } from "../compiler/compile";
+import Blockly, { BlockSvg } from 'blockly';
+import { addCategory, toolboxCategoryCallbacks } from "../toolbox";
+import functionTable from "../compiler/functionTable";
+import { anyBlockOfType, blockReferenceDropdown, onchangeUpdateBlockReference } from "./blockReference";
+import { BlockInfo } from "blockly/core/utils/toolbox";
+
+toolboxCategoryCallbacks.channel = (workspace) => {
+    const channelAvailable = anyBlockOfType('channel_config');
+    return [
+        {
+            'type': 'channel_config',
+            'kind': 'block',
+        },
+        {
+            'type': 'channel_send',
+            'kind': 'block',
+            enabled: channelAvailable,
+            'inputs': {
+                'VALUE': {
+                    'shadow': {
+                        'type': 'math_number',
+                        'fields': {
+                            'NUM': 0,
+                        },
+                    }
+                },
+            }
+        },
+        {
+            'type': 'channel_receive',
+            'kind': 'block',
+            enabled: channelAvailable,
+        },
+    ] as BlockInfo[];
+};
+
+addCategory({
+    'kind': 'category',
+    'name': 'Channels',
+    'colour': "#a55b80",
+    'custom': 'channel'
+});
+
+interface ChannelData {
+    id: number,
+    type: 'Number' | 'String',
+}
+
+registerBlock('channel_config', {
+    block: {
+        init: function () {
+            this.appendEndRowInput()
+                .appendField("Channel")
+                .appendField(new Blockly.FieldTextInput("Channel"), "NAME");
+            this.appendEndRowInput()
+                .appendField("Type")
+                .appendField(new Blockly.FieldDropdown([["number", "Number"], ["text", "String"]]), "TYPE")
+                .appendField("Capacity")
+                .appendField(new Blockly.FieldNumber(8, 1, 255, 1), "CAPACITY");
+            this.setColour(330);
+            this.setTooltip("A queue passing values between threads. Receiving waits until a value is available, sending waits while the channel is full");
+            this.setHelpUrl("");
+        }
+    },
+    referenceableBy: 'NAME',
+    initGenerator: (block, buffer, ctx) => {
+        const data: ChannelData = { id: ctx.nextId(), type: block.getFieldValue('TYPE') };
+        ctx.blockData.set(block, data);
+        return buffer.startSegment().addCall(functionTable.channelSetup, null,
+            { type: 'uint16', value: data.id },
+            { type: 'Number', value: block.getFieldValue('CAPACITY') },
+            { type: 'uint8', value: data.type === 'String' ? 1 : 0 },
+        );
+    }
+});
+
+registerBlock('channel_send', {
+    block: {
+        init: function (this: BlockSvg) {
+            this.appendValueInput("VALUE")
+                .setCheck(["Number", "String"])
+                .appendField("Send");
+            this.appendDummyInput()
+                .appendField("to")
+                .appendField<string>(blockReferenceDropdown('channel_config'), "CHANNEL");
+            this.setInputsInline(true);
+            this.setPreviousStatement(true, null);
+            this.setNextStatement(true, null);
+            this.setColour(330);
+            this.setTooltip("Send a value to a channel, waiting while the channel is full");
+            this.setHelpUrl("");
+        },
+
+        onchange: function (this: Blockly.BlockSvg, event: Blockly.Events.Abstract) {
+            onchangeUpdateBlockReference(this, event, 'CHANNEL', 'channel_config');
+        }
+    },
+
+    codeGenerator: (block, buffer, ctx) => {
+        const data = ctx.blockData.getByBlockId(block.getFieldValue('CHANNEL')) as ChannelData;
+        const id = { type: 'uint16', value: data.id } as const;
+        const value = generateCodeForBlock(data.type, block.getInputTargetBlock('VALUE'), buffer, ctx);
+        // The value is evaluated before waiting for a free slot: evaluating it might wait as
+        // well, for example to receive from another channel, while holding a reserved slot.
+        const valueThenSlot = {
+            type: value.type, code: buffer.startSegment()
+                .addSegment(value.code)
+                .addCall(functionTable.channelWaitSlot, null, id)
+        };
+        return {
+            type: null, code: buffer.startSegment()
+                .addCall(data.type === 'String' ? functionTable.channelSendHandle : functionTable.channelSendNumber, null, id, valueThenSlot)
+        };
+    }
+});
+
+registerBlock('channel_receive', {
+    block: {
+        init: function (this: BlockSvg) {
+            this.appendDummyInput()
+                .appendField("Receive from")
+                .appendField<string>(blockReferenceDropdown('channel_config'), "CHANNEL");
+            this.setOutput(true, ["Number", "String"]);
+            this.setColour(330);
+            this.setTooltip("Receive the oldest value of a channel, waiting until one is available");
+            this.setHelpUrl("");
+        },
+
+        onchange: function (this: Blockly.BlockSvg, event: Blockly.Events.Abstract) {
+            onchangeUpdateBlockReference(this, event, 'CHANNEL', 'channel_config');
+        }
+    },
+
+    codeGenerator: (block, buffer, ctx) => {
+        const data = ctx.blockData.getByBlockId(block.getFieldValue('CHANNEL')) as ChannelData;
+        const id = { type: 'uint16', value: data.id } as const;
+        return {
+            type: data.type, code: buffer.startSegment()
+                .addCall(functionTable.channelWaitValue, null, id)
+                .addCall(data.type === 'String' ? functionTable.channelReceiveHandle : functionTable.channelReceiveNumber, data.type, id)
+        };
+    }
+});
@@ -91,7 +91,7 @@ registerBlock('controls_repeat_ext', {
                 code.addSegment(times.code);
                 code.addSegment(main);
                 code.addJz(-main.size());
-                code.addCall(functionTable.basicPop32, null, { type: 'Number', code: buffer.startSegment() })
+                code.addNative('drop32')
             })
         };
     }
@@ -142,7 +142,7 @@ registerBlock('controls_whileUntil', {
 
         let condition: CodeBuilder;
         if (mode === 'WHILE') {
-            condition = buffer.startSegment(code => code.addCall(functionTable.logicNegate, 'Boolean', conditionBlock));
+            condition = buffer.startSegment(code => code.addNative('not', conditionBlock));
         }
         else {
             condition = conditionBlock.code;
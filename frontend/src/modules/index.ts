@@ -10,5 +10,6 @@ import './text'
 import './colour'
 import './gui'
 import './variables'
+import './channel'
 
 addDefaultCategories();
\ No newline at end of file
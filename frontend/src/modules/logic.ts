@@ -1,5 +1,5 @@
 import { generateCodeForBlock, registerBlock } from "../compiler/compile";
-import functionTable, { functionCallers } from "../compiler/functionTable";
+import { functionCallers } from "../compiler/functionTable";
 import { addCategory } from "../toolbox";
 
 addCategory({
@@ -64,7 +64,7 @@ registerBlock('logic_operation', {
         const op = block.getFieldValue('OP') as 'AND' | 'OR';
         const a = generateCodeForBlock('Boolean', block.getInputTargetBlock('A'), buffer, ctx);
         const b = generateCodeForBlock('Boolean', block.getInputTargetBlock('B'), buffer, ctx);
-        return { type: "Boolean", code: buffer.startSegment().addCall(functionTable.logicOperation, 'Boolean', a, b, { type: 'uint8', value: { AND: 0, OR: 1 }[op] }) };
+        return { type: "Boolean", code: buffer.startSegment().addNative(({ AND: 'and', OR: 'or' } as const)[op], a, b) };
     }
 });
 
@@ -55,6 +55,10 @@ addCategory({
         {
             'type': 'pin_read_analog',
             'kind': 'block'
+        },
+        {
+            'type': 'pin_event_state',
+            'kind': 'block'
         }
     ]
 });
@@ -165,4 +169,21 @@ registerBlock('pin_read_analog', {
     codeGenerator: (block, buffer, ctx) => {
         return { type: 'Number', code: buffer.startSegment().addCall(functionTable.pinReadAnalog, 'Number', { type: 'uint8', value: block.getFieldValue('PIN') }) }
     }
-});
\ No newline at end of file
+});
+
+Blockly.Blocks['pin_event_state'] = {
+    init: function () {
+        this.appendDummyInput()
+            .appendField("Pin State After Change");
+        this.setOutput(true, "Boolean");
+        this.setColour(230);
+        this.setTooltip("Within a pin change handler, the state of the pin after the handled change");
+        this.setHelpUrl("");
+    }
+};
+
+registerBlock('pin_event_state', {
+    codeGenerator: (block, buffer, ctx) => {
+        return { type: 'Boolean', code: buffer.startSegment().addCall(functionTable.pinEventState, 'Boolean') }
+    }
+});
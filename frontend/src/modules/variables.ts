@@ -1,7 +1,7 @@
 import { generateCodeForBlock, registerBlock } from "../compiler/compile";
 import Blockly, { FlyoutButton, Msg, Variables, WorkspaceSvg } from 'blockly';
 import { addCategory, toolboxCategoryCallbacks } from "../toolbox";
-import functionTable, { functionCallers } from "../compiler/functionTable";
+import { functionCallers } from "../compiler/functionTable";
 
 addCategory(
     {
@@ -84,9 +84,9 @@ registerBlock('variables_get_dynamic', {
         else if (variable.is("Boolean"))
             functionCallers.variablesGetVar8(code, variable);
         else if (variable.is("Colour")) {
-            code.addCall(functionTable.variablesGetVar32, 'Number', { type: 'uint16', value: variable.offset }); // r
-            code.addCall(functionTable.variablesGetVar32, 'Number', { type: 'uint16', value: variable.offset + 4 }); // g
-            code.addCall(functionTable.variablesGetVar32, 'Number', { type: 'uint16', value: variable.offset + 8 }); // b
+            code.addLoadGlobal32(variable.offset); // r
+            code.addLoadGlobal32(variable.offset + 4); // g
+            code.addLoadGlobal32(variable.offset + 8); // b
         }
         else if (variable.is("String"))
             functionCallers.variablesGetResourceHandle(code, variable);
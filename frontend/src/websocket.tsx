@@ -7,6 +7,7 @@ export enum MessageType {
     LOG_SNAPSHOT = 1,
     UI_SNAPSHOT = 2,
     BASIC_TRIGGER_CALLBACK = 3,
+    PROFILE = 4,
 
 }
 